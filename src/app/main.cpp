@@ -24,8 +24,10 @@
 ****************************************************************************/
 
 #include "application.h"
+#include <buildserver.h>
 #include <helperfunctions.h>
 #include <jobserver.h>
+#include <jobtokenpool.h>
 #include <options.h>
 #include <parser.h>
 #include <preprocessor.h>
@@ -75,10 +77,26 @@ static void showUsage()
            "/X <filename> write stderr to file.\n"
            "/Y disable batch mode inference rules\n\n"
            "jom only options:\n"
+           "/CLIENT let the build server of the current directory build, if one is\n"
+           "        running\n"
+           "/COMBINETARGETS build all command line targets in parallel instead of\n"
+           "                one after another\n"
+           "/CONTENTHASH treat targets as up-to-date if the contents of their dependents\n"
+           "             didn't change, using the hashes recorded in <makefile>.jomhashes\n"
+           "/CRITICALPATH start targets on the longest path first, using the command\n"
+           "              durations recorded in <makefile>.jomlog\n"
            "/DUMPGRAPH show the generated dependency graph\n"
            "/DUMPGRAPHDOT dump dependency graph in dot format\n"
+           "/GNUJOBSERVER pass the job server to GNU make compatible tools in MAKEFLAGS\n"
+           "/INPROCESSMAKE run recursive $(MAKE) calls inside this jom process\n"
            "/J <n> use up to n processes in parallel\n"
-           "/VERSION print version and exit\n");
+           "/PARSECACHE cache the parsed makefile in <makefile>.jomcache\n"
+           "/SERVER keep parsed makefiles and file information in memory, and build\n"
+           "        for /CLIENT calls in the current directory until terminated\n"
+           "/SHELLPOOL keep one shell per job running for commands that need a shell\n"
+           "/VERSION print version and exit\n"
+           "/WATCH keep running after the build, and build again when dependents\n"
+           "       change\n");
 }
 
 static TargetExecutor* g_pTargetExecutor = 0;
@@ -102,17 +120,35 @@ QStringList getCommandLineArguments()
     QStringList commandLineArguments = qApp->arguments().mid(1);
     QString makeFlags = qGetEnvironmentVariable(L"JOMFLAGS");
     if (makeFlags.isEmpty())
-        makeFlags = qGetEnvironmentVariable(L"MAKEFLAGS");
+        makeFlags = JobServer::jomFlagsFromMakeFlags(qGetEnvironmentVariable(L"MAKEFLAGS"));
     if (!makeFlags.isEmpty())
         commandLineArguments.prepend(QLatin1Char('/') + makeFlags);
     return commandLineArguments;
 }
 
-static bool initJobServer(const Application &app, ProcessEnvironment *environment,
-                          JobServer **outJobServer)
+static bool initJobServer(const Application &app, const Options *options,
+                          ProcessEnvironment *environment, JobServer **outJobServer)
 {
+    bool isJobServerClient = app.isSubJOM();
+    const QString inheritedMakeFlags = qGetEnvironmentVariable(L"MAKEFLAGS");
+    const QString inheritedAuth = JobServer::authFromMakeFlags(inheritedMakeFlags);
+    if (!isJobServerClient && !inheritedAuth.isEmpty()) {
+        // We've been started by GNU make or another tool that supports its job server.
+        JobTokenPool tokenPool;
+        if (tokenPool.open(inheritedAuth)) {
+            isJobServerClient = true;
+            environment->insert(QLatin1String("_JOMSRVKEY_"), inheritedAuth);
+            const int n = JobServer::jobCountFromMakeFlags(inheritedMakeFlags);
+            if (n > 0)
+                environment->insert(QLatin1String("_JOMJOBCOUNT_"), QString::number(n));
+        } else {
+            fprintf(stderr, "jom: Cannot use the job server from MAKEFLAGS: %s\n",
+                    qPrintable(tokenPool.errorString()));
+        }
+    }
+
     bool mustCreateJobServer = false;
-    if (app.isSubJOM()) {
+    if (isJobServerClient) {
         int inheritedMaxNumberOfJobs = g_options.maxNumberOfJobs;
         const QString str = environment->value(QLatin1String("_JOMJOBCOUNT_"));
         if (!str.isEmpty()) {
@@ -133,32 +169,63 @@ static bool initJobServer(const Application &app, ProcessEnvironment *environmen
         mustCreateJobServer = true;
     }
 
+    // Tools that got the job server from MAKEFLAGS expect their children to get it as well.
+    const bool advertiseInMakeFlags = options->advertiseJobServer || !inheritedAuth.isEmpty();
     if (mustCreateJobServer) {
         JobServer *jobServer = new JobServer(environment);
         *outJobServer = jobServer;
-        if (!jobServer->start(g_options.maxNumberOfJobs)) {
+        if (!jobServer->start(g_options.maxNumberOfJobs, advertiseInMakeFlags)) {
             fprintf(stderr, "Cannot start job server: %s.", qPrintable(jobServer->errorString()));
             return false;
         }
+    } else if (advertiseInMakeFlags) {
+        // Our MAKEFLAGS macro has replaced the inherited value in the environment.
+        const QString auth = environment->value(QLatin1String("_JOMSRVKEY_"));
+        bool ok;
+        int n = environment->value(QLatin1String("_JOMJOBCOUNT_")).toInt(&ok);
+        if (!ok || n < 1)
+            n = g_options.maxNumberOfJobs;
+        JobServer::advertiseInMakeFlags(environment, auth, n);
     }
     return true;
 }
 
-int main(int argc, char* argv[])
+/**
+ * Removes the jom only option /NAME from the arguments.
+ * Returns true, if the option was present.
+ */
+static bool takeOption(QStringList &arguments, const char *name)
+{
+    const QString optionName = QLatin1String(name);
+    for (int i = 0; i < arguments.count(); ++i) {
+        const QString &arg = arguments.at(i);
+        if ((arg.startsWith(QLatin1Char('/')) || arg.startsWith(QLatin1Char('-')))
+                && arg.midRef(1).compare(optionName, Qt::CaseInsensitive) == 0)
+        {
+            arguments.removeAt(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static int build(Application &app, const QStringList &arguments, const QStringList &environment,
+                 bool isResident)
 {
     int result = 0;
     try {
-        SetConsoleCtrlHandler(&ConsoleCtrlHandlerRoutine, TRUE);
-        Application app(argc, argv);
-        QTextCodec::setCodecForLocale(QTextCodec::codecForName("IBM 850"));
         MakefileFactory mf;
         Options* options = 0;
-        mf.setEnvironment(QProcess::systemEnvironment());
-        if (!mf.apply(getCommandLineArguments(), &options)) {
+        mf.setEnvironment(environment);
+        mf.setResident(isResident);
+        if (!mf.apply(arguments, &options)) {
             switch (mf.errorType()) {
             case MakefileFactory::CommandLineError:
                 showUsage();
                 return 128;
+            case MakefileFactory::MacroError:
+                fprintf(stderr, "Error: %s\n", qPrintable(mf.errorString()));
+                return 128;
             case MakefileFactory::ParserError:
             case MakefileFactory::IOError:
                 fprintf(stderr, "Error: %s\n", qPrintable(mf.errorString()));
@@ -191,7 +258,7 @@ int main(int argc, char* argv[])
 
         JobServer *jobServer = 0;
         ProcessEnvironment processEnvironment = mkfile->macroTable()->environment();
-        if (!initJobServer(app, &processEnvironment, &jobServer))
+        if (!initJobServer(app, options, &processEnvironment, &jobServer))
             return 3;
         QScopedPointer<JobServer> jobServerDeleter(jobServer);
 
@@ -220,8 +287,60 @@ int main(int argc, char* argv[])
             fflush(stdout);
         }
     } catch (const Exception &e) {
+        g_pTargetExecutor = 0;
         fprintf(stderr, "jom: %s\n", qPrintable(e.message()));
         result = 2;
     }
     return result;
 }
+
+/**
+ * Builds the requests of jom /CLIENT calls in the current directory until we're terminated.
+ */
+static int serve(Application &app)
+{
+    const QString dirPath = QDir::currentPath();
+    BuildServer server;
+    if (!server.listen(dirPath)) {
+        fprintf(stderr, "jom: Cannot start the build server: %s\n",
+                qPrintable(server.errorString()));
+        return 2;
+    }
+    printf("jom: Serving builds in '%s'\n", qPrintable(QDir::toNativeSeparators(dirPath)));
+    fflush(stdout);
+
+    const GlobalOptions globalOptions = g_options;
+    BuildServer::Request request;
+    while (server.waitForRequest(&request)) {
+        g_options = globalOptions;
+        Preprocessor::clearIncludeGuards();
+        server.finishRequest(build(app, request.arguments, request.environment, true));
+    }
+    fprintf(stderr, "jom: %s\n", qPrintable(server.errorString()));
+    return 2;
+}
+
+int main(int argc, char* argv[])
+{
+    SetConsoleCtrlHandler(&ConsoleCtrlHandlerRoutine, TRUE);
+    Application app(argc, argv);
+    QTextCodec::setCodecForLocale(QTextCodec::codecForName("IBM 850"));
+    QStringList arguments = getCommandLineArguments();
+    if (takeOption(arguments, "SERVER"))
+        return serve(app);
+
+    // Sub-makes and tools that pass their job server must build in their own process.
+    const QStringList environment = QProcess::systemEnvironment();
+    if (takeOption(arguments, "CLIENT") && !app.isSubJOM()
+            && JobServer::authFromMakeFlags(qGetEnvironmentVariable(L"MAKEFLAGS")).isEmpty())
+    {
+        BuildServer::Request request;
+        request.arguments = arguments;
+        request.environment = environment;
+        int exitCode;
+        if (BuildServer::forwardRequest(QDir::currentPath(), request, &exitCode))
+            return exitCode;
+    }
+
+    return build(app, arguments, environment, false);
+}
@@ -0,0 +1,180 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "buildhistory.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QSaveFile>
+
+namespace NMakeFile {
+
+static const char historyFileHeader[] = "# jom build history 2\n";
+static const char historyFileHeaderV1[] = "# jom build history 1\n";
+static const char restatRecordTag[] = "restat";
+
+BuildHistory::BuildHistory(const QString &fileName)
+    : m_fileName(fileName)
+    , m_bModified(false)
+{
+}
+
+/**
+ * Reads the history file. Each line contains the duration in milliseconds
+ * and the target name, separated by a tab.
+ * Lines of restat records contain "restat", the three time stamps of the record
+ * and the target name, separated by tabs.
+ */
+bool BuildHistory::load()
+{
+    m_durations.clear();
+    m_restatRecords.clear();
+    m_bModified = false;
+
+    QFile file(m_fileName);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    const QByteArray header = file.readLine();
+    if (header != historyFileHeader && header != historyFileHeaderV1)
+        return false;
+
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine();
+        if (line.endsWith('\n'))
+            line.chop(1);
+        if (line.startsWith(restatRecordTag)) {
+            const QList<QByteArray> fields = line.split('\t');
+            if (fields.count() != 5)
+                continue;
+            bool ok1, ok2, ok3;
+            RestatRecord record;
+            record.fileTime = FileTime(fields.at(1).toULongLong(&ok1));
+            record.inputTime = FileTime(fields.at(2).toULongLong(&ok2));
+            record.contentTime = FileTime(fields.at(3).toULongLong(&ok3));
+            if (ok1 && ok2 && ok3)
+                m_restatRecords.insert(QString::fromUtf8(fields.at(4)), record);
+            continue;
+        }
+        const int idx = line.indexOf('\t');
+        if (idx <= 0)
+            continue;
+        bool ok;
+        const qint64 msecs = line.left(idx).toLongLong(&ok);
+        if (!ok || msecs < 0)
+            continue;
+        m_durations.insert(QString::fromUtf8(line.mid(idx + 1)), msecs);
+    }
+    return true;
+}
+
+bool BuildHistory::save()
+{
+    if (!m_bModified)
+        return true;
+
+    QSaveFile file(m_fileName);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+
+    file.write(historyFileHeader);
+    QHash<QString, qint64>::const_iterator it = m_durations.constBegin();
+    for (; it != m_durations.constEnd(); ++it) {
+        QByteArray line = QByteArray::number(it.value());
+        line += '\t';
+        line += it.key().toUtf8();
+        line += '\n';
+        file.write(line);
+    }
+    QHash<QString, RestatRecord>::const_iterator rit = m_restatRecords.constBegin();
+    for (; rit != m_restatRecords.constEnd(); ++rit) {
+        QByteArray line = restatRecordTag;
+        line += '\t';
+        line += QByteArray::number(rit.value().fileTime.internalRepresentation());
+        line += '\t';
+        line += QByteArray::number(rit.value().inputTime.internalRepresentation());
+        line += '\t';
+        line += QByteArray::number(rit.value().contentTime.internalRepresentation());
+        line += '\t';
+        line += rit.key().toUtf8();
+        line += '\n';
+        file.write(line);
+    }
+
+    if (!file.commit())
+        return false;
+    m_bModified = false;
+    return true;
+}
+
+/**
+ * Returns the recorded duration of the target's commands in milliseconds,
+ * or -1 if there's none.
+ */
+qint64 BuildHistory::duration(const QString &targetName) const
+{
+    return m_durations.value(key(targetName), -1);
+}
+
+qint64 BuildHistory::averageDuration() const
+{
+    if (m_durations.isEmpty())
+        return 0;
+    qint64 sum = 0;
+    foreach (qint64 msecs, m_durations)
+        sum += msecs;
+    return sum / m_durations.count();
+}
+
+void BuildHistory::setDuration(const QString &targetName, qint64 msecs)
+{
+    m_durations.insert(key(targetName), msecs);
+    m_bModified = true;
+}
+
+/**
+ * Returns true if the commands of the .RESTAT target left its file's content unchanged
+ * when they ran last.
+ */
+bool BuildHistory::restatRecord(const QString &targetName, RestatRecord *record) const
+{
+    QHash<QString, RestatRecord>::const_iterator it = m_restatRecords.find(key(targetName));
+    if (it == m_restatRecords.constEnd())
+        return false;
+    *record = it.value();
+    return true;
+}
+
+void BuildHistory::setRestatRecord(const QString &targetName, const RestatRecord &record)
+{
+    m_restatRecords.insert(key(targetName), record);
+    m_bModified = true;
+}
+
+void BuildHistory::removeRestatRecord(const QString &targetName)
+{
+    if (m_restatRecords.remove(key(targetName)))
+        m_bModified = true;
+}
+
+} // namespace NMakeFile
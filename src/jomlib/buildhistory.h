@@ -0,0 +1,77 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef BUILDHISTORY_H
+#define BUILDHISTORY_H
+
+#include "filetime.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+
+namespace NMakeFile {
+
+/**
+ * Wall times of the commands of targets, recorded in previous builds.
+ *
+ * Also records the .RESTAT targets whose commands left their file's content unchanged.
+ */
+class BuildHistory
+{
+public:
+    explicit BuildHistory(const QString &fileName);
+
+    const QString &fileName() const { return m_fileName; }
+    bool load();
+    bool save();
+
+    bool isEmpty() const { return m_durations.isEmpty(); }
+    qint64 duration(const QString &targetName) const;
+    qint64 averageDuration() const;
+    void setDuration(const QString &targetName, qint64 msecs);
+
+    struct RestatRecord
+    {
+        FileTime fileTime;      // time stamp of the file after the commands ran
+        FileTime inputTime;     // time the commands were started
+        FileTime contentTime;   // time stamp of the file's last content change
+    };
+
+    bool restatRecord(const QString &targetName, RestatRecord *record) const;
+    void setRestatRecord(const QString &targetName, const RestatRecord &record);
+    void removeRestatRecord(const QString &targetName);
+
+private:
+    static QString key(const QString &targetName) { return targetName.toLower(); }
+
+    QString m_fileName;
+    QHash<QString, qint64> m_durations;
+    QHash<QString, RestatRecord> m_restatRecords;
+    bool m_bModified;
+};
+
+} // namespace NMakeFile
+
+#endif // BUILDHISTORY_H
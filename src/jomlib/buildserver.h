@@ -0,0 +1,75 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef BUILDSERVER_H
+#define BUILDSERVER_H
+
+#include <QtCore/QStringList>
+
+namespace NMakeFile {
+
+class BuildServerPrivate;
+
+/**
+ * Serves the build requests of jom clients for one directory.
+ *
+ * The server process keeps the parsed makefiles and the file attribute cache in memory
+ * between builds. Changes in the directory tree are watched to invalidate the cached
+ * file attributes. Clients connect through a named pipe whose name is derived from the
+ * directory. While a request is served, stdout and stderr of the server go to the client.
+ *
+ * Windows only.
+ */
+class BuildServer
+{
+public:
+    struct Request
+    {
+        QStringList arguments;
+        QStringList environment;
+    };
+
+    BuildServer();
+    ~BuildServer();
+
+    bool listen(const QString &dirPath);
+    bool waitForRequest(Request *request);
+    void finishRequest(int exitCode);
+    QString errorString() const { return m_errorString; }
+
+    static QString pipeName(const QString &dirPath);
+    static bool forwardRequest(const QString &dirPath, const Request &request, int *exitCode);
+
+private:
+    Q_DISABLE_COPY(BuildServer)
+    void setError(const QString &errorMessage) { m_errorString = errorMessage; }
+
+    BuildServerPrivate *d;
+    QString m_errorString;
+};
+
+} // namespace NMakeFile
+
+#endif // BUILDSERVER_H
@@ -0,0 +1,416 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "buildserver.h"
+#include "fastfileinfo.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+#include <QtCore/QtEndian>
+
+#include <fcntl.h>
+#include <io.h>
+#include <stdio.h>
+#include <windows.h>
+
+namespace NMakeFile {
+
+static const quint32 requestMagic = 0x4a4f4d52;     // "JOMR"
+static const quint32 protocolVersion = 1;
+static const quint32 maxRequestSize = 16 * 1024 * 1024;
+
+/**
+ * Collects the directories of the tree below the root directory whose content has changed.
+ */
+class DirectoryWatcher : public QThread
+{
+public:
+    DirectoryWatcher()
+        : m_hDirectory(INVALID_HANDLE_VALUE)
+        , m_hStopEvent(CreateEvent(NULL, TRUE, FALSE, NULL))
+        , m_isComplete(false)
+    {
+    }
+
+    ~DirectoryWatcher()
+    {
+        SetEvent(m_hStopEvent);
+        wait();
+        if (m_hDirectory != INVALID_HANDLE_VALUE)
+            CloseHandle(m_hDirectory);
+        CloseHandle(m_hStopEvent);
+    }
+
+    bool watch(const QString &dirPath)
+    {
+        m_rootPath = QDir::toNativeSeparators(QDir(dirPath).absolutePath());
+        m_hDirectory = CreateFile(reinterpret_cast<const TCHAR*>(m_rootPath.utf16()),
+                                  FILE_LIST_DIRECTORY,
+                                  FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                  NULL, OPEN_EXISTING,
+                                  FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+        if (m_hDirectory == INVALID_HANDLE_VALUE)
+            return false;
+        m_isComplete = true;
+        start();
+        return true;
+    }
+
+    /**
+     * Returns the directories that have changed since the last call.
+     * Returns false, if the changes are unknown and all cached attributes must be dropped.
+     */
+    bool takeChanges(QStringList *changedDirectories)
+    {
+        QMutexLocker locker(&m_mutex);
+        const bool isComplete = m_isComplete;
+        *changedDirectories = m_changedDirectories.toList();
+        m_changedDirectories.clear();
+        m_isComplete = isRunning();
+        return isComplete;
+    }
+
+protected:
+    void run() override
+    {
+        const DWORD notifyFilter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME
+                | FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE
+                | FILE_NOTIFY_CHANGE_LAST_WRITE;
+        QVector<DWORD> buffer(16 * 1024);
+        OVERLAPPED overlapped = {0};
+        overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        forever {
+            ResetEvent(overlapped.hEvent);
+            if (!ReadDirectoryChangesW(m_hDirectory, buffer.data(), buffer.count() * sizeof(DWORD),
+                                       TRUE, notifyFilter, NULL, &overlapped, NULL))
+            {
+                break;
+            }
+
+            HANDLE handles[2] = { m_hStopEvent, overlapped.hEvent };
+            DWORD numberOfBytes = 0;
+            if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0 + 1) {
+                CancelIo(m_hDirectory);
+                GetOverlappedResult(m_hDirectory, &overlapped, &numberOfBytes, TRUE);
+                break;
+            }
+            if (!GetOverlappedResult(m_hDirectory, &overlapped, &numberOfBytes, FALSE))
+                break;
+
+            QMutexLocker locker(&m_mutex);
+            if (numberOfBytes == 0) {
+                // The buffer overflowed. We don't know what has changed.
+                m_isComplete = false;
+                continue;
+            }
+            const char *data = reinterpret_cast<const char *>(buffer.constData());
+            forever {
+                const FILE_NOTIFY_INFORMATION *info
+                        = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(data);
+                if (info->Action == FILE_ACTION_RENAMED_OLD_NAME) {
+                    // This might be a directory. The listings below it are gone.
+                    m_isComplete = false;
+                }
+                const QString fileName = QString::fromWCharArray(info->FileName,
+                        info->FileNameLength / sizeof(WCHAR));
+                const int idx = fileName.lastIndexOf(QLatin1Char('\\'));
+                QString dirPath = m_rootPath;
+                if (idx >= 0)
+                    dirPath += QLatin1Char('\\') + fileName.left(idx);
+                m_changedDirectories.insert(dirPath);
+                if (!info->NextEntryOffset)
+                    break;
+                data += info->NextEntryOffset;
+            }
+        }
+        CloseHandle(overlapped.hEvent);
+
+        QMutexLocker locker(&m_mutex);
+        m_isComplete = false;
+    }
+
+private:
+    QString m_rootPath;
+    HANDLE m_hDirectory;
+    HANDLE m_hStopEvent;
+    QMutex m_mutex;
+    QSet<QString> m_changedDirectories;
+    bool m_isComplete;
+};
+
+class BuildServerPrivate
+{
+public:
+    BuildServerPrivate()
+        : hPipe(INVALID_HANDLE_VALUE)
+        , savedStdout(-1)
+        , savedStderr(-1)
+    {
+    }
+
+    bool redirectOutput();
+    void restoreOutput();
+
+    QString dirPath;
+    HANDLE hPipe;
+    int savedStdout;
+    int savedStderr;
+    DirectoryWatcher watcher;
+};
+
+static bool writeAll(HANDLE hFile, const char *data, DWORD size)
+{
+    while (size > 0) {
+        DWORD numberOfBytesWritten;
+        if (!WriteFile(hFile, data, size, &numberOfBytesWritten, NULL))
+            return false;
+        data += numberOfBytesWritten;
+        size -= numberOfBytesWritten;
+    }
+    return true;
+}
+
+static bool readAll(HANDLE hFile, char *data, DWORD size)
+{
+    while (size > 0) {
+        DWORD numberOfBytesRead;
+        if (!ReadFile(hFile, data, size, &numberOfBytesRead, NULL) || !numberOfBytesRead)
+            return false;
+        data += numberOfBytesRead;
+        size -= numberOfBytesRead;
+    }
+    return true;
+}
+
+/**
+ * Lets file descriptors 1 and 2 write to the client.
+ */
+bool BuildServerPrivate::redirectOutput()
+{
+    HANDLE hOutput;
+    if (!DuplicateHandle(GetCurrentProcess(), hPipe, GetCurrentProcess(), &hOutput,
+                         0, FALSE, DUPLICATE_SAME_ACCESS))
+    {
+        return false;
+    }
+    const int fd = _open_osfhandle(reinterpret_cast<intptr_t>(hOutput), _O_WRONLY);
+    if (fd == -1) {
+        CloseHandle(hOutput);
+        return false;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    savedStdout = _dup(1);
+    savedStderr = _dup(2);
+    _dup2(fd, 1);
+    _dup2(fd, 2);
+    _close(fd);
+    return true;
+}
+
+void BuildServerPrivate::restoreOutput()
+{
+    fflush(stdout);
+    fflush(stderr);
+    _dup2(savedStdout, 1);
+    _dup2(savedStderr, 2);
+    _close(savedStdout);
+    _close(savedStderr);
+    savedStdout = savedStderr = -1;
+}
+
+BuildServer::BuildServer()
+    : d(new BuildServerPrivate)
+{
+}
+
+BuildServer::~BuildServer()
+{
+    if (d->hPipe != INVALID_HANDLE_VALUE)
+        CloseHandle(d->hPipe);
+    delete d;
+}
+
+/**
+ * Returns the name of the pipe of the server for the given directory.
+ */
+QString BuildServer::pipeName(const QString &dirPath)
+{
+    const QString key = QDir::toNativeSeparators(QDir(dirPath).absolutePath()).toLower();
+    const QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1);
+    return QLatin1String("\\\\.\\pipe\\jom-server-") + QString::fromLatin1(hash.toHex());
+}
+
+bool BuildServer::listen(const QString &dirPath)
+{
+    const QString name = pipeName(dirPath);
+    d->dirPath = dirPath;
+    d->hPipe = CreateNamedPipe(reinterpret_cast<const TCHAR*>(name.utf16()),
+                               PIPE_ACCESS_DUPLEX | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                               PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT
+                               | PIPE_REJECT_REMOTE_CLIENTS,
+                               1, 64 * 1024, 64 * 1024, 0, NULL);
+    if (d->hPipe == INVALID_HANDLE_VALUE) {
+        if (GetLastError() == ERROR_ACCESS_DENIED)
+            setError(QLatin1String("A build server for this directory is already running."));
+        else
+            setError(qt_error_string(GetLastError()));
+        return false;
+    }
+    if (!d->watcher.watch(dirPath)) {
+        setError(qt_error_string(GetLastError()));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Blocks until a client has sent a valid request.
+ * Drops the cached file attributes that might be outdated, and redirects the output
+ * of this process to the client.
+ */
+bool BuildServer::waitForRequest(Request *request)
+{
+    forever {
+        if (!ConnectNamedPipe(d->hPipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED) {
+            setError(qt_error_string(GetLastError()));
+            return false;
+        }
+
+        quint32 size;
+        QByteArray data;
+        if (readAll(d->hPipe, reinterpret_cast<char *>(&size), sizeof(size))) {
+            size = qFromLittleEndian(size);
+            if (size <= maxRequestSize) {
+                data.resize(size);
+                if (!readAll(d->hPipe, data.data(), size))
+                    data.clear();
+            }
+        }
+
+        QDataStream ds(data);
+        quint32 magic = 0, version = 0;
+        ds >> magic >> version;
+        if (magic == requestMagic && version == protocolVersion) {
+            ds >> request->arguments >> request->environment;
+            if (ds.status() == QDataStream::Ok && d->redirectOutput())
+                break;
+        }
+        DisconnectNamedPipe(d->hPipe);
+    }
+
+    QStringList changedDirectories;
+    if (d->watcher.takeChanges(&changedDirectories)) {
+        // Files outside of the watched tree might have changed as well.
+        FastFileInfo::clearCacheOutside(d->dirPath);
+        foreach (const QString &dirPath, changedDirectories)
+            FastFileInfo::clearCacheForDirectory(dirPath);
+    } else {
+        FastFileInfo::clearCache();
+    }
+    return true;
+}
+
+/**
+ * Restores the output of this process, and sends the exit code to the client.
+ */
+void BuildServer::finishRequest(int exitCode)
+{
+    d->restoreOutput();
+    const qint32 data = qToLittleEndian(qint32(exitCode));
+    if (writeAll(d->hPipe, reinterpret_cast<const char *>(&data), sizeof(data)))
+        FlushFileBuffers(d->hPipe);
+    DisconnectNamedPipe(d->hPipe);
+}
+
+/**
+ * Sends the request to the server of the given directory and writes the output of the
+ * build to stdout. Returns false, if there's no server running for this directory.
+ */
+bool BuildServer::forwardRequest(const QString &dirPath, const Request &request, int *exitCode)
+{
+    const QString name = pipeName(dirPath);
+    HANDLE hPipe;
+    forever {
+        hPipe = CreateFile(reinterpret_cast<const TCHAR*>(name.utf16()),
+                           GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (hPipe != INVALID_HANDLE_VALUE)
+            break;
+        // The server is busy with another client.
+        if (GetLastError() != ERROR_PIPE_BUSY
+                || !WaitNamedPipe(reinterpret_cast<const TCHAR*>(name.utf16()),
+                                  NMPWAIT_WAIT_FOREVER))
+        {
+            return false;
+        }
+    }
+
+    QByteArray data;
+    QDataStream ds(&data, QIODevice::WriteOnly);
+    ds << quint32(0) << requestMagic << protocolVersion << request.arguments << request.environment;
+    qToLittleEndian(quint32(data.size() - sizeof(quint32)),
+                    reinterpret_cast<uchar *>(data.data()));
+    if (!writeAll(hPipe, data.constData(), data.size())) {
+        CloseHandle(hPipe);
+        return false;
+    }
+
+    // The output is already translated. The last four bytes are the exit code.
+    const int fd = _fileno(stdout);
+    const int origMode = _setmode(fd, _O_BINARY);
+    QByteArray pending;
+    char buffer[4096];
+    DWORD numberOfBytesRead;
+    while (ReadFile(hPipe, buffer, sizeof(buffer), &numberOfBytesRead, NULL)
+           && numberOfBytesRead)
+    {
+        pending.append(buffer, numberOfBytesRead);
+        if (pending.size() > int(sizeof(qint32))) {
+            const int count = pending.size() - sizeof(qint32);
+            fwrite(pending.constData(), sizeof(char), count, stdout);
+            fflush(stdout);
+            pending.remove(0, count);
+        }
+    }
+    CloseHandle(hPipe);
+    if (origMode != -1)
+        _setmode(fd, origMode);
+
+    if (pending.size() == sizeof(qint32)) {
+        *exitCode = qFromLittleEndian<qint32>(reinterpret_cast<const uchar *>(pending.constData()));
+    } else {
+        fputs("jom: The build server closed the connection.\n", stderr);
+        *exitCode = 2;
+    }
+    return true;
+}
+
+} // namespace NMakeFile
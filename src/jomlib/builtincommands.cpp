@@ -0,0 +1,475 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "builtincommands.h"
+#include "helperfunctions.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QRegExp>
+
+#include <windows.h>
+
+namespace NMakeFile {
+
+static const QByteArray newLine = QByteArrayLiteral("\r\n");
+
+BuiltinCommands::BuiltinCommands(const QString &workingDirectory)
+    : m_workingDirectory(workingDirectory)
+    , m_exitCode(0)
+{
+    m_outputs[1].kind = Output::StandardOutput;
+    m_outputs[1].file = 0;
+    m_outputs[2].kind = Output::StandardError;
+    m_outputs[2].file = 0;
+}
+
+BuiltinCommands::~BuiltinCommands()
+{
+    qDeleteAll(m_files);
+}
+
+/**
+ * Runs the command line in-process and returns true, if it is supported.
+ */
+bool BuiltinCommands::execute(const QString &commandLine)
+{
+    QString command;
+    if (!parseRedirections(commandLine, &command))
+        return false;
+    return dispatch(command);
+}
+
+/**
+ * Removes the redirections from the command line like cmd does.
+ * Returns false, if the command line contains other special characters.
+ */
+bool BuiltinCommands::parseRedirections(const QString &commandLine, QString *command)
+{
+    static const QString fileNameTerminators = QLatin1String("\"<>|&()^%");
+    bool inQuotes = false;
+    int i = 0;
+    const int n = commandLine.length();
+    while (i < n) {
+        const QChar ch = commandLine.at(i);
+        if (ch == QLatin1Char('%') || ch == QLatin1Char('^')) {
+            // Variable expansion and escaping.
+            return false;
+        }
+        if (ch == QLatin1Char('"'))
+            inQuotes = !inQuotes;
+        if (inQuotes || ch != QLatin1Char('>')) {
+            if (!inQuotes && (ch == QLatin1Char('<') || ch == QLatin1Char('|')
+                              || ch == QLatin1Char('&') || ch == QLatin1Char('(')
+                              || ch == QLatin1Char(')')))
+            {
+                return false;
+            }
+            command->append(ch);
+            ++i;
+            continue;
+        }
+
+        Redirection redirection;
+        redirection.handle = 1;
+        redirection.duplicatedHandle = 0;
+        redirection.append = false;
+        if (!command->isEmpty() && command->at(command->length() - 1).isDigit()) {
+            // "2>" redirects stderr. cmd treats "foo2>" differently. Don't bother.
+            const QChar digit = command->at(command->length() - 1);
+            if (command->length() < 2 || !command->at(command->length() - 2).isSpace()
+                    || (digit != QLatin1Char('1') && digit != QLatin1Char('2')))
+            {
+                return false;
+            }
+            redirection.handle = digit.digitValue();
+            command->chop(1);
+        }
+
+        ++i;
+        if (i < n && commandLine.at(i) == QLatin1Char('>')) {
+            redirection.append = true;
+            ++i;
+        }
+        if (i < n && commandLine.at(i) == QLatin1Char('&')) {
+            ++i;
+            if (i >= n || (commandLine.at(i) != QLatin1Char('1')
+                           && commandLine.at(i) != QLatin1Char('2')))
+            {
+                return false;
+            }
+            redirection.duplicatedHandle = commandLine.at(i).digitValue();
+            ++i;
+        } else {
+            while (i < n && commandLine.at(i).isSpace())
+                ++i;
+            if (i < n && commandLine.at(i) == QLatin1Char('"')) {
+                const int idx = commandLine.indexOf(QLatin1Char('"'), i + 1);
+                if (idx < 0)
+                    return false;
+                redirection.fileName = commandLine.mid(i + 1, idx - i - 1);
+                i = idx + 1;
+            } else {
+                const int start = i;
+                while (i < n && !commandLine.at(i).isSpace()
+                       && !fileNameTerminators.contains(commandLine.at(i)))
+                {
+                    ++i;
+                }
+                redirection.fileName = commandLine.mid(start, i - start);
+            }
+            if (redirection.fileName.isEmpty())
+                return false;
+        }
+        if (i < n && !commandLine.at(i).isSpace())
+            return false;
+        m_redirections.append(redirection);
+    }
+    return !inQuotes;
+}
+
+static bool isDeviceName(const QString &fileName)
+{
+    static QRegExp rex(QLatin1String("^(.*[\\\\/])?(con|prn|aux|com\\d|lpt\\d|conin\\$|conout\\$)(\\..*)?$"),
+                       Qt::CaseInsensitive, QRegExp::RegExp2);
+    return rex.exactMatch(fileName);
+}
+
+static bool isNullDevice(const QString &fileName)
+{
+    return fileName.compare(QLatin1String("NUL"), Qt::CaseInsensitive) == 0;
+}
+
+/**
+ * Opens the files of the redirections. Must be called before the command does anything.
+ * Returns false, if a file cannot be opened. The shell must report that.
+ */
+bool BuiltinCommands::openOutputs()
+{
+    foreach (const Redirection &redirection, m_redirections) {
+        Output &output = m_outputs[redirection.handle];
+        if (redirection.duplicatedHandle) {
+            output = m_outputs[redirection.duplicatedHandle];
+            continue;
+        }
+        if (isNullDevice(redirection.fileName)) {
+            output.kind = Output::Null;
+            output.file = 0;
+            continue;
+        }
+        if (isDeviceName(redirection.fileName))
+            return false;
+
+        QFile *file = new QFile(absoluteFilePath(redirection.fileName));
+        m_files.append(file);
+        QIODevice::OpenMode openMode = QIODevice::WriteOnly;
+        openMode |= redirection.append ? QIODevice::Append : QIODevice::Truncate;
+        if (!file->open(openMode))
+            return false;
+        output.kind = Output::File;
+        output.file = file;
+    }
+    m_redirections.clear();
+    return true;
+}
+
+void BuiltinCommands::write(int handle, const QByteArray &data)
+{
+    const Output &output = m_outputs[handle];
+    switch (output.kind) {
+    case Output::StandardOutput:
+        m_standardOutput += data;
+        break;
+    case Output::StandardError:
+        m_standardError += data;
+        break;
+    case Output::Null:
+        break;
+    case Output::File:
+        output.file->write(data);
+        break;
+    }
+}
+
+QString BuiltinCommands::absoluteFilePath(const QString &fileName) const
+{
+    return QDir::toNativeSeparators(
+                QDir(m_workingDirectory).absoluteFilePath(QDir::fromNativeSeparators(fileName)));
+}
+
+/**
+ * Splits the arguments into switches and unquoted file names.
+ * Returns false for arguments cmd would treat in a special way.
+ */
+bool BuiltinCommands::splitArguments(const QString &arguments, QStringList *switches,
+                                     QStringList *fileNames)
+{
+    static QRegExp rexSpecial(QLatin1String("[,;=/*?]"));
+    foreach (QString argument, splitCommandLine(arguments)) {
+        if (argument.startsWith(QLatin1Char('/'))) {
+            switches->append(argument.toUpper());
+            continue;
+        }
+        const bool isQuoted = argument.startsWith(QLatin1Char('"'));
+        removeDoubleQuotes(argument);
+        if (argument.isEmpty() || argument.contains(QLatin1Char('"'))
+                || argument.contains(QLatin1Char('*')) || argument.contains(QLatin1Char('?'))
+                || (!isQuoted && rexSpecial.indexIn(argument) >= 0)
+                || argument.endsWith(QLatin1Char('\\')) || isDeviceName(argument))
+        {
+            return false;
+        }
+        fileNames->append(argument);
+    }
+    return true;
+}
+
+bool BuiltinCommands::dispatch(const QString &command)
+{
+    const QString commandLine = trimLeft(command);
+    int idx = 0;
+    while (idx < commandLine.length() && !commandLine.at(idx).isSpace())
+        ++idx;
+    if (idx >= commandLine.length())
+        return false;
+
+    const QString name = commandLine.left(idx).toLower();
+    const QString arguments = commandLine.mid(idx + 1);
+    if (name == QLatin1String("echo"))
+        return exec_echo(arguments);
+    if (name == QLatin1String("type"))
+        return exec_type(arguments);
+    if (name == QLatin1String("del") || name == QLatin1String("erase"))
+        return exec_del(arguments);
+    if (name == QLatin1String("md") || name == QLatin1String("mkdir"))
+        return exec_md(arguments);
+    if (name == QLatin1String("copy"))
+        return exec_copy(arguments);
+    if (name == QLatin1String("if"))
+        return exec_if(arguments);
+    return false;
+}
+
+bool BuiltinCommands::exec_echo(const QString &text)
+{
+    // "echo", "echo on" and "echo off" depend on the shell's state.
+    const QString trimmedText = text.trimmed();
+    if (trimmedText.isEmpty()
+            || trimmedText.compare(QLatin1String("on"), Qt::CaseInsensitive) == 0
+            || trimmedText.compare(QLatin1String("off"), Qt::CaseInsensitive) == 0
+            || text.contains(QLatin1String("/?")))
+    {
+        return false;
+    }
+    if (!openOutputs())
+        return false;
+    write(1, text.toLocal8Bit() + newLine);
+    m_exitCode = 0;
+    return true;
+}
+
+bool BuiltinCommands::exec_type(const QString &arguments)
+{
+    QStringList switches, fileNames;
+    if (!splitArguments(arguments, &switches, &fileNames) || !switches.isEmpty()
+            || fileNames.count() != 1)
+    {
+        return false;
+    }
+
+    QFile file(absoluteFilePath(fileNames.first()));
+    QByteArray content;
+    if (file.exists()) {
+        if (!file.open(QFile::ReadOnly))
+            return false;
+        content = file.readAll();
+
+        // type converts Unicode files and stops at Ctrl+Z.
+        if (content.startsWith("\xff\xfe") || content.contains('\x1a'))
+            return false;
+    } else if (QFileInfo(file.fileName()).isDir()) {
+        return false;
+    }
+
+    if (!openOutputs())
+        return false;
+    if (!file.isOpen()) {
+        write(2, "The system cannot find the file specified." + newLine);
+        m_exitCode = 1;
+        return true;
+    }
+    write(1, content);
+    m_exitCode = 0;
+    return true;
+}
+
+bool BuiltinCommands::exec_del(const QString &arguments)
+{
+    QStringList switches, fileNames;
+    if (!splitArguments(arguments, &switches, &fileNames) || fileNames.isEmpty())
+        return false;
+    bool force = false;
+    foreach (const QString &switchName, switches) {
+        if (switchName == QLatin1String("/F"))
+            force = true;
+        else if (switchName != QLatin1String("/Q"))
+            return false;
+    }
+
+    // del deletes the content of directories, and asks before deleting read-only files.
+    QStringList filePaths;
+    foreach (const QString &fileName, fileNames) {
+        const QString filePath = absoluteFilePath(fileName);
+        const QFileInfo fileInfo(filePath);
+        if (fileInfo.isDir() || (fileInfo.exists() && !fileInfo.isWritable() && !force))
+            return false;
+        filePaths.append(filePath);
+    }
+
+    if (!openOutputs())
+        return false;
+    foreach (const QString &filePath, filePaths) {
+        const wchar_t *nativeFilePath = reinterpret_cast<const wchar_t *>(filePath.utf16());
+        if (!QFile::exists(filePath)) {
+            write(2, "Could Not Find " + filePath.toLocal8Bit() + newLine);
+            continue;
+        }
+        if (force)
+            SetFileAttributesW(nativeFilePath, FILE_ATTRIBUTE_NORMAL);
+        if (!DeleteFileW(nativeFilePath))
+            write(2, filePath.toLocal8Bit() + newLine + qt_error_string().toLocal8Bit() + newLine);
+    }
+
+    // del doesn't report errors in its exit code.
+    m_exitCode = 0;
+    return true;
+}
+
+/**
+ * Creates the directory and all missing parent directories.
+ */
+static bool createDirectory(const QString &dirPath)
+{
+    if (CreateDirectoryW(reinterpret_cast<const wchar_t *>(dirPath.utf16()), NULL))
+        return true;
+    if (GetLastError() != ERROR_PATH_NOT_FOUND)
+        return false;
+    const int idx = dirPath.lastIndexOf(QLatin1Char('\\'));
+    if (idx <= 0 || !createDirectory(dirPath.left(idx)))
+        return false;
+    return CreateDirectoryW(reinterpret_cast<const wchar_t *>(dirPath.utf16()), NULL);
+}
+
+bool BuiltinCommands::exec_md(const QString &arguments)
+{
+    // md reports errors for each of several directories differently.
+    QStringList switches, fileNames;
+    if (!splitArguments(arguments, &switches, &fileNames) || !switches.isEmpty()
+            || fileNames.count() != 1)
+    {
+        return false;
+    }
+
+    if (!openOutputs())
+        return false;
+    const QString dirPath = absoluteFilePath(fileNames.first());
+    if (QFileInfo(dirPath).exists()) {
+        write(2, "A subdirectory or file " + fileNames.first().toLocal8Bit()
+              + " already exists." + newLine);
+        m_exitCode = 1;
+    } else if (!createDirectory(dirPath)) {
+        write(2, qt_error_string().toLocal8Bit() + newLine);
+        m_exitCode = 1;
+    } else {
+        m_exitCode = 0;
+    }
+    return true;
+}
+
+bool BuiltinCommands::exec_copy(const QString &arguments)
+{
+    QStringList switches, fileNames;
+    if (!splitArguments(arguments, &switches, &fileNames) || fileNames.count() != 2)
+        return false;
+    bool overwrite = false;
+    foreach (const QString &switchName, switches) {
+        if (switchName == QLatin1String("/Y"))
+            overwrite = true;
+        else if (switchName != QLatin1String("/B"))
+            return false;
+    }
+
+    // Concatenation, and messages about missing sources or overwriting are left to cmd.
+    const QString sourceFilePath = absoluteFilePath(fileNames.at(0));
+    QString targetFilePath = absoluteFilePath(fileNames.at(1));
+    if (fileNames.at(0).contains(QLatin1Char('+')) || !QFileInfo(sourceFilePath).isFile())
+        return false;
+    if (QFileInfo(targetFilePath).isDir())
+        targetFilePath += QLatin1Char('\\') + QFileInfo(sourceFilePath).fileName();
+    if (targetFilePath.compare(sourceFilePath, Qt::CaseInsensitive) == 0
+            || (!overwrite && QFile::exists(targetFilePath)))
+    {
+        return false;
+    }
+
+    if (!openOutputs())
+        return false;
+    if (CopyFileW(reinterpret_cast<const wchar_t *>(sourceFilePath.utf16()),
+                  reinterpret_cast<const wchar_t *>(targetFilePath.utf16()), FALSE))
+    {
+        write(1, "        1 file(s) copied." + newLine);
+        m_exitCode = 0;
+    } else {
+        write(2, qt_error_string().toLocal8Bit() + newLine);
+        write(1, "        0 file(s) copied." + newLine);
+        m_exitCode = 1;
+    }
+    return true;
+}
+
+bool BuiltinCommands::exec_if(const QString &arguments)
+{
+    static QRegExp rex(QLatin1String("^\\s*(not\\s+)?exist\\s+(\"[^\"]+\"|[^\\s\"]+)\\s+(\\S.*)$"),
+                       Qt::CaseInsensitive, QRegExp::RegExp2);
+    if (!rex.exactMatch(arguments))
+        return false;
+
+    QStringList switches, fileNames;
+    if (!splitArguments(rex.cap(2), &switches, &fileNames) || !switches.isEmpty()
+            || fileNames.count() != 1)
+    {
+        return false;
+    }
+
+    const bool isNegated = !rex.cap(1).isEmpty();
+    const QString command = rex.cap(3);
+    if (QFileInfo(absoluteFilePath(fileNames.first())).exists() != isNegated)
+        return dispatch(command);
+    m_exitCode = 0;
+    return true;
+}
+
+} // namespace NMakeFile
@@ -0,0 +1,99 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef BUILTINCOMMANDS_H
+#define BUILTINCOMMANDS_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QStringList>
+
+QT_BEGIN_NAMESPACE
+class QFile;
+QT_END_NAMESPACE
+
+namespace NMakeFile {
+
+/**
+ * In-process implementations of cmd's echo, type, del, md, copy and "if [not] exist".
+ *
+ * Only a subset of cmd's syntax is supported, including redirection with >, >>, 2> and 2>&1.
+ * execute() returns false for everything else, before it has any side effect.
+ * The command must be passed to cmd.exe then.
+ */
+class BuiltinCommands
+{
+public:
+    explicit BuiltinCommands(const QString &workingDirectory);
+    ~BuiltinCommands();
+
+    bool execute(const QString &commandLine);
+    int exitCode() const { return m_exitCode; }
+    const QByteArray &standardOutput() const { return m_standardOutput; }
+    const QByteArray &standardError() const { return m_standardError; }
+
+private:
+    Q_DISABLE_COPY(BuiltinCommands)
+
+    struct Redirection
+    {
+        int handle;
+        int duplicatedHandle;
+        bool append;
+        QString fileName;
+    };
+
+    struct Output
+    {
+        enum Kind { StandardOutput, StandardError, Null, File };
+        Kind kind;
+        QFile *file;
+    };
+
+    bool parseRedirections(const QString &commandLine, QString *command);
+    bool openOutputs();
+    void write(int handle, const QByteArray &data);
+    QString absoluteFilePath(const QString &fileName) const;
+    bool splitArguments(const QString &arguments, QStringList *switches, QStringList *fileNames);
+
+    bool dispatch(const QString &command);
+    bool exec_echo(const QString &text);
+    bool exec_type(const QString &arguments);
+    bool exec_del(const QString &arguments);
+    bool exec_md(const QString &arguments);
+    bool exec_copy(const QString &arguments);
+    bool exec_if(const QString &arguments);
+
+    QString m_workingDirectory;
+    QList<Redirection> m_redirections;
+    Output m_outputs[3];
+    QList<QFile *> m_files;
+    int m_exitCode;
+    QByteArray m_standardOutput;
+    QByteArray m_standardError;
+};
+
+} // namespace NMakeFile
+
+#endif // BUILTINCOMMANDS_H
@@ -24,16 +24,25 @@
 ****************************************************************************/
 
 #include "commandexecutor.h"
+#include "builtincommands.h"
 #include "options.h"
 #include "exception.h"
 #include "helperfunctions.h"
 #include "fastfileinfo.h"
+#include "jobserver.h"
+#include "macrotable.h"
+#include "makefilefactory.h"
+#include "shellworker.h"
+#include "targetexecutor.h"
 
 #include <QtCore/QDebug>
 #include <QtCore/QDir>
+#include <QtCore/QEventLoop>
 #include <QtCore/QRegExp>
 #include <QStringList>
 #include <windows.h>
+#include <fcntl.h>
+#include <io.h>
 
 namespace NMakeFile {
 
@@ -43,7 +52,12 @@ QString CommandExecutor::m_tempPath;
 CommandExecutor::CommandExecutor(QObject* parent, const ProcessEnvironment &environment)
 :   QObject(parent),
     m_pTarget(0),
+    m_recursiveMake(0),
+    m_recursiveMakefile(0),
+    m_shellWorker(0),
     m_ignoreProcessErrors(false),
+    m_executingCommandLine(false),
+    m_executeNextCommandLine(false),
     m_active(false)
 {
     if (m_startUpTickCount == 0)
@@ -65,6 +79,7 @@ CommandExecutor::CommandExecutor(QObject* parent, const ProcessEnvironment &envi
 
 CommandExecutor::~CommandExecutor()
 {
+    deleteRecursiveMake();
     cleanupTempFiles();
 }
 
@@ -72,6 +87,7 @@ void CommandExecutor::start(DescriptionBlock* target)
 {
     m_pTarget = target;
     m_active = true;
+    m_workingDirectory = FastFileInfo::currentDirectory();
 
     if (target->m_commands.isEmpty()) {
         finishExecution(false);
@@ -99,6 +115,7 @@ void CommandExecutor::onProcessError(Process::ProcessError error)
 void CommandExecutor::onProcessFinished(int exitCode, Process::ExitStatus exitStatus)
 {
     //qDebug() << "onProcessFinished" << m_pTarget->m_targetName;
+    FastFileInfo::setCurrentDirectory(m_workingDirectory);
     if (exitStatus != Process::NormalExit)
         exitCode = 2;
 
@@ -130,8 +147,35 @@ void CommandExecutor::finishExecution(bool commandFailed)
     emit finished(this, commandFailed);
 }
 
+void CommandExecutor::onShellWorkerFinished(int exitCode)
+{
+    // The output of the shell worker has been buffered in m_process, which didn't run.
+    m_process.printBufferedOutput();
+    onProcessFinished(exitCode, Process::NormalExit);
+}
+
+void CommandExecutor::onRecursiveMakeFinished(int exitCode)
+{
+    if (sender() != m_recursiveMake)
+        return;
+    deleteRecursiveMake();
+    onProcessFinished(exitCode, Process::NormalExit);
+}
+
 void CommandExecutor::waitForFinished()
 {
+    if (m_recursiveMake) {
+        QEventLoop loop;
+        connect(m_recursiveMake, SIGNAL(finished(int)), &loop, SLOT(quit()));
+        loop.exec();
+        return;
+    }
+    if (m_shellWorker && m_shellWorker->isBusy()) {
+        QEventLoop loop;
+        connect(m_shellWorker, SIGNAL(finished(int)), &loop, SLOT(quit()));
+        loop.exec();
+        return;
+    }
     m_process.waitForFinished();
 }
 
@@ -152,6 +196,23 @@ static bool startsWithShellBuiltin(const QString &commandLine)
 }
 
 void CommandExecutor::executeCurrentCommandLine()
+{
+    // Builtins finish synchronously and call onProcessFinished, which calls us again.
+    // Run the following commands in this loop instead of recursing for each of them.
+    if (m_executingCommandLine) {
+        m_executeNextCommandLine = true;
+        return;
+    }
+
+    m_executingCommandLine = true;
+    do {
+        m_executeNextCommandLine = false;
+        startCurrentCommandLine();
+    } while (m_executeNextCommandLine);
+    m_executingCommandLine = false;
+}
+
+void CommandExecutor::startCurrentCommandLine()
 {
     const Command& cmd = m_pTarget->m_commands.at(m_currentCommandIdx);
     QString commandLine = cmd.m_commandLine;
@@ -181,6 +242,19 @@ void CommandExecutor::executeCurrentCommandLine()
         m_nextWorkingDir.clear();
     }
 
+    if (m_pTarget->makefile()->options()->runRecursiveMakeInProcess) {
+        QString workingDirectory;
+        QStringList arguments;
+        int exitCode;
+        if (isRecursiveMakeCall(commandLine, &workingDirectory, &arguments)
+            && startRecursiveMake(workingDirectory, arguments, &exitCode))
+        {
+            if (exitCode >= 0)
+                onProcessFinished(exitCode, Process::NormalExit);
+            return;
+        }
+    }
+
     const bool simpleCmdLine = isSimpleCommandLine(commandLine);
     if (simpleCmdLine)
     {
@@ -210,6 +284,18 @@ void CommandExecutor::executeCurrentCommandLine()
         }
     }
 
+    QString workingDirectory = m_process.workingDirectory();
+    if (workingDirectory.isEmpty())
+        workingDirectory = m_workingDirectory;
+    BuiltinCommands builtins(workingDirectory);
+    if (builtins.execute(commandLine)) {
+        writeBinaryToStandardOutput(builtins.standardOutput());
+        writeBinaryToStandardError(builtins.standardError());
+        m_process.printBufferedOutput();
+        onProcessFinished(builtins.exitCode(), Process::NormalExit);
+        return;
+    }
+
     bool executionSucceeded = false;
     if (simpleCmdLine && !startsWithShellBuiltin(commandLine)) {
         // ### It would be cool if we would not try to start every command directly.
@@ -226,6 +312,22 @@ void CommandExecutor::executeCurrentCommandLine()
         m_ignoreProcessErrors = false;
     }
 
+    if (!executionSucceeded && m_pTarget->makefile()->options()->useShellPool
+            && ShellWorker::canExecute(commandLine, workingDirectory))
+    {
+        //qDebug("+++ shell worker exec");
+        if (!m_shellWorker) {
+            m_shellWorker = new ShellWorker(this);
+            connect(m_shellWorker, SIGNAL(standardOutputReady(const QByteArray &)),
+                    SLOT(writeBinaryToStandardOutput(const QByteArray &)));
+            connect(m_shellWorker, SIGNAL(standardErrorReady(const QByteArray &)),
+                    SLOT(writeBinaryToStandardError(const QByteArray &)));
+            connect(m_shellWorker, SIGNAL(finished(int)), SLOT(onShellWorkerFinished(int)));
+        }
+        executionSucceeded = m_shellWorker->start(commandLine, workingDirectory,
+                                                  m_process.environment());
+    }
+
     if (!executionSucceeded) {
         //qDebug("+++ shell exec");
 
@@ -313,6 +415,8 @@ void CommandExecutor::createTempFiles()
 
 void CommandExecutor::cleanupTempFiles()
 {
+    if (m_recursiveMake)
+        m_recursiveMake->removeTempFiles();
     while (!m_tempFiles.isEmpty()) {
         const TempFile& tempfile = m_tempFiles.takeLast();
         if (!tempfile.keep) tempfile.file->remove();
@@ -342,6 +446,37 @@ void CommandExecutor::writeToStandardError(const QByteArray& output)
         writeToChannel(output, stderr);
 }
 
+/**
+ * Writes output that already contains CRLF line endings, like the output of a child process.
+ */
+void CommandExecutor::writeBinaryToChannel(const QByteArray &data, FILE *channel)
+{
+    if (data.isEmpty())
+        return;
+    fflush(channel);
+    const int fd = _fileno(channel);
+    const int origMode = _setmode(fd, _O_BINARY);
+    fwrite(data.constData(), sizeof(char), data.size(), channel);
+    fflush(channel);
+    _setmode(fd, origMode);
+}
+
+void CommandExecutor::writeBinaryToStandardOutput(const QByteArray &output)
+{
+    if (m_process.isBufferedOutputSet())
+        m_process.writeToStdOutBuffer(output);
+    else
+        writeBinaryToChannel(output, stdout);
+}
+
+void CommandExecutor::writeBinaryToStandardError(const QByteArray &output)
+{
+    if (m_process.isBufferedOutputSet())
+        m_process.writeToStdErrBuffer(output);
+    else
+        writeBinaryToChannel(output, stderr);
+}
+
 bool CommandExecutor::isSimpleCommandLine(const QString &commandLine)
 {
     static QRegExp rex(QLatin1String("\\||>|<|&"));
@@ -390,6 +525,154 @@ bool CommandExecutor::exec_cd(const QString &commandLine)
     return true;
 }
 
+/**
+ * Returns true, if the command line calls $(MAKE), optionally after changing the directory
+ * with "cd dir &&". Returns the sub-make's working directory and arguments.
+ */
+bool CommandExecutor::isRecursiveMakeCall(const QString &commandLine, QString *workingDirectory,
+                                          QStringList *arguments)
+{
+    static QRegExp rexCd(QLatin1String("^cd\\s+(/d\\s+)?([^&|<>]+)&&(.*)$"),
+                         Qt::CaseInsensitive, QRegExp::RegExp2);
+
+    QString dirPath = m_process.workingDirectory();
+    if (dirPath.isEmpty())
+        dirPath = m_workingDirectory;
+    QString makeCall = commandLine;
+    if (rexCd.exactMatch(commandLine)) {
+        QString cdArgument = rexCd.cap(2).trimmed();
+        removeDoubleQuotes(cdArgument);
+        dirPath = QDir(dirPath).absoluteFilePath(cdArgument);
+        makeCall = rexCd.cap(3);
+    }
+
+    if (!isSimpleCommandLine(makeCall))
+        return false;
+
+    QStringList args = splitCommandLine(makeCall);
+    if (args.isEmpty()
+        || QDir::toNativeSeparators(args.first()).compare(
+               m_pTarget->makefile()->options()->fullAppPath, Qt::CaseInsensitive) != 0)
+    {
+        return false;
+    }
+
+    const QFileInfo fi(dirPath);
+    if (!fi.isDir())
+        return false;   // Let the shell complain.
+
+    *workingDirectory = QDir::cleanPath(fi.absoluteFilePath());
+    args.removeFirst();
+    *arguments = args;
+    return true;
+}
+
+/**
+ * Returns true, if a separate jom process would do nothing else than building the sub-make.
+ * Options that change the number of jobs, redirect stderr or print information are left to
+ * a separate process, because they affect the whole process.
+ */
+static bool canRunInProcess(const QStringList &arguments)
+{
+    MacroTable macroTable;
+    foreach (const QString &arg, arguments) {
+        if (arg.startsWith(QLatin1Char('@')))
+            return false;
+        if (arg.startsWith(QLatin1Char('/')) || arg.startsWith(QLatin1Char('-')))
+            continue;
+
+        // Options::readCommandLineArguments throws on invalid macro names.
+        const int idx = arg.indexOf(QLatin1Char('='));
+        if (idx >= 0 && !macroTable.isMacroNameValid(arg.left(idx).trimmed()))
+            return false;
+    }
+
+    GlobalOptions globalOptions = g_options;
+    Options options;
+    QString makefile;
+    QStringList targets;
+    return options.readCommandLineArguments(arguments, makefile, targets, macroTable,
+                                            &globalOptions)
+        && globalOptions.maxNumberOfJobs == g_options.maxNumberOfJobs
+        && !options.showUsageAndExit
+        && !options.showVersionAndExit
+        && !options.displayMakeInformation
+        && !options.printWorkingDir
+        && options.stderrFile.isEmpty();
+}
+
+/**
+ * Builds a sub-make with a TargetExecutor in this process.
+ * It uses the job server of the parent like a separate jom process would do.
+ *
+ * Returns false, if the sub-make must be started as a separate process.
+ * exitCode is set to -1, if the build has been started. Otherwise the sub-make failed
+ * before building anything.
+ */
+bool CommandExecutor::startRecursiveMake(const QString &workingDirectory, QStringList arguments,
+                                         int *exitCode)
+{
+    const ProcessEnvironment environment = m_process.environment();
+    QString makeFlags = environment.value(QLatin1String("JOMFLAGS"));
+    if (makeFlags.isEmpty())
+        makeFlags = JobServer::jomFlagsFromMakeFlags(environment.value(QLatin1String("MAKEFLAGS")));
+    if (!makeFlags.isEmpty())
+        arguments.prepend(QLatin1Char('/') + makeFlags);
+
+    if (!FastFileInfo::setCurrentDirectory(workingDirectory))
+        return false;
+    if (!canRunInProcess(arguments)) {
+        FastFileInfo::setCurrentDirectory(m_workingDirectory);
+        return false;
+    }
+
+    *exitCode = -1;
+    const GlobalOptions globalOptions = g_options;
+    MakefileFactory factory;
+    factory.setEnvironment(environment);
+    Options *options = 0;
+    if (!factory.apply(arguments, &options)) {
+        writeToStandardError("Error: " + factory.errorString().toLocal8Bit() + "\n");
+        delete factory.makefile();
+        *exitCode = 2;
+    } else if (factory.makefile()->isParallelExecutionDisabled()) {
+        delete factory.makefile();
+        g_options = globalOptions;
+        FastFileInfo::setCurrentDirectory(m_workingDirectory);
+        return false;
+    } else {
+        // Recursive calls of the sub-make run in-process as well.
+        options->runRecursiveMakeInProcess = true;
+
+        // The sub-make writes to the console itself. Print what this command has written so far.
+        m_process.printBufferedOutput();
+
+        m_recursiveMakefile = factory.makefile();
+        m_recursiveMake = new TargetExecutor(environment, !isBufferedOutputSet());
+        connect(m_recursiveMake, SIGNAL(finished(int)), SLOT(onRecursiveMakeFinished(int)),
+                Qt::QueuedConnection);
+        try {
+            m_recursiveMake->apply(m_recursiveMakefile, factory.activeTargets());
+        } catch (const Exception &e) {
+            writeToStandardError("jom: " + e.message().toLocal8Bit() + "\n");
+            deleteRecursiveMake();
+            *exitCode = 2;
+        }
+    }
+
+    g_options = globalOptions;
+    FastFileInfo::setCurrentDirectory(m_workingDirectory);
+    return true;
+}
+
+void CommandExecutor::deleteRecursiveMake()
+{
+    delete m_recursiveMake;
+    m_recursiveMake = 0;
+    delete m_recursiveMakefile;
+    m_recursiveMakefile = 0;
+}
+
 void CommandExecutor::setEnvironment(const ProcessEnvironment &environment)
 {
     m_process.setEnvironment(environment);
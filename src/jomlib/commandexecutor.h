@@ -37,6 +37,9 @@ QT_END_NAMESPACE
 
 namespace NMakeFile {
 
+class ShellWorker;
+class TargetExecutor;
+
 class CommandExecutor : public QObject
 {
     Q_OBJECT
@@ -62,16 +65,27 @@ signals:
 private slots:
     void onProcessError(Process::ProcessError error);
     void onProcessFinished(int exitCode, Process::ExitStatus exitStatus);
+    void onRecursiveMakeFinished(int exitCode);
+    void onShellWorkerFinished(int exitCode);
+    void writeBinaryToStandardOutput(const QByteArray &data);
+    void writeBinaryToStandardError(const QByteArray &data);
 
 private:
     void finishExecution(bool commandFailed);
     void executeCurrentCommandLine();
+    void startCurrentCommandLine();
     void createTempFiles();
     void writeToChannel(const QByteArray& data, FILE *channel);
     void writeToStandardOutput(const QByteArray& data);
     void writeToStandardError(const QByteArray& data);
+    void writeBinaryToChannel(const QByteArray &data, FILE *channel);
     bool isSimpleCommandLine(const QString &cmdLine);
     bool exec_cd(const QString &commandLine);
+    bool isRecursiveMakeCall(const QString &commandLine, QString *workingDirectory,
+                             QStringList *arguments);
+    bool startRecursiveMake(const QString &workingDirectory, QStringList arguments,
+                            int *exitCode);
+    void deleteRecursiveMake();
 
 private:
     static ulong        m_startUpTickCount;
@@ -88,7 +102,13 @@ private:
     QList<TempFile>     m_tempFiles;
     int                 m_currentCommandIdx;
     QString             m_nextWorkingDir;
+    QString             m_workingDirectory;
+    TargetExecutor*     m_recursiveMake;
+    Makefile*           m_recursiveMakefile;
+    ShellWorker*        m_shellWorker;
     bool                m_ignoreProcessErrors;
+    bool                m_executingCommandLine;
+    bool                m_executeNextCommandLine;
     bool                m_active;
 };
 
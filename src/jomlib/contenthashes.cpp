@@ -0,0 +1,295 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "contenthashes.h"
+#include "fastfileinfo.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QSaveFile>
+#include <QtCore/QtEndian>
+
+namespace NMakeFile {
+
+static const char hashesFileHeader[] = "# jom content hashes 1\n";
+
+ContentHashes::ContentHashes(const QString &fileName)
+    : m_fileName(fileName)
+    , m_bModified(false)
+{
+}
+
+/**
+ * Reads the hashes file. File lines contain "F", the hash, the size, the time stamp
+ * and the file name. Target lines contain "T", the hash of the dependents and the
+ * target name. All fields are separated by tabs.
+ */
+bool ContentHashes::load()
+{
+    m_files.clear();
+    m_targets.clear();
+    m_bModified = false;
+
+    QFile file(m_fileName);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    if (file.readLine() != hashesFileHeader)
+        return false;
+
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine();
+        if (line.endsWith('\n'))
+            line.chop(1);
+        const QList<QByteArray> fields = line.split('\t');
+        bool ok;
+        if (fields.count() == 5 && fields.at(0) == "F") {
+            FileEntry entry;
+            entry.hash = fields.at(1).toULongLong(&ok, 16);
+            if (!ok)
+                continue;
+            entry.size = fields.at(2).toLongLong(&ok);
+            if (!ok)
+                continue;
+            entry.lastModified = FileTime(fields.at(3).toULongLong(&ok));
+            if (!ok)
+                continue;
+            m_files.insert(QString::fromUtf8(fields.at(4)), entry);
+        } else if (fields.count() == 3 && fields.at(0) == "T") {
+            const quint64 hash = fields.at(1).toULongLong(&ok, 16);
+            if (!ok)
+                continue;
+            m_targets.insert(QString::fromUtf8(fields.at(2)), hash);
+        }
+    }
+    return true;
+}
+
+bool ContentHashes::save()
+{
+    if (!m_bModified)
+        return true;
+
+    QSaveFile file(m_fileName);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+
+    file.write(hashesFileHeader);
+    QHash<QString, FileEntry>::const_iterator fit = m_files.constBegin();
+    for (; fit != m_files.constEnd(); ++fit) {
+        QByteArray line = "F\t";
+        line += QByteArray::number(fit->hash, 16);
+        line += '\t';
+        line += QByteArray::number(fit->size);
+        line += '\t';
+        line += QByteArray::number(fit->lastModified.internalRepresentation());
+        line += '\t';
+        line += fit.key().toUtf8();
+        line += '\n';
+        file.write(line);
+    }
+    QHash<QString, quint64>::const_iterator tit = m_targets.constBegin();
+    for (; tit != m_targets.constEnd(); ++tit) {
+        QByteArray line = "T\t";
+        line += QByteArray::number(tit.value(), 16);
+        line += '\t';
+        line += tit.key().toUtf8();
+        line += '\n';
+        file.write(line);
+    }
+
+    if (!file.commit())
+        return false;
+    m_bModified = false;
+    return true;
+}
+
+/**
+ * Computes the content hash of a file. The file is only read if its size or
+ * time stamp differ from the ones of the recorded hash.
+ * Returns false if the file cannot be read.
+ */
+bool ContentHashes::fileHash(const QString &fileName, quint64 *hash)
+{
+    FastFileInfo fi(fileName);
+    if (!fi.exists())
+        return false;
+
+    const QString fileKey = key(fileName);
+    QHash<QString, FileEntry>::const_iterator it = m_files.constFind(fileKey);
+    if (it != m_files.constEnd() && it->size == fi.size()
+            && it->lastModified == fi.lastModified()) {
+        *hash = it->hash;
+        return true;
+    }
+
+    FileEntry entry;
+    entry.size = fi.size();
+    entry.lastModified = fi.lastModified();
+    if (!hashFile(fileName, &entry.hash))
+        return false;
+
+    m_files.insert(fileKey, entry);
+    m_bModified = true;
+    *hash = entry.hash;
+    return true;
+}
+
+/**
+ * Combines the names and content hashes of the dependents.
+ * The order of the dependents doesn't matter.
+ * Returns false if one of the dependents is not a readable file.
+ */
+bool ContentHashes::dependentsHash(const QStringList &dependents, quint64 *hash)
+{
+    quint64 result = 0;
+    foreach (const QString &dependent, dependents) {
+        quint64 contentHash;
+        if (!fileHash(dependent, &contentHash))
+            return false;
+        const QByteArray name = key(dependent).toUtf8();
+        result += ContentHashes::hash(name.constData(), name.size(), contentHash);
+    }
+    *hash = result;
+    return true;
+}
+
+bool ContentHashes::hasTargetHash(const QString &targetName) const
+{
+    return m_targets.contains(key(targetName));
+}
+
+bool ContentHashes::isTargetHashEqual(const QString &targetName, quint64 hash) const
+{
+    QHash<QString, quint64>::const_iterator it = m_targets.constFind(key(targetName));
+    return it != m_targets.constEnd() && it.value() == hash;
+}
+
+void ContentHashes::setTargetHash(const QString &targetName, quint64 hash)
+{
+    const QString targetKey = key(targetName);
+    QHash<QString, quint64>::const_iterator it = m_targets.constFind(targetKey);
+    if (it == m_targets.constEnd() || it.value() != hash) {
+        m_targets.insert(targetKey, hash);
+        m_bModified = true;
+    }
+}
+
+/**
+ * Reads the file and computes the hash of its content.
+ * Returns false if the file cannot be read.
+ */
+bool ContentHashes::hashFile(const QString &fileName, quint64 *hash)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+
+    const qint64 size = file.size();
+    if (size == 0) {
+        *hash = ContentHashes::hash(0, 0);
+        return true;
+    }
+
+    uchar *data = file.map(0, size);
+    if (data) {
+        *hash = ContentHashes::hash(reinterpret_cast<const char *>(data), size);
+        file.unmap(data);
+        return true;
+    }
+
+    const QByteArray content = file.readAll();
+    if (content.size() != size)
+        return false;
+    *hash = ContentHashes::hash(content.constData(), content.size());
+    return true;
+}
+
+static const quint64 prime1 = Q_UINT64_C(0x9E3779B185EBCA87);
+static const quint64 prime2 = Q_UINT64_C(0xC2B2AE3D27D4EB4F);
+static const quint64 prime3 = Q_UINT64_C(0x165667B19E3779F9);
+static const quint64 prime4 = Q_UINT64_C(0x85EBCA77C2B2AE63);
+static const quint64 prime5 = Q_UINT64_C(0x27D4EB2F165667C5);
+
+static inline quint64 rotateLeft(quint64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline quint64 xxhRound(quint64 acc, quint64 input)
+{
+    return rotateLeft(acc + input * prime2, 31) * prime1;
+}
+
+static inline quint64 xxhMergeRound(quint64 acc, quint64 value)
+{
+    return (acc ^ xxhRound(0, value)) * prime1 + prime4;
+}
+
+/**
+ * XXH64 hash of the data.
+ */
+quint64 ContentHashes::hash(const char *data, qint64 length, quint64 seed)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    const uchar *const end = p + length;
+    quint64 h;
+    if (length >= 32) {
+        quint64 v1 = seed + prime1 + prime2;
+        quint64 v2 = seed + prime2;
+        quint64 v3 = seed;
+        quint64 v4 = seed - prime1;
+        for (const uchar *const limit = end - 32; p <= limit; p += 32) {
+            v1 = xxhRound(v1, qFromLittleEndian<quint64>(p));
+            v2 = xxhRound(v2, qFromLittleEndian<quint64>(p + 8));
+            v3 = xxhRound(v3, qFromLittleEndian<quint64>(p + 16));
+            v4 = xxhRound(v4, qFromLittleEndian<quint64>(p + 24));
+        }
+        h = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) + rotateLeft(v4, 18);
+        h = xxhMergeRound(h, v1);
+        h = xxhMergeRound(h, v2);
+        h = xxhMergeRound(h, v3);
+        h = xxhMergeRound(h, v4);
+    } else {
+        h = seed + prime5;
+    }
+
+    h += quint64(length);
+    for (; end - p >= 8; p += 8)
+        h = rotateLeft(h ^ xxhRound(0, qFromLittleEndian<quint64>(p)), 27) * prime1 + prime4;
+    if (end - p >= 4) {
+        h = rotateLeft(h ^ (quint64(qFromLittleEndian<quint32>(p)) * prime1), 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = rotateLeft(h ^ (*p * prime5), 11) * prime1;
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+} // namespace NMakeFile
@@ -0,0 +1,79 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef CONTENTHASHES_H
+#define CONTENTHASHES_H
+
+#include "filetime.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+namespace NMakeFile {
+
+/**
+ * Content hashes of files and of the dependents of targets, recorded in previous builds.
+ * A target whose dependents have the same contents as when it was last built is up-to-date,
+ * no matter what their time stamps say.
+ */
+class ContentHashes
+{
+public:
+    explicit ContentHashes(const QString &fileName);
+
+    const QString &fileName() const { return m_fileName; }
+    bool load();
+    bool save();
+
+    bool fileHash(const QString &fileName, quint64 *hash);
+    bool dependentsHash(const QStringList &dependents, quint64 *hash);
+
+    bool hasTargetHash(const QString &targetName) const;
+    bool isTargetHashEqual(const QString &targetName, quint64 hash) const;
+    void setTargetHash(const QString &targetName, quint64 hash);
+
+    static bool hashFile(const QString &fileName, quint64 *hash);
+    static quint64 hash(const char *data, qint64 length, quint64 seed = 0);
+
+private:
+    static QString key(const QString &name) { return name.toLower(); }
+
+    struct FileEntry
+    {
+        qint64 size;
+        FileTime lastModified;
+        quint64 hash;
+    };
+
+    QString m_fileName;
+    QHash<QString, FileEntry> m_files;
+    QHash<QString, quint64> m_targets;
+    bool m_bModified;
+};
+
+} // namespace NMakeFile
+
+#endif // CONTENTHASHES_H
@@ -24,19 +24,29 @@
 ****************************************************************************/
 
 #include "dependencygraph.h"
+#include "buildhistory.h"
+#include "contenthashes.h"
+#include "depslog.h"
+#include "exception.h"
 #include "makefile.h"
 #include "options.h"
 #include "fastfileinfo.h"
 
 #include <QFile>
 #include <QDebug>
-#include <QDir>
+
+#include <algorithm>
 
 namespace NMakeFile {
 
 DependencyGraph::DependencyGraph()
-:   m_root(0),
-    m_bDirtyLeaves(true)
+:   m_root(-1),
+    m_nodeCount(0),
+    m_buildHistory(0),
+    m_readySequenceNumber(0),
+    m_contentHashes(0),
+    m_depsLog(0),
+    m_restatHistory(0)
 {
 }
 
@@ -45,57 +55,91 @@ DependencyGraph::~DependencyGraph()
     clear();
 }
 
-DependencyGraph::Node* DependencyGraph::createNode(DescriptionBlock* target, Node* parent)
+int DependencyGraph::createNode(DescriptionBlock* target)
 {
-    Node* node = new Node;
-    node->target = target;
-    node->state = Node::UnknownState;
-    if (parent) {
-        addEdge(parent, node);
-    }
+    Node node;
+    node.target = target;
+    node.state = Node::UnknownState;
+    node.pendingChildren = 0;
+
+    const int id = m_nodes.count();
+    m_nodes.append(node);
+    m_nodeIds.insert(target, id);
+    m_nodeCount++;
+    return id;
+}
 
-    m_nodeContainer[target] = node;
-    return node;
+/**
+ * Enables critical path scheduling. Targets on the longest path to the root target,
+ * weighted by the durations in the build history, are handed out first.
+ */
+void DependencyGraph::setBuildHistory(const BuildHistory *buildHistory)
+{
+    m_buildHistory = buildHistory;
 }
 
-void DependencyGraph::deleteNode(Node* node)
+/**
+ * Enables content hash checking. Targets that are out of date by their time stamps are
+ * still up-to-date if the contents of their dependents didn't change since they were built.
+ */
+void DependencyGraph::setContentHashes(ContentHashes *contentHashes)
 {
-    m_nodeContainer.remove(node->target);
-    if (node == m_root) m_root = 0;
-    delete node;
+    m_contentHashes = contentHashes;
 }
 
-void DependencyGraph::build(DescriptionBlock* target)
+/**
+ * Enables implicit dependents. The dependents that were recorded for targets
+ * with depfiles are added to the graph.
+ */
+void DependencyGraph::setDepsLog(const DepsLog *depsLog)
 {
-    m_bDirtyLeaves = true;
-    m_root = createNode(target, 0);
-    QSet<Node *> seen;
-    internalBuild(m_root, seen);
-    //dump();
-    //qDebug() << "\n\n-------------------------------------------------\n";
+    m_depsLog = depsLog;
+}
 
-    //do {
-    //    target = findAvailableTarget();
-    //    if (target) qDebug() << "XXX" << target->m_targetName << target->m_bFileExists;
-    //} while(target);
+/**
+ * Enables the restat records. A .RESTAT target whose commands left its file's content
+ * unchanged is up-to-date while its file keeps the recorded time stamp, and its parents
+ * see the time stamp of the last content change.
+ */
+void DependencyGraph::setRestatHistory(const BuildHistory *restatHistory)
+{
+    m_restatHistory = restatHistory;
+}
 
-    //qDebug() << "\nFINISHED";
+void DependencyGraph::build(DescriptionBlock* target)
+{
+    clear();
+    m_root = createNode(target);
+    internalBuild(m_root);
+    prefetchFileInfos();
+    checkFileDependents();
+    buildAdjacency();
+    if (m_depsLog)
+        checkForCycles();
+    if (m_buildHistory)
+        computePriorities();
 }
 
 void DependencyGraph::markParentsRecursivlyUnbuildable(DescriptionBlock *target)
 {
-    markParentsRecursivlyUnbuildable(m_nodeContainer.value(target));
+    const int node = m_nodeIds.value(target, -1);
+    if (node >= 0)
+        markParentsRecursivlyUnbuildable(node);
 }
 
 bool DependencyGraph::isUnbuildable(DescriptionBlock *target) const
 {
-    return m_nodeContainer.value(target)->state == Node::Unbuildable;
+    const int node = m_nodeIds.value(target, -1);
+    return node >= 0 && m_nodes.at(node).state == Node::Unbuildable;
 }
 
-void DependencyGraph::markParentsRecursivlyUnbuildable(Node *node)
+void DependencyGraph::markParentsRecursivlyUnbuildable(int node)
 {
-    foreach (Node *parent, node->parents) {
-        parent->state = Node::Unbuildable;
+    for (int i = m_parentOffsets.at(node); i < m_parentOffsets.at(node + 1); ++i) {
+        const int parent = m_parents.at(i);
+        if (m_nodes.at(parent).state == Node::Unbuildable)
+            continue;   // all parents of this node have been marked already
+        m_nodes[parent].state = Node::Unbuildable;
         markParentsRecursivlyUnbuildable(parent);
     }
 }
@@ -108,13 +152,26 @@ bool DependencyGraph::isTargetUpToDate(DescriptionBlock* target)
         target->m_timeStamp = fi.lastModified();
     }
 
+    // The target is compared against the time its commands ran, if they left the file
+    // unchanged. The parents are compared against the time of the last content change.
+    FileTime ownTimeStamp = target->m_timeStamp;
+    BuildHistory::RestatRecord restatRecord;
+    const bool isRestatRecordValid = m_restatHistory && target->m_bFileExists
+            && m_restatHistory->restatRecord(target->targetName(), &restatRecord)
+            && restatRecord.fileTime == target->m_timeStamp;
+    if (isRestatRecordValid && ownTimeStamp < restatRecord.inputTime)
+        ownTimeStamp = restatRecord.inputTime;
+
+    QStringList dependents = target->m_dependents;
+    dependents += target->m_implicitDependents;
+
     bool isUpToDate;
-    if (target->m_dependents.isEmpty()) {
+    if (dependents.isEmpty()) {
         isUpToDate = target->m_bFileExists;
     } else {
         // find latest timestamp of all dependents
         FileTime latestDependentTime;
-        foreach (const QString& dependentName, target->m_dependents) {
+        foreach (const QString& dependentName, dependents) {
             FileTime ts;
             DescriptionBlock *dependent = target->makefile()->target(dependentName);
             if (dependent) {
@@ -146,7 +203,7 @@ bool DependencyGraph::isTargetUpToDate(DescriptionBlock* target)
         if (!target->m_bFileExists)
             target->m_timeStamp = latestDependentTime;
 
-        isUpToDate = (target->m_bFileExists && latestDependentTime <= target->m_timeStamp);
+        isUpToDate = (target->m_bFileExists && latestDependentTime <= ownTimeStamp);
     }
 
     if (isUpToDate && !target->m_inferenceRules.isEmpty()) {
@@ -173,62 +230,296 @@ bool DependencyGraph::isTargetUpToDate(DescriptionBlock* target)
         target->m_inferenceRules = savedRules;
     }
 
+    if (m_contentHashes && target->m_bFileExists)
+        isUpToDate = isTargetContentUpToDate(target, isUpToDate);
+
     if (!isUpToDate && target->m_bFileExists)
         target->m_timeStamp.clear();
+    else if (isUpToDate && isRestatRecordValid)
+        target->m_timeStamp = restatRecord.contentTime;
 
     return isUpToDate;
 }
 
-void DependencyGraph::internalBuild(Node *node, QSet<Node *> &seen)
+/**
+ * Compares the hash of the dependents' contents with the one recorded when the target
+ * was built. Targets that are up-to-date by their time stamps get their hash recorded,
+ * if there's none yet.
+ */
+bool DependencyGraph::isTargetContentUpToDate(DescriptionBlock* target, bool isUpToDateByTimeStamps)
 {
-    const int c = seen.count();
-    seen << node;
-    if (c == seen.count())
-        return;
+    const QString targetName = target->targetName();
+    if (isUpToDateByTimeStamps && m_contentHashes->hasTargetHash(targetName))
+        return true;
+
+    // Take into account the dependents that unapplied inference rules would add.
+    QStringList dependents = target->m_dependents;
+    foreach (InferenceRule *rule, target->m_inferenceRules) {
+        const QString inferredDependent = rule->inferredDependent(targetName);
+        if (!dependents.contains(inferredDependent) && FastFileInfo(inferredDependent).exists())
+            dependents.append(inferredDependent);
+    }
+    dependents += target->m_implicitDependents;
+
+    quint64 hash;
+    if (!m_contentHashes->dependentsHash(dependents, &hash))
+        return isUpToDateByTimeStamps;
+    if (isUpToDateByTimeStamps) {
+        m_contentHashes->setTargetHash(targetName, hash);
+        return true;
+    }
+    return m_contentHashes->isTargetHashEqual(targetName, hash);
+}
 
-    foreach (const QString& dependentName, node->target->m_dependents) {
-        Makefile* const makefile = node->target->makefile();
-        DescriptionBlock* dependent = makefile->target(dependentName);
-        if (!dependent) {
-            // We don't know dependent "foo" but it may have been defined as "C:\MySourceDir\foo"
-            dependent = makefile->target(makefile->dirPath() + QDir::separator() + dependentName);
-        }
+void DependencyGraph::internalBuild(int node)
+{
+    DescriptionBlock* const target = m_nodes.at(node).target;
+    Makefile* const makefile = target->makefile();
+    int childCount = 0;
+    foreach (const QString& dependentName, target->m_dependents) {
+        DescriptionBlock* dependent = makefile->dependentTarget(dependentName);
         if (!dependent) {
-            if (!FastFileInfo(dependentName).exists()) {
-                QByteArray msg = "Error: dependent '";
-                msg += dependentName.toLocal8Bit();
-                msg += "' does not exist.\n";
-                fputs(msg.constData(), stderr);
-                exit(2);
-            }
+            m_fileDependents.append(dependentName);
             continue;
         }
+        if (addChild(node, dependent))
+            childCount++;
+    }
 
-        Node* child = m_nodeContainer.value(dependent);
-        if (child)
-            addEdge(node, child);
-        else
-            child = createNode(dependent, node);
+    if (m_depsLog && !makefile->depFileName(target->targetName()).isEmpty()) {
+        // Implicit dependents that don't exist anymore aren't an error.
+        // They just make the target out of date.
+        target->m_implicitDependents = m_depsLog->dependents(target->targetName());
+        foreach (const QString& dependentName, target->m_implicitDependents) {
+            DescriptionBlock* dependent = makefile->dependentTarget(dependentName);
+            if (dependent && addChild(node, dependent))
+                childCount++;
+        }
+    }
+
+    if (childCount == 0)
+        m_newLeaves.enqueue(node);
+}
+
+/**
+ * Adds an edge from the node to the node of the dependent and creates the latter if needed.
+ * Returns false if the edge already existed.
+ */
+bool DependencyGraph::addChild(int node, DescriptionBlock* dependent)
+{
+    int child = m_nodeIds.value(dependent, -1);
+    if (child >= 0) {
+        // Nodes are built right after their creation. Just add the edge.
+        return addEdge(node, child);
+    }
+
+    child = createNode(dependent);
+    addEdge(node, child);
+    internalBuild(child);
+    return true;
+}
+
+/**
+ * Reads the file attributes of all targets and file dependents of the graph in parallel.
+ * The up-to-date checks in findAvailableTarget then work on cached data only.
+ */
+void DependencyGraph::prefetchFileInfos()
+{
+    QStringList fileNames = m_fileDependents;
+    fileNames.reserve(fileNames.count() + m_nodes.count());
+    foreach (const Node &node, m_nodes) {
+        fileNames.append(node.target->targetName());
+        fileNames += node.target->m_implicitDependents;
+    }
+    FastFileInfo::prefetch(fileNames);
+}
+
+void DependencyGraph::checkFileDependents()
+{
+    foreach (const QString &dependentName, m_fileDependents) {
+        if (!FastFileInfo(dependentName).exists()) {
+            throw Exception(QString::fromLatin1("dependent '%1' does not exist.")
+                            .arg(dependentName));
+        }
+    }
+}
+
+/**
+ * Returns the dependents of the graph's targets that aren't targets themselves.
+ * This includes the implicit dependents, the dependents added by inference rules
+ * during the build, and the ones that unapplied inference rules would add.
+ */
+QStringList DependencyGraph::fileDependents() const
+{
+    QStringList fileNames;
+    QSet<QString> seen;
+    foreach (const Node &node, m_nodes) {
+        DescriptionBlock *const target = node.target;
+        Makefile *const makefile = target->makefile();
+        QStringList dependents = target->m_dependents;
+        dependents += target->m_implicitDependents;
+        foreach (InferenceRule *rule, target->m_inferenceRules) {
+            const QString inferredDependent = rule->inferredDependent(target->targetName());
+            if (FastFileInfo(inferredDependent).exists())
+                dependents.append(inferredDependent);
+        }
+        foreach (const QString &dependentName, dependents) {
+            const QString key = dependentName.toLower();
+            if (seen.contains(key) || makefile->dependentTarget(dependentName))
+                continue;
+            seen.insert(key);
+            fileNames.append(dependentName);
+        }
+    }
+    return fileNames;
+}
+
+bool DependencyGraph::addEdge(int parent, int child)
+{
+    const quint64 key = (quint64(quint32(parent)) << 32) | quint32(child);
+    if (m_edgeSet.contains(key))
+        return false;
+    m_edgeSet.insert(key);
+
+    Edge edge;
+    edge.parent = parent;
+    edge.child = child;
+    m_edges.append(edge);
+    return true;
+}
+
+/**
+ * Converts the edge list into the child and parent adjacency arrays.
+ * The order of each node's children and parents is the order in which the edges were added.
+ */
+void DependencyGraph::buildAdjacency()
+{
+    const int nodeCount = m_nodes.count();
+    m_childOffsets.fill(0, nodeCount + 1);
+    m_parentOffsets.fill(0, nodeCount + 1);
+    foreach (const Edge &edge, m_edges) {
+        m_childOffsets[edge.parent + 1]++;
+        m_parentOffsets[edge.child + 1]++;
+    }
+    for (int i = 0; i < nodeCount; ++i) {
+        m_childOffsets[i + 1] += m_childOffsets.at(i);
+        m_parentOffsets[i + 1] += m_parentOffsets.at(i);
+    }
 
-        internalBuild(child, seen);
+    m_children.resize(m_edges.count());
+    m_parents.resize(m_edges.count());
+    QVector<int> nextChild = m_childOffsets;
+    QVector<int> nextParent = m_parentOffsets;
+    foreach (const Edge &edge, m_edges) {
+        m_children[nextChild[edge.parent]++] = edge.child;
+        m_parents[nextParent[edge.child]++] = edge.parent;
     }
 
-    if (node->children.isEmpty())
-        m_leaves.append(node);
+    for (int i = 0; i < nodeCount; ++i)
+        m_nodes[i].pendingChildren = m_childOffsets.at(i + 1) - m_childOffsets.at(i);
+
+    m_edges = QVector<Edge>();
+    m_edgeSet = QSet<quint64>();
+}
+
+/**
+ * The parser rejects cycles of explicit dependents only.
+ * Implicit dependents from the deps log can close cycles, whose nodes would never become leaves.
+ */
+void DependencyGraph::checkForCycles()
+{
+    // Remove leaves until only the nodes in and above cycles are left.
+    const int nodeCount = m_nodes.count();
+    QVector<int> pendingChildren(nodeCount);
+    QVector<int> leaves;
+    for (int i = 0; i < nodeCount; ++i) {
+        pendingChildren[i] = m_nodes.at(i).pendingChildren;
+        if (pendingChildren.at(i) == 0)
+            leaves.append(i);
+    }
+    for (int k = 0; k < leaves.count(); ++k) {
+        const int node = leaves.at(k);
+        for (int i = m_parentOffsets.at(node); i < m_parentOffsets.at(node + 1); ++i) {
+            const int parent = m_parents.at(i);
+            if (--pendingChildren[parent] == 0)
+                leaves.append(parent);
+        }
+    }
+    if (leaves.count() == nodeCount)
+        return;
+
+    // Every remaining node has a remaining child. Following them long enough ends in a cycle.
+    int node = m_root;
+    for (int steps = 0; steps < nodeCount; ++steps) {
+        for (int i = m_childOffsets.at(node); i < m_childOffsets.at(node + 1); ++i) {
+            const int child = m_children.at(i);
+            if (pendingChildren.at(child) > 0) {
+                node = child;
+                break;
+            }
+        }
+    }
+
+    QString msg = QLatin1String("cycle in targets detected: %1");
+    throw Exception(msg.arg(m_nodes.at(node).target->targetName()));
+}
+
+void DependencyGraph::computePriorities()
+{
+    // Without any recorded durations, the priority is the number of targets on the path.
+    const qint64 unknownDuration = m_buildHistory->isEmpty()
+            ? 1 : qMax(Q_INT64_C(1), m_buildHistory->averageDuration());
+
+    // Visit each node after all of its parents.
+    const int nodeCount = m_nodes.count();
+    QVector<int> pendingParents(nodeCount);
+    for (int i = 0; i < nodeCount; ++i)
+        pendingParents[i] = m_parentOffsets.at(i + 1) - m_parentOffsets.at(i);
+
+    m_priorities.fill(0, nodeCount);
+    QVector<int> nodes;
+    nodes.reserve(nodeCount);
+    nodes.append(m_root);
+    for (int k = 0; k < nodes.count(); ++k) {
+        const int node = nodes.at(k);
+        qint64 longestPathAbove = 0;
+        for (int i = m_parentOffsets.at(node); i < m_parentOffsets.at(node + 1); ++i)
+            longestPathAbove = qMax(longestPathAbove, m_priorities.at(m_parents.at(i)));
+
+        const DescriptionBlock *target = m_nodes.at(node).target;
+        qint64 duration = m_buildHistory->duration(target->targetName());
+        if (duration < 0) {
+            if (target->m_commands.isEmpty() && target->m_inferenceRules.isEmpty())
+                duration = 0;
+            else
+                duration = unknownDuration;
+        }
+        m_priorities[node] = longestPathAbove + duration;
+
+        for (int i = m_childOffsets.at(node); i < m_childOffsets.at(node + 1); ++i) {
+            const int child = m_children.at(i);
+            if (--pendingParents[child] == 0)
+                nodes.append(child);
+        }
+    }
 }
 
 void DependencyGraph::dump()
 {
+    if (m_root < 0)
+        return;
     QString indent;
     internalDump(m_root, indent);
 }
 
-void DependencyGraph::internalDump(Node* node, QString& indent)
+void DependencyGraph::internalDump(int node, QString& indent)
 {
-    puts(qPrintable(QString(indent + node->target->targetName())));
+    puts(qPrintable(QString(indent + m_nodes.at(node).target->targetName())));
     indent.append(QLatin1Char(' '));
-    foreach (Node* child, node->children) {
-        internalDump(child, indent);
+    for (int i = m_childOffsets.at(node); i < m_childOffsets.at(node + 1); ++i) {
+        const int child = m_children.at(i);
+        if (m_nodes.at(child).state != Node::RemovedState)
+            internalDump(child, indent);
     }
     indent.resize(indent.length() - 1);
 }
@@ -236,121 +527,182 @@ void DependencyGraph::internalDump(Node* node, QString& indent)
 void DependencyGraph::dotDump()
 {
     printf("digraph G {\n");
-    QString parent;
-    internalDotDump(m_root, parent);
+    if (m_root >= 0) {
+        QString parent;
+        internalDotDump(m_root, parent);
+    }
     printf("}\n");
 }
 
-void DependencyGraph::internalDotDump(Node* node, const QString& parent)
+void DependencyGraph::internalDotDump(int node, const QString& parent)
 {
+    const QString targetName = m_nodes.at(node).target->targetName();
     if (!parent.isNull()) {
-        QByteArray line = "  \"" + parent.toLocal8Bit() + "\" -> \"" + node->target->targetName().toLocal8Bit() + "\";";
+        QByteArray line = "  \"" + parent.toLocal8Bit() + "\" -> \"" + targetName.toLocal8Bit() + "\";";
         puts(line);
     }
-    foreach (Node* child, node->children) {
-        internalDotDump(child, node->target->targetName());
+    for (int i = m_childOffsets.at(node); i < m_childOffsets.at(node + 1); ++i) {
+        const int child = m_children.at(i);
+        if (m_nodes.at(child).state != Node::RemovedState)
+            internalDotDump(child, targetName);
     }
 }
 
 void DependencyGraph::clear()
 {
-    m_root = 0;
-    qDeleteAll(m_nodeContainer);
-    m_nodeContainer.clear();
-    m_leaves.clear();
-}
-
-void DependencyGraph::addEdge(Node* parent, Node* child)
-{
-    if (!parent->children.contains(child))
-        parent->children.append(child);
-    if (!child->parents.contains(parent))
-        child->parents.append(parent);
+    m_root = -1;
+    m_nodeCount = 0;
+    m_nodes.clear();
+    m_nodeIds.clear();
+    m_childOffsets.clear();
+    m_children.clear();
+    m_parentOffsets.clear();
+    m_parents.clear();
+    m_edges.clear();
+    m_edgeSet.clear();
+    m_fileDependents.clear();
+    m_newLeaves.clear();
+    m_readyQueue.clear();
+    m_priorities.clear();
+    m_readyHeap.clear();
+    m_readySequenceNumber = 0;
 }
 
 bool DependencyGraph::isEmpty() const
 {
-    return m_nodeContainer.isEmpty();
+    return m_nodeCount == 0;
 }
 
 void DependencyGraph::removeLeaf(DescriptionBlock* target)
 {
-    Node* nodeToRemove = m_nodeContainer.value(target);
-    if (nodeToRemove)
+    const int nodeToRemove = m_nodeIds.value(target, -1);
+    if (nodeToRemove >= 0 && m_nodes.at(nodeToRemove).state != Node::RemovedState)
         removeLeaf(nodeToRemove);
 }
 
-void DependencyGraph::removeLeaf(Node* node)
+/**
+ * Marks the node as removed and decrements the pending child counter of its parents.
+ * Parents without pending children become new leaves.
+ */
+void DependencyGraph::removeLeaf(int node)
 {
-    Q_ASSERT(node);
-    Q_ASSERT(node->children.isEmpty());
+    Q_ASSERT(node >= 0);
+    Q_ASSERT(m_nodes.at(node).pendingChildren == 0);
 
-    m_leaves.removeAll(node);
+    m_nodes[node].state = Node::RemovedState;
+    m_nodeCount--;
 
-    foreach (Node* parent, node->parents) {
-        parent->children.removeOne(node);
-        if (parent->children.isEmpty()) {
-            m_bDirtyLeaves = true;
-            m_leaves.append(parent);
-        }
+    for (int i = m_parentOffsets.at(node); i < m_parentOffsets.at(node + 1); ++i) {
+        Node &parent = m_nodes[m_parents.at(i)];
+        if (--parent.pendingChildren == 0)
+            m_newLeaves.enqueue(m_parents.at(i));
     }
-    deleteNode(node);
 }
 
+/**
+ * Returns the next target that must be built, or 0 if there's none at the moment.
+ *
+ * Every node passes through here once after it became a leaf. Up-to-date leaves are
+ * removed right away. Inference rules are applied to the remaining ones before they
+ * are appended to the ready queue.
+ */
 DescriptionBlock *DependencyGraph::findAvailableTarget(bool ignoreTimeStamps)
 {
-    if (m_leaves.isEmpty())
-        return 0;
-
-    if (!ignoreTimeStamps) {
-        // remove all leaves that are not up-to-date
-        QList<Node *> upToDateNodes;
-        while (m_bDirtyLeaves) {
-            m_bDirtyLeaves = false;
-            foreach (Node *leaf, m_leaves)
-                if (leaf->state != Node::ExecutingState && isTargetUpToDate(leaf->target))
-                    upToDateNodes.append(leaf);
-            foreach (Node *leaf, upToDateNodes) {
+    if (!m_newLeaves.isEmpty()) {
+        QVector<int> readyNodes;
+        while (!m_newLeaves.isEmpty()) {
+            // Removing an up-to-date leaf may enqueue its parents.
+            const int leaf = m_newLeaves.dequeue();
+            if (!ignoreTimeStamps && isTargetUpToDate(m_nodes.at(leaf).target)) {
                 displayNodeBuildInfo(leaf, true);
                 removeLeaf(leaf);
+            } else {
+                readyNodes.append(leaf);
             }
-            upToDateNodes.clear();
         }
+        applyInferenceRules(readyNodes);
+        foreach (int leaf, readyNodes)
+            enqueueReadyNode(leaf);
     }
 
+    int leaf;
+    while ((leaf = dequeueReadyNode()) >= 0) {
+        Node &node = m_nodes[leaf];
+        if (node.state == Node::RemovedState)
+            continue;
+        if (node.state != Node::Unbuildable)
+            node.state = Node::ExecutingState;
+        displayNodeBuildInfo(leaf, ignoreTimeStamps ? isTargetUpToDate(node.target) : false);
+        return node.target;
+    }
+
+    return 0;
+}
+
+/**
+ * Orders ready nodes by descending priority. Nodes with equal priority are
+ * handed out in the order they became ready.
+ */
+bool DependencyGraph::readyNodeLessThan(const ReadyNode &lhs, const ReadyNode &rhs)
+{
+    if (lhs.priority != rhs.priority)
+        return lhs.priority < rhs.priority;
+    return lhs.sequenceNumber > rhs.sequenceNumber;
+}
+
+void DependencyGraph::enqueueReadyNode(int node)
+{
+    if (m_priorities.isEmpty()) {
+        m_readyQueue.enqueue(node);
+        return;
+    }
+
+    ReadyNode readyNode;
+    readyNode.priority = m_priorities.at(node);
+    readyNode.sequenceNumber = m_readySequenceNumber++;
+    readyNode.node = node;
+    m_readyHeap.append(readyNode);
+    std::push_heap(m_readyHeap.begin(), m_readyHeap.end(), readyNodeLessThan);
+}
+
+int DependencyGraph::dequeueReadyNode()
+{
+    if (m_priorities.isEmpty())
+        return m_readyQueue.isEmpty() ? -1 : m_readyQueue.dequeue();
+
+    if (m_readyHeap.isEmpty())
+        return -1;
+    std::pop_heap(m_readyHeap.begin(), m_readyHeap.end(), readyNodeLessThan);
+    const int node = m_readyHeap.last().node;
+    m_readyHeap.removeLast();
+    return node;
+}
+
+void DependencyGraph::applyInferenceRules(const QVector<int> &nodes)
+{
     // apply inference rules separated by makefiles
     QSet<Makefile*> makefileSet;
     QMultiHash<Makefile*, DescriptionBlock*> multiHash;
-    foreach (Node *leaf, m_leaves) {
-        makefileSet.insert(leaf->target->makefile());
-        multiHash.insert(leaf->target->makefile(), leaf->target);
+    foreach (int node, nodes) {
+        DescriptionBlock *target = m_nodes.at(node).target;
+        makefileSet.insert(target->makefile());
+        multiHash.insert(target->makefile(), target);
     }
     foreach (Makefile *mf, makefileSet)
         mf->applyInferenceRules(multiHash.values(mf));
-
-    // return the first leaf that is not currently executed
-    foreach (Node *leaf, m_leaves) {
-        if (leaf->state != Node::ExecutingState) {
-            if (leaf->state != Node::Unbuildable)
-                leaf->state = Node::ExecutingState;
-            displayNodeBuildInfo(leaf, ignoreTimeStamps ? isTargetUpToDate(leaf->target) : false);
-            return leaf->target;
-        }
-    }
-
-    return 0;
 }
 
-void DependencyGraph::displayNodeBuildInfo(Node* node, bool isUpToDate)
+void DependencyGraph::displayNodeBuildInfo(int node, bool isUpToDate)
 {
-    if (node->target->makefile()->options()->displayBuildInfo) {
+    DescriptionBlock *target = m_nodes.at(node).target;
+    if (target->makefile()->options()->displayBuildInfo) {
         QByteArray msg;
         if (isUpToDate)
             msg = " ";
         else
             msg = "*";
-        msg += node->target->m_timeStamp.toString().toLocal8Bit() + " " +
-               node->target->targetName().toLocal8Bit();
+        msg += target->m_timeStamp.toString().toLocal8Bit() + " " +
+               target->targetName().toLocal8Bit();
         puts(msg);
     }
 }
@@ -27,10 +27,16 @@
 #define DEPENDENCYGRAPH_H
 
 #include <QtCore/QHash>
+#include <QtCore/QQueue>
 #include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
 
 namespace NMakeFile {
 
+class BuildHistory;
+class ContentHashes;
+class DepsLog;
 class DescriptionBlock;
 
 class DependencyGraph
@@ -39,7 +45,12 @@ public:
     DependencyGraph();
     ~DependencyGraph();
 
+    void setBuildHistory(const BuildHistory *buildHistory);
+    void setContentHashes(ContentHashes *contentHashes);
+    void setDepsLog(const DepsLog *depsLog);
+    void setRestatHistory(const BuildHistory *restatHistory);
     void build(DescriptionBlock* target);
+    QStringList fileDependents() const;
     void markParentsRecursivlyUnbuildable(DescriptionBlock *target);
     bool isUnbuildable(DescriptionBlock *target) const;
     bool isEmpty() const;
@@ -51,32 +62,87 @@ public:
 
 private:
     bool isTargetUpToDate(DescriptionBlock* target);
+    bool isTargetContentUpToDate(DescriptionBlock* target, bool isUpToDateByTimeStamps);
 
     struct Node
     {
-        enum State {UnknownState, ExecutingState, Unbuildable};
+        enum State {UnknownState, ExecutingState, Unbuildable, RemovedState};
 
         State state;
         DescriptionBlock* target;
-        QList<Node*> children;
-        QList<Node*> parents;
+        int pendingChildren;    // number of children that have not been removed yet
     };
 
-    Node* createNode(DescriptionBlock* target, Node* parent);
-    void deleteNode(Node* node);
-    void removeLeaf(Node* node);
-    void internalBuild(Node *node, QSet<Node *> &seen);
-    void addEdge(Node* parent, Node* child);
-    void internalDump(Node* node, QString& indent);
-    void internalDotDump(Node* node, const QString& parent);
-    void displayNodeBuildInfo(Node* node, bool isUpToDate);
-    static void markParentsRecursivlyUnbuildable(Node *node);
+    struct Edge
+    {
+        int parent;
+        int child;
+    };
+
+    struct ReadyNode
+    {
+        qint64 priority;
+        int sequenceNumber;
+        int node;
+    };
+
+    static bool readyNodeLessThan(const ReadyNode &lhs, const ReadyNode &rhs);
+
+    int createNode(DescriptionBlock* target);
+    void removeLeaf(int node);
+    void internalBuild(int node);
+    bool addChild(int node, DescriptionBlock* dependent);
+    void prefetchFileInfos();
+    void checkFileDependents();
+    bool addEdge(int parent, int child);
+    void buildAdjacency();
+    void checkForCycles();
+    void applyInferenceRules(const QVector<int> &nodes);
+    void computePriorities();
+    void enqueueReadyNode(int node);
+    int dequeueReadyNode();
+    void internalDump(int node, QString& indent);
+    void internalDotDump(int node, const QString& parent);
+    void displayNodeBuildInfo(int node, bool isUpToDate);
+    void markParentsRecursivlyUnbuildable(int node);
 
 private:
-    Node* m_root;
-    QHash<DescriptionBlock*, Node*> m_nodeContainer;
-    QList<Node *> m_leaves;
-    bool m_bDirtyLeaves;
+    int m_root;
+    int m_nodeCount;
+    QVector<Node> m_nodes;
+    QHash<DescriptionBlock*, int> m_nodeIds;
+
+    // Adjacency lists in compressed sparse row format. The children of node n are
+    // m_children[m_childOffsets[n]] to m_children[m_childOffsets[n + 1] - 1].
+    // The parents are stored in the same way.
+    QVector<int> m_childOffsets;
+    QVector<int> m_children;
+    QVector<int> m_parentOffsets;
+    QVector<int> m_parents;
+
+    // Edges in insertion order. Only used while building the graph.
+    QVector<Edge> m_edges;
+    QSet<quint64> m_edgeSet;
+
+    // Dependents that aren't targets.
+    QStringList m_fileDependents;
+
+    // Nodes that became leaves and haven't been checked for being up-to-date.
+    QQueue<int> m_newLeaves;
+
+    // Leaves that must be built, in the order they became leaves.
+    QQueue<int> m_readyQueue;
+
+    // Length of the longest path from each node to the root, including the node itself.
+    // If set, m_readyHeap is used instead of m_readyQueue.
+    const BuildHistory *m_buildHistory;
+    QVector<qint64> m_priorities;
+    QVector<ReadyNode> m_readyHeap;
+    int m_readySequenceNumber;
+
+    ContentHashes *m_contentHashes;
+    const DepsLog *m_depsLog;
+    const BuildHistory *m_restatHistory;
 };
 
 } // namespace NMakeFile
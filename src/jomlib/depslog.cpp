@@ -0,0 +1,311 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "depslog.h"
+
+#include <QtCore/QSaveFile>
+#include <QtCore/QtEndian>
+
+#include <cstring>
+
+namespace NMakeFile {
+
+static const char depsLogHeader[] = "# jom deps log 1\n";
+static const int depsLogHeaderLength = sizeof(depsLogHeader) - 1;
+
+enum RecordType
+{
+    PathRecord = 0,
+    DependentsRecord = 1
+};
+
+DepsLog::DepsLog(const QString &fileName)
+    : m_fileName(fileName)
+    , m_dependentsRecordCount(0)
+    , m_bRewriteNeeded(true)
+{
+}
+
+DepsLog::~DepsLog()
+{
+    m_file.close();
+}
+
+static void appendUInt32(QByteArray *records, quint32 value)
+{
+    uchar buffer[4];
+    qToLittleEndian(value, buffer);
+    records->append(reinterpret_cast<const char *>(buffer), 4);
+}
+
+/**
+ * Reads the log. Path records consist of the type byte, the length and the UTF-8 encoded
+ * file name. Dependents records consist of the type byte, the id of the target, the number
+ * of dependents and their ids. All numbers are 32 bit little endian values.
+ * A truncated record at the end of the log is dropped.
+ */
+bool DepsLog::load()
+{
+    m_file.close();
+    m_paths.clear();
+    m_pathIds.clear();
+    m_dependents.clear();
+    m_dependentsRecordCount = 0;
+    m_bRewriteNeeded = true;
+
+    QFile file(m_fileName);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+
+    const qint64 size = file.size();
+    if (size < depsLogHeaderLength)
+        return false;
+    const uchar *data = file.map(0, size);
+    QByteArray content;
+    if (!data) {
+        content = file.readAll();
+        data = reinterpret_cast<const uchar *>(content.constData());
+    }
+    if (memcmp(data, depsLogHeader, depsLogHeaderLength) != 0)
+        return false;
+
+    const uchar *p = data + depsLogHeaderLength;
+    const uchar *const end = data + size;
+    while (end - p >= 5) {
+        const uchar type = *p;
+        const quint32 value = qFromLittleEndian<quint32>(p + 1);
+        if (type == PathRecord) {
+            if (quint64(end - p - 5) < value)
+                break;
+            const QString path = QString::fromUtf8(reinterpret_cast<const char *>(p + 5), value);
+            m_pathIds.insert(key(path), m_paths.count());
+            m_paths.append(path);
+            p += 5 + value;
+        } else if (type == DependentsRecord) {
+            if (end - p < 9 || value >= quint32(m_paths.count()))
+                break;
+            const quint32 count = qFromLittleEndian<quint32>(p + 5);
+            if (quint64(end - p - 9) / 4 < count)
+                break;
+            QVector<quint32> ids(count);
+            bool valid = true;
+            for (quint32 i = 0; i < count; ++i) {
+                ids[i] = qFromLittleEndian<quint32>(p + 9 + 4 * i);
+                if (ids.at(i) >= quint32(m_paths.count()))
+                    valid = false;
+            }
+            if (!valid)
+                break;
+            m_dependents.insert(value, ids);
+            ++m_dependentsRecordCount;
+            p += 9 + 4 * count;
+        } else {
+            break;
+        }
+    }
+
+    // Rewrite the log if it's damaged or if most of its records are outdated.
+    m_bRewriteNeeded = p != end
+            || (m_dependentsRecordCount > 1000
+                && m_dependentsRecordCount > 3 * m_dependents.count());
+    return true;
+}
+
+/**
+ * Returns the dependents that were recorded for the target.
+ */
+QStringList DepsLog::dependents(const QString &targetName) const
+{
+    QStringList result;
+    QHash<QString, quint32>::const_iterator it = m_pathIds.constFind(key(targetName));
+    if (it == m_pathIds.constEnd())
+        return result;
+    const QVector<quint32> ids = m_dependents.value(it.value());
+    result.reserve(ids.count());
+    foreach (quint32 id, ids)
+        result.append(m_paths.at(id));
+    return result;
+}
+
+/**
+ * Replaces the recorded dependents of the target and appends the change to the log file.
+ */
+bool DepsLog::recordDependents(const QString &targetName, const QStringList &dependents)
+{
+    QByteArray records;
+    const quint32 targetId = pathId(targetName, &records);
+    QVector<quint32> dependentIds;
+    dependentIds.reserve(dependents.count());
+    foreach (const QString &dependent, dependents)
+        dependentIds.append(pathId(dependent, &records));
+
+    QHash<quint32, QVector<quint32> >::const_iterator it = m_dependents.constFind(targetId);
+    if (records.isEmpty() && it != m_dependents.constEnd() && it.value() == dependentIds)
+        return true;
+
+    m_dependents.insert(targetId, dependentIds);
+    ++m_dependentsRecordCount;
+    if (m_bRewriteNeeded)
+        return rewrite();
+
+    appendDependentsRecord(targetId, dependentIds, &records);
+    if (!m_file.isOpen()) {
+        m_file.setFileName(m_fileName);
+        if (!m_file.open(QFile::WriteOnly | QFile::Append))
+            return false;
+    }
+    if (m_file.write(records) != records.size())
+        return false;
+    return m_file.flush();
+}
+
+quint32 DepsLog::pathId(const QString &fileName, QByteArray *records)
+{
+    const QString fileKey = key(fileName);
+    QHash<QString, quint32>::const_iterator it = m_pathIds.constFind(fileKey);
+    if (it != m_pathIds.constEnd())
+        return it.value();
+
+    const quint32 id = m_paths.count();
+    m_pathIds.insert(fileKey, id);
+    m_paths.append(fileName);
+
+    const QByteArray utf8 = fileName.toUtf8();
+    records->append(char(PathRecord));
+    appendUInt32(records, utf8.size());
+    records->append(utf8);
+    return id;
+}
+
+void DepsLog::appendDependentsRecord(quint32 targetId, const QVector<quint32> &dependentIds,
+                                     QByteArray *records) const
+{
+    records->append(char(DependentsRecord));
+    appendUInt32(records, targetId);
+    appendUInt32(records, dependentIds.count());
+    foreach (quint32 id, dependentIds)
+        appendUInt32(records, id);
+}
+
+/**
+ * Writes a new log that contains only the current dependents of each target.
+ */
+bool DepsLog::rewrite()
+{
+    m_file.close();
+
+    QByteArray records(depsLogHeader, depsLogHeaderLength);
+    for (int i = 0; i < m_paths.count(); ++i) {
+        const QByteArray utf8 = m_paths.at(i).toUtf8();
+        records.append(char(PathRecord));
+        appendUInt32(&records, utf8.size());
+        records.append(utf8);
+    }
+    QHash<quint32, QVector<quint32> >::const_iterator it = m_dependents.constBegin();
+    for (; it != m_dependents.constEnd(); ++it)
+        appendDependentsRecord(it.key(), it.value(), &records);
+
+    QSaveFile file(m_fileName);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+    file.write(records);
+    if (!file.commit())
+        return false;
+
+    m_dependentsRecordCount = m_dependents.count();
+    m_bRewriteNeeded = false;
+    return true;
+}
+
+static void appendDependent(QByteArray &path, QStringList *dependents)
+{
+    if (path.isEmpty())
+        return;
+    dependents->append(QFile::decodeName(path));
+    path.clear();
+}
+
+/**
+ * Reads the dependents of the first rule of a depfile as written by gcc -MD or clang -MD.
+ * Spaces and hash signs in file names are escaped with a backslash, dollar signs are doubled.
+ * Other backslashes are part of the file name.
+ */
+bool DepsLog::readDepFile(const QString &fileName, QStringList *dependents)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    const QByteArray content = file.readAll();
+    dependents->clear();
+
+    // The target name ends at the first colon that is followed by white space.
+    // Other colons belong to drive letters.
+    const int n = content.size();
+    int i = 0;
+    for (; i < n; ++i) {
+        if (content.at(i) == ':'
+                && (i + 1 == n || content.at(i + 1) == ' ' || content.at(i + 1) == '\t'
+                    || content.at(i + 1) == '\r' || content.at(i + 1) == '\n')) {
+            break;
+        }
+    }
+    if (i == n)
+        return false;
+
+    QByteArray path;
+    for (++i; i < n; ++i) {
+        const char ch = content.at(i);
+        if (ch == '\\' && i + 1 < n) {
+            const char next = content.at(i + 1);
+            if (next == '\r' || next == '\n') {
+                // line continuation
+                ++i;
+                if (next == '\r' && i + 1 < n && content.at(i + 1) == '\n')
+                    ++i;
+                appendDependent(path, dependents);
+                continue;
+            }
+            if (next == ' ' || next == '#') {
+                path += next;
+                ++i;
+                continue;
+            }
+        } else if (ch == '$' && i + 1 < n && content.at(i + 1) == '$') {
+            path += '$';
+            ++i;
+            continue;
+        } else if (ch == '\n') {
+            break;
+        } else if (ch == ' ' || ch == '\t' || ch == '\r') {
+            appendDependent(path, dependents);
+            continue;
+        }
+        path += ch;
+    }
+    appendDependent(path, dependents);
+    return true;
+}
+
+} // namespace NMakeFile
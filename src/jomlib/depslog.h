@@ -0,0 +1,75 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef DEPSLOG_H
+#define DEPSLOG_H
+
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+namespace NMakeFile {
+
+/**
+ * Implicit dependents of targets, read from compiler generated depfiles in previous builds.
+ *
+ * The log is a binary file that is only ever appended to. Path records assign ids to
+ * file names. Dependents records store the ids of a target's dependents, replacing
+ * earlier records of the same target. The log is rewritten when it contains too
+ * many outdated records.
+ */
+class DepsLog
+{
+public:
+    explicit DepsLog(const QString &fileName);
+    ~DepsLog();
+
+    const QString &fileName() const { return m_fileName; }
+    bool load();
+    QStringList dependents(const QString &targetName) const;
+    bool recordDependents(const QString &targetName, const QStringList &dependents);
+
+    static bool readDepFile(const QString &fileName, QStringList *dependents);
+
+private:
+    static QString key(const QString &fileName) { return fileName.toLower(); }
+    quint32 pathId(const QString &fileName, QByteArray *records);
+    void appendDependentsRecord(quint32 targetId, const QVector<quint32> &dependentIds,
+                                QByteArray *records) const;
+    bool rewrite();
+
+    QString m_fileName;
+    QFile m_file;
+    QStringList m_paths;
+    QHash<QString, quint32> m_pathIds;
+    QHash<quint32, QVector<quint32> > m_dependents;
+    int m_dependentsRecordCount;
+    bool m_bRewriteNeeded;
+};
+
+} // namespace NMakeFile
+
+#endif // DEPSLOG_H
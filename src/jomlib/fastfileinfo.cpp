@@ -27,7 +27,13 @@
 
 #include <QtCore/QDebug>
 #include <QtCore/QDir>
+#include <QtCore/QFileInfo>
 #include <QtCore/QHash>
+#include <QtCore/QRunnable>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
 #include <windows.h>
 
 namespace NMakeFile {
@@ -45,40 +51,200 @@ inline const WIN32_FILE_ATTRIBUTE_DATA* z(const FastFileInfo::InternalType &inte
     return reinterpret_cast<const WIN32_FILE_ATTRIBUTE_DATA*>(&internalData);
 }
 
-static WIN32_FILE_ATTRIBUTE_DATA createInvalidFAD()
+struct DirectoryListing
 {
-    WIN32_FILE_ATTRIBUTE_DATA fad = {0};
-    fad.dwFileAttributes = INVALID_FILE_ATTRIBUTES;
-    return fad;
-}
+    QHash<QString, WIN32_FILE_ATTRIBUTE_DATA> entries;
+};
 
+/**
+ * Cache of file attributes, keyed by the file name as it was queried.
+ * Only existing files are cached. Missing files are checked again on every query,
+ * because commands might create them at any time.
+ */
 static QHash<QString, WIN32_FILE_ATTRIBUTE_DATA> fadHash;
 
-FastFileInfo::FastFileInfo(const QString &fileName)
+/**
+ * The file attribute caches of the working directories that are not the current one.
+ * Relative file names mean different files in different working directories.
+ */
+static QHash<QString, QHash<QString, WIN32_FILE_ATTRIBUTE_DATA> > inactiveFadHashes;
+static QString currentDirectoryPath;
+
+/**
+ * Cache of whole directory listings, keyed by the lower case absolute directory path.
+ * The entries are keyed by the lower case file name.
+ */
+static QHash<QString, DirectoryListing> directoryHash;
+
+static const QString &longPathPrefix()
 {
-    static const WIN32_FILE_ATTRIBUTE_DATA invalidFAD = createInvalidFAD();
-    *z(m_attributes) = fadHash.value(fileName, invalidFAD);
-    if (z(m_attributes)->dwFileAttributes != INVALID_FILE_ATTRIBUTES)
-        return;
+    static const QString prefix = QStringLiteral("\\\\?\\");
+    return prefix;
+}
 
-    static const QString longPathPrefix = QStringLiteral("\\\\?\\");
-    QString nativeFilePath = QDir::toNativeSeparators(QFileInfo(fileName).absoluteFilePath());
-    if (!nativeFilePath.startsWith(longPathPrefix))
-        nativeFilePath.prepend(longPathPrefix);
+static QString nativeAbsoluteFilePath(const QString &fileName)
+{
+    return QDir::toNativeSeparators(QFileInfo(fileName).absoluteFilePath());
+}
 
+static void splitFilePath(const QString &nativeFilePath, QString *directoryKey, QString *fileKey)
+{
+    const int idx = nativeFilePath.lastIndexOf(QLatin1Char('\\'));
+    *directoryKey = nativeFilePath.left(idx).toLower();
+    *fileKey = nativeFilePath.mid(idx + 1).toLower();
+}
+
+static QString directoryKeyOf(const QString &dirPath)
+{
+    QString directoryKey = nativeAbsoluteFilePath(dirPath).toLower();
+    if (directoryKey.endsWith(QLatin1Char('\\')))
+        directoryKey.chop(1);
+    return directoryKey;
+}
+
+static WIN32_FILE_ATTRIBUTE_DATA fileAttributes(QString nativeFilePath)
+{
+    if (!nativeFilePath.startsWith(longPathPrefix()))
+        nativeFilePath.prepend(longPathPrefix());
+
+    WIN32_FILE_ATTRIBUTE_DATA fad;
     if (!GetFileAttributesEx(reinterpret_cast<const TCHAR*>(nativeFilePath.utf16()),
-                             GetFileExInfoStandard, &m_attributes))
+                             GetFileExInfoStandard, &fad))
+    {
+        fad.dwFileAttributes = INVALID_FILE_ATTRIBUTES;
+    }
+    return fad;
+}
+
+/**
+ * Reads the attributes of all files of a directory with one enumeration.
+ * A directory that doesn't exist yields an empty listing.
+ */
+static DirectoryListing listDirectory(const QString &directoryKey)
+{
+    DirectoryListing listing;
+
+    QString pattern = directoryKey;
+    if (!pattern.startsWith(longPathPrefix()))
+        pattern.prepend(longPathPrefix());
+    pattern += QLatin1String("\\*");
+
+    WIN32_FIND_DATA findData;
+    HANDLE hFind = FindFirstFileEx(reinterpret_cast<const TCHAR*>(pattern.utf16()),
+                                   FindExInfoBasic, &findData, FindExSearchNameMatch,
+                                   NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return listing;
+
+    do {
+        const QString fileName = QString::fromWCharArray(findData.cFileName);
+        if (fileName == QLatin1String(".") || fileName == QLatin1String(".."))
+            continue;
+        WIN32_FILE_ATTRIBUTE_DATA fad;
+        fad.dwFileAttributes = findData.dwFileAttributes;
+        fad.ftCreationTime = findData.ftCreationTime;
+        fad.ftLastAccessTime = findData.ftLastAccessTime;
+        fad.ftLastWriteTime = findData.ftLastWriteTime;
+        fad.nFileSizeHigh = findData.nFileSizeHigh;
+        fad.nFileSizeLow = findData.nFileSizeLow;
+        listing.entries.insert(fileName.toLower(), fad);
+    } while (FindNextFile(hFind, &findData));
+    FindClose(hFind);
+    return listing;
+}
+
+class ListDirectoryTask : public QRunnable
+{
+public:
+    ListDirectoryTask(const QString &directoryKey, DirectoryListing *listing)
+        : m_directoryKey(directoryKey), m_listing(listing)
     {
-        z(m_attributes)->dwFileAttributes = INVALID_FILE_ATTRIBUTES;
+    }
+
+    void run() override
+    {
+        *m_listing = listDirectory(m_directoryKey);
+    }
+
+private:
+    const QString m_directoryKey;
+    DirectoryListing *const m_listing;
+};
+
+/**
+ * Reads the directories of the given files in parallel and puts their listings into the cache.
+ * Later FastFileInfo lookups of files in these directories don't touch the file system.
+ */
+void FastFileInfo::prefetch(const QStringList &fileNames)
+{
+    QStringList directoryKeys;
+    QSet<QString> seenDirectoryKeys;
+    foreach (const QString &fileName, fileNames) {
+        if (fadHash.contains(fileName))
+            continue;
+        QString directoryKey, fileKey;
+        splitFilePath(nativeAbsoluteFilePath(fileName), &directoryKey, &fileKey);
+        if (fileKey.isEmpty() || directoryHash.contains(directoryKey)
+                || seenDirectoryKeys.contains(directoryKey)) {
+            continue;
+        }
+        seenDirectoryKeys.insert(directoryKey);
+        directoryKeys.append(directoryKey);
+    }
+
+    // A single directory is listed on first use anyway.
+    if (directoryKeys.count() < 2)
+        return;
+
+    QVector<DirectoryListing> listings(directoryKeys.count());
+    QThreadPool threadPool;
+    for (int i = 0; i < directoryKeys.count(); ++i)
+        threadPool.start(new ListDirectoryTask(directoryKeys.at(i), &listings[i]));
+    threadPool.waitForDone();
+
+    for (int i = 0; i < directoryKeys.count(); ++i)
+        directoryHash.insert(directoryKeys.at(i), listings.at(i));
+}
+
+FastFileInfo::FastFileInfo(const QString &fileName)
+{
+    QHash<QString, WIN32_FILE_ATTRIBUTE_DATA>::const_iterator it = fadHash.constFind(fileName);
+    if (it != fadHash.constEnd()) {
+        *z(m_attributes) = it.value();
+        return;
+    }
+
+    const QString nativeFilePath = nativeAbsoluteFilePath(fileName);
+    QString directoryKey, fileKey;
+    splitFilePath(nativeFilePath, &directoryKey, &fileKey);
+    if (fileKey.isEmpty()) {
+        // root directory
+        *z(m_attributes) = fileAttributes(nativeFilePath);
         return;
     }
 
+    QHash<QString, DirectoryListing>::iterator dit = directoryHash.find(directoryKey);
+    if (dit == directoryHash.end())
+        dit = directoryHash.insert(directoryKey, listDirectory(directoryKey));
+
+    DirectoryListing &listing = dit.value();
+    QHash<QString, WIN32_FILE_ATTRIBUTE_DATA>::const_iterator eit = listing.entries.constFind(fileKey);
+    if (eit != listing.entries.constEnd()) {
+        *z(m_attributes) = eit.value();
+    } else {
+        // The file might have been created after the directory was listed.
+        *z(m_attributes) = fileAttributes(nativeFilePath);
+        if (z(m_attributes)->dwFileAttributes == INVALID_FILE_ATTRIBUTES)
+            return;
+        listing.entries.insert(fileKey, *z(m_attributes));
+    }
+
     fadHash.insert(fileName, *z(m_attributes));
 }
 
 bool FastFileInfo::exists() const
 {
-    return z(m_attributes)->dwFileAttributes != INVALID_FILE_ATTRIBUTES; 
+    return z(m_attributes)->dwFileAttributes != INVALID_FILE_ATTRIBUTES;
 }
 
 FileTime FastFileInfo::lastModified() const
@@ -91,9 +257,104 @@ FileTime FastFileInfo::lastModified() const
     }
 }
 
+qint64 FastFileInfo::size() const
+{
+    const WIN32_FILE_ATTRIBUTE_DATA *fattr = z(m_attributes);
+    if (fattr->dwFileAttributes == INVALID_FILE_ATTRIBUTES)
+        return -1;
+    return (qint64(fattr->nFileSizeHigh) << 32) | fattr->nFileSizeLow;
+}
+
+/**
+ * Returns the working directory of the process as set by setCurrentDirectory.
+ */
+QString FastFileInfo::currentDirectory()
+{
+    if (currentDirectoryPath.isNull())
+        currentDirectoryPath = QDir::currentPath();
+    return currentDirectoryPath;
+}
+
+/**
+ * Changes the working directory of the process, if it differs from dirPath.
+ * Makefiles that are built in-process share the working directory of the process.
+ * Everyone who works with relative file names must set the own directory first.
+ */
+bool FastFileInfo::setCurrentDirectory(const QString &dirPath)
+{
+    const QString previousDirPath = currentDirectory();
+    if (dirPath == previousDirPath)
+        return true;
+    if (!QDir::setCurrent(dirPath))
+        return false;
+    inactiveFadHashes[previousDirPath].swap(fadHash);
+    fadHash.swap(inactiveFadHashes[dirPath]);
+    currentDirectoryPath = dirPath;
+    return true;
+}
+
+/**
+ * Must be called after the file has been (re)built.
+ * Updates the cached attributes of this file in the listing of its directory.
+ */
 void FastFileInfo::clearCacheForFile(const QString &fileName)
 {
     fadHash.remove(fileName);
+
+    const QString nativeFilePath = nativeAbsoluteFilePath(fileName);
+    QString directoryKey, fileKey;
+    splitFilePath(nativeFilePath, &directoryKey, &fileKey);
+    QHash<QString, DirectoryListing>::iterator dit = directoryHash.find(directoryKey);
+    if (dit == directoryHash.end())
+        return;
+
+    const WIN32_FILE_ATTRIBUTE_DATA fad = fileAttributes(nativeFilePath);
+    if (fad.dwFileAttributes == INVALID_FILE_ATTRIBUTES)
+        dit->entries.remove(fileKey);
+    else
+        dit->entries.insert(fileKey, fad);
+}
+
+/**
+ * Must be called if files in this directory have been changed by someone else.
+ * The attributes that are cached by queried file name can't be mapped to their directories
+ * cheaply. Therefore, these caches are dropped completely. They are refilled from the
+ * directory listings.
+ */
+void FastFileInfo::clearCacheForDirectory(const QString &dirPath)
+{
+    fadHash.clear();
+    inactiveFadHashes.clear();
+    directoryHash.remove(directoryKeyOf(dirPath));
+}
+
+/**
+ * Drops the listings of all directories that are not in the tree below dirPath.
+ */
+void FastFileInfo::clearCacheOutside(const QString &dirPath)
+{
+    fadHash.clear();
+    inactiveFadHashes.clear();
+    const QString rootKey = directoryKeyOf(dirPath);
+    QHash<QString, DirectoryListing>::iterator it = directoryHash.begin();
+    while (it != directoryHash.end()) {
+        const QString &directoryKey = it.key();
+        if (directoryKey.startsWith(rootKey)
+                && (directoryKey.length() == rootKey.length()
+                    || directoryKey.at(rootKey.length()) == QLatin1Char('\\')))
+        {
+            ++it;
+        } else {
+            it = directoryHash.erase(it);
+        }
+    }
+}
+
+void FastFileInfo::clearCache()
+{
+    fadHash.clear();
+    inactiveFadHashes.clear();
+    directoryHash.clear();
 }
 
 } // NMakeFile
@@ -28,6 +28,8 @@
 
 #include "filetime.h"
 
+#include <QtCore/QStringList>
+
 namespace NMakeFile {
 
 class FastFileInfo
@@ -37,8 +39,15 @@ public:
 
     bool exists() const;
     FileTime lastModified() const;
+    qint64 size() const;
 
+    static void prefetch(const QStringList &fileNames);
     static void clearCacheForFile(const QString &fileName);
+    static void clearCacheForDirectory(const QString &dirPath);
+    static void clearCacheOutside(const QString &dirPath);
+    static void clearCache();
+    static QString currentDirectory();
+    static bool setCurrentDirectory(const QString &dirPath);
 
     struct InternalType
     {
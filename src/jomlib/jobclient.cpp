@@ -24,20 +24,16 @@
 ****************************************************************************/
 
 #include "jobclient.h"
-#include "jobclientacquirehelper.h"
+#include "jobtokenpool.h"
 #include "helperfunctions.h"
 
-#include <QSystemSemaphore>
-#include <QThread>
-
 namespace NMakeFile {
 
 JobClient::JobClient(ProcessEnvironment *environment, QObject *parent)
     : QObject(parent)
     , m_environment(environment)
-    , m_semaphore(0)
-    , m_acquireThread(new QThread(this))
-    , m_acquireHelper(0)
+    , m_tokenPool(0)
+    , m_numberOfSpareTokens(0)
     , m_isAcquiring(false)
 {
 }
@@ -46,52 +42,66 @@ JobClient::~JobClient()
 {
     if (isAcquiring())
         qWarning("JobClient destroyed while still acquiring.");
-    m_acquireThread->quit();
-    m_acquireThread->wait(2500);
-    delete m_acquireHelper;
-    delete m_semaphore;
+    if (m_tokenPool)
+        releaseSpareTokens();
 }
 
 bool JobClient::start()
 {
-    Q_ASSERT(!m_semaphore && !m_acquireHelper);
-    Q_ASSERT(!m_acquireThread->isRunning());
+    Q_ASSERT(!m_tokenPool);
 
-    const QString semaphoreKey = m_environment->value(QLatin1String("_JOMSRVKEY_"));
-    if (semaphoreKey.isEmpty()) {
+    const QString auth = m_environment->value(QLatin1String("_JOMSRVKEY_"));
+    if (auth.isEmpty()) {
         setError(QLatin1String("Cannot determine jobserver name."));
         return false;
     }
-    m_semaphore = new QSystemSemaphore(semaphoreKey);
-    if (m_semaphore->error() != QSystemSemaphore::NoError) {
-        setError(m_semaphore->errorString());
+    m_tokenPool = new JobTokenPool(this);
+    if (!m_tokenPool->open(auth)) {
+        setError(m_tokenPool->errorString());
         return false;
     }
 
-    m_acquireHelper = new JobClientAcquireHelper(m_semaphore);
-    m_acquireHelper->moveToThread(m_acquireThread);
-    connect(this, &JobClient::startAcquisition, m_acquireHelper, &JobClientAcquireHelper::acquire);
-    connect(m_acquireHelper, &JobClientAcquireHelper::acquired, this, &JobClient::onHelperAcquired);
-    m_acquireThread->start();
+    connect(m_tokenPool, SIGNAL(acquired(int)), this, SLOT(onTokensAcquired(int)));
+    connect(m_tokenPool, SIGNAL(acquisitionFailed()), this, SLOT(onTokenAcquisitionFailed()));
     return true;
 }
 
-void JobClient::asyncAcquire()
+/**
+ * Acquires one job token and emits acquired() when done, or acquisitionFailed() on error.
+ *
+ * If the job server has more tokens at hand, up to maxNumberOfTokens are taken in one go.
+ * The extra tokens are used by subsequent calls. Give them back with releaseSpareTokens()
+ * when there's nothing to build for them.
+ */
+void JobClient::asyncAcquire(int maxNumberOfTokens)
 {
-    Q_ASSERT(m_semaphore);
-    Q_ASSERT(m_acquireHelper);
-    Q_ASSERT(m_acquireThread->isRunning());
+    Q_ASSERT(m_tokenPool);
+    Q_ASSERT(!m_isAcquiring);
+
+    if (m_numberOfSpareTokens > 0) {
+        m_numberOfSpareTokens--;
+        emit acquired();
+        return;
+    }
 
     m_isAcquiring = true;
-    emit startAcquisition();
+    m_tokenPool->asyncAcquire(qMax(1, maxNumberOfTokens));
 }
 
-void JobClient::onHelperAcquired()
+void JobClient::onTokensAcquired(int numberOfTokens)
 {
     m_isAcquiring = false;
+    m_numberOfSpareTokens += numberOfTokens - 1;
     emit acquired();
 }
 
+void JobClient::onTokenAcquisitionFailed()
+{
+    m_isAcquiring = false;
+    setError(QLatin1String("Cannot acquire job token: ") + m_tokenPool->errorString());
+    emit acquisitionFailed();
+}
+
 bool JobClient::isAcquiring() const
 {
     return m_isAcquiring;
@@ -99,11 +109,16 @@ bool JobClient::isAcquiring() const
 
 void JobClient::release()
 {
-    Q_ASSERT(m_semaphore);
+    Q_ASSERT(m_tokenPool);
 
-    if (!m_semaphore->release())
-        qWarning("QSystemSemaphore::release failed: %s (%d)",
-                 qPrintable(m_semaphore->errorString()), m_semaphore->error());
+    if (!m_tokenPool->release())
+        qWarning("Cannot release job token: %s", qPrintable(m_tokenPool->errorString()));
+}
+
+void JobClient::releaseSpareTokens()
+{
+    for (; m_numberOfSpareTokens > 0; --m_numberOfSpareTokens)
+        release();
 }
 
 QString JobClient::errorString() const
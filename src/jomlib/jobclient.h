@@ -29,14 +29,9 @@
 #include "processenvironment.h"
 #include <QObject>
 
-QT_BEGIN_NAMESPACE
-class QSystemSemaphore;
-class QThread;
-QT_END_NAMESPACE
-
 namespace NMakeFile {
 
-class JobClientAcquireHelper;
+class JobTokenPool;
 
 class JobClient : public QObject
 {
@@ -46,26 +41,27 @@ public:
     ~JobClient();
 
     bool start();
-    void asyncAcquire();
+    void asyncAcquire(int maxNumberOfTokens = 1);
     bool isAcquiring() const;
     void release();
+    void releaseSpareTokens();
     QString errorString() const;
 
 signals:
-    void startAcquisition();
     void acquired();
+    void acquisitionFailed();
 
 private slots:
-    void onHelperAcquired();
+    void onTokensAcquired(int numberOfTokens);
+    void onTokenAcquisitionFailed();
 
 private:
     void setError(const QString &errorMessage);
 
     ProcessEnvironment *m_environment;
     QString m_errorString;
-    QSystemSemaphore *m_semaphore;
-    QThread *m_acquireThread;
-    JobClientAcquireHelper *m_acquireHelper;
+    JobTokenPool *m_tokenPool;
+    int m_numberOfSpareTokens;
     bool m_isAcquiring;
 };
 
@@ -24,41 +24,38 @@
 ****************************************************************************/
 
 #include "jobserver.h"
-#include "filetime.h"
-#include "helperfunctions.h"
-#include <QByteArray>
-#include <QCoreApplication>
-#include <QSystemSemaphore>
+#include "jobtokenpool.h"
+
+#include <QRegExp>
+#include <QStringList>
 
 namespace NMakeFile {
 
 JobServer::JobServer(ProcessEnvironment *environment)
-    : m_semaphore(0)
+    : m_tokenPool(0)
     , m_environment(environment)
 {
 }
 
 JobServer::~JobServer()
 {
-    delete m_semaphore;
+    delete m_tokenPool;
 }
 
-bool JobServer::start(int maxNumberOfJobs)
+bool JobServer::start(int maxNumberOfJobs, bool advertiseInMakeFlags)
 {
     Q_ASSERT(m_environment);
 
-    const quint64 randomId = (FileTime::currentTime().internalRepresentation() % UINT_MAX)
-        ^ reinterpret_cast<quint64>(&maxNumberOfJobs);
-    const QString semaphoreKey = QLatin1String("jomsrv-")
-            + QString::number(QCoreApplication::applicationPid()) + QLatin1Char('-')
-            + QString::number(randomId);
-    m_semaphore = new QSystemSemaphore(semaphoreKey, maxNumberOfJobs - 1, QSystemSemaphore::Create);
-    if (m_semaphore->error() != QSystemSemaphore::NoError) {
-        setError(m_semaphore->errorString());
+    // The process that starts the job server owns one implicit job token.
+    m_tokenPool = new JobTokenPool;
+    if (!m_tokenPool->create(maxNumberOfJobs - 1)) {
+        setError(m_tokenPool->errorString());
         return false;
     }
-    m_environment->insert(QLatin1String("_JOMSRVKEY_"), semaphoreKey);
+    m_environment->insert(QLatin1String("_JOMSRVKEY_"), m_tokenPool->auth());
     m_environment->insert(QLatin1String("_JOMJOBCOUNT_"), QString::number(maxNumberOfJobs));
+    if (advertiseInMakeFlags)
+        JobServer::advertiseInMakeFlags(m_environment, m_tokenPool->auth(), maxNumberOfJobs);
     return true;
 }
 
@@ -72,4 +69,70 @@ void JobServer::setError(const QString &errorMessage)
     m_errorString = errorMessage;
 }
 
+/**
+ * Returns the job server of a GNU make compatible parent process.
+ * GNU make passes it as --jobserver-auth or, before version 4.2, as --jobserver-fds.
+ */
+QString JobServer::authFromMakeFlags(const QString &makeflags)
+{
+    QString auth;
+    foreach (const QString &word, makeflags.split(QLatin1Char(' '), QString::SkipEmptyParts)) {
+        if (word == QLatin1String("--"))
+            break;  // command line variable definitions follow
+        if (word.startsWith(QLatin1String("--jobserver-auth=")))
+            auth = word.mid(17);
+        else if (word.startsWith(QLatin1String("--jobserver-fds=")))
+            auth = word.mid(16);
+    }
+    return auth;
+}
+
+int JobServer::jobCountFromMakeFlags(const QString &makeflags)
+{
+    int result = 0;
+    foreach (const QString &word, makeflags.split(QLatin1Char(' '), QString::SkipEmptyParts)) {
+        if (word == QLatin1String("--"))
+            break;
+        if (word.startsWith(QLatin1String("-j")) && word.length() > 2) {
+            bool ok;
+            const int n = word.mid(2).toInt(&ok);
+            if (ok && n > 0)
+                result = n;
+        }
+    }
+    return result;
+}
+
+/**
+ * Returns the single-letter flags of MAKEFLAGS without the options that GNU make puts there.
+ * A MAKEFLAGS value without spaces is returned unchanged.
+ */
+QString JobServer::jomFlagsFromMakeFlags(const QString &makeflags)
+{
+    if (!makeflags.contains(QLatin1Char(' ')))
+        return makeflags;
+    const QString firstWord = makeflags.section(QLatin1Char(' '), 0, 0);
+    if (firstWord.startsWith(QLatin1Char('-')))
+        return QString();
+    return firstWord;
+}
+
+/**
+ * Makes the job server visible to GNU make compatible tools, e.g. make, ninja and cargo.
+ */
+void JobServer::advertiseInMakeFlags(ProcessEnvironment *environment, const QString &auth,
+                                     int maxNumberOfJobs)
+{
+    QString makeflags = jomFlagsFromMakeFlags(environment->value(QLatin1String("MAKEFLAGS")));
+
+    // GNU make doesn't know our /J flag. The job count is passed as -j instead.
+    // Our /J flag is always followed by the job count. Other J letters are left alone.
+    makeflags.replace(QRegExp(QLatin1String("^([^J]*)J\\d+"), Qt::CaseInsensitive),
+                      QLatin1String("\\1"));
+
+    makeflags += QLatin1String(" -j") + QString::number(maxNumberOfJobs)
+            + QLatin1String(" --jobserver-auth=") + auth;
+    environment->insert(QLatin1String("MAKEFLAGS"), makeflags);
+}
+
 } // namespace NMakeFile
@@ -28,26 +28,30 @@
 
 #include "processenvironment.h"
 
-QT_BEGIN_NAMESPACE
-class QSystemSemaphore;
-QT_END_NAMESPACE
-
 namespace NMakeFile {
 
+class JobTokenPool;
+
 class JobServer
 {
 public:
     JobServer(ProcessEnvironment *environment);
     ~JobServer();
 
-    bool start(int maxNumberOfJobs);
+    bool start(int maxNumberOfJobs, bool advertiseInMakeFlags);
     QString errorString() const;
 
+    static QString authFromMakeFlags(const QString &makeflags);
+    static int jobCountFromMakeFlags(const QString &makeflags);
+    static QString jomFlagsFromMakeFlags(const QString &makeflags);
+    static void advertiseInMakeFlags(ProcessEnvironment *environment, const QString &auth,
+                                     int maxNumberOfJobs);
+
 private:
     void setError(const QString &errorMessage);
 
     QString m_errorString;
-    QSystemSemaphore *m_semaphore;
+    JobTokenPool *m_tokenPool;
     ProcessEnvironment *m_environment;
 };
 
@@ -0,0 +1,88 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef JOBTOKENPOOL_H
+#define JOBTOKENPOOL_H
+
+#include <QtCore/QObject>
+#include <QtCore/QString>
+
+namespace NMakeFile {
+
+class JobTokenPoolPrivate;
+
+/**
+ * A pool of job tokens that is shared between processes.
+ *
+ * The pool follows the GNU make jobserver protocol. On Windows, it is a named semaphore.
+ * Elsewhere, it is a named pipe ("fifo:PATH") or a pair of inherited pipe descriptors
+ * ("R,W"). auth() returns the value for --jobserver-auth.
+ *
+ * Tokens are acquired asynchronously from within the event loop of the calling thread.
+ */
+class JobTokenPool : public QObject
+{
+    Q_OBJECT
+public:
+    explicit JobTokenPool(QObject *parent = 0);
+    ~JobTokenPool();
+
+    bool create(int numberOfTokens);
+    bool open(const QString &auth);
+    QString auth() const { return m_auth; }
+
+    void asyncAcquire(int maxNumberOfTokens);
+    bool isAcquiring() const { return m_maxNumberOfTokens > 0; }
+    bool release();
+
+    QString errorString() const { return m_errorString; }
+
+signals:
+    /**
+     * Emitted after asyncAcquire() with 1 to maxNumberOfTokens tokens.
+     */
+    void acquired(int numberOfTokens);
+
+    /**
+     * Emitted after asyncAcquire() if no token can be acquired. See errorString().
+     */
+    void acquisitionFailed();
+
+private slots:
+    void onTokenAvailable();
+
+private:
+    Q_DISABLE_COPY(JobTokenPool)
+    void setError(const QString &errorMessage) { m_errorString = errorMessage; }
+
+    JobTokenPoolPrivate *d;
+    QString m_auth;
+    QString m_errorString;
+    int m_maxNumberOfTokens;
+};
+
+} // namespace NMakeFile
+
+#endif // JOBTOKENPOOL_H
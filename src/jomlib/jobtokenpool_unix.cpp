@@ -0,0 +1,289 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "jobtokenpool.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QSocketNotifier>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace NMakeFile {
+
+class JobTokenPoolPrivate
+{
+public:
+    JobTokenPoolPrivate()
+        : readFd(-1)
+        , writeFd(-1)
+        , ownsReadFd(false)
+        , ownsWriteFd(false)
+        , originalReadFlags(-1)
+        , notifier(0)
+    {
+    }
+
+    int readFd;
+    int writeFd;
+    bool ownsReadFd;
+    bool ownsWriteFd;
+    int originalReadFlags;      // set if we made an inherited descriptor non-blocking
+    QByteArray fifoPath;        // set if we created the fifo
+    QSocketNotifier *notifier;
+    QByteArray acquiredTokens;
+};
+
+JobTokenPool::JobTokenPool(QObject *parent)
+    : QObject(parent)
+    , d(new JobTokenPoolPrivate)
+    , m_maxNumberOfTokens(0)
+{
+}
+
+JobTokenPool::~JobTokenPool()
+{
+    delete d->notifier;
+    if (d->originalReadFlags != -1)
+        ::fcntl(d->readFd, F_SETFL, d->originalReadFlags);
+    if (d->ownsReadFd)
+        ::close(d->readFd);
+    if (d->ownsWriteFd && d->writeFd != d->readFd)
+        ::close(d->writeFd);
+    if (!d->fifoPath.isEmpty())
+        ::unlink(d->fifoPath.constData());
+    delete d;
+}
+
+static bool writeTokens(int fd, const char *tokens, int count)
+{
+    while (count > 0) {
+        const ssize_t n = ::write(fd, tokens, count);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                pollfd pfd = { fd, POLLOUT, 0 };
+                ::poll(&pfd, 1, -1);
+                continue;
+            }
+            return false;
+        }
+        tokens += n;
+        count -= int(n);
+    }
+    return true;
+}
+
+/**
+ * Writes as many tokens into the non-blocking descriptor as fit without waiting.
+ * Returns the number of tokens written or -1 on error.
+ */
+static int writeTokensNonBlocking(int fd, const char *tokens, int count)
+{
+    int written = 0;
+    while (written < count) {
+        const ssize_t n = ::write(fd, tokens + written, count - written);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            return -1;
+        }
+        written += int(n);
+    }
+    return written;
+}
+
+bool JobTokenPool::create(int numberOfTokens)
+{
+    static int counter = 0;
+    const QString fileName = QDir::tempPath() + QLatin1String("/jomfifo-")
+            + QString::number(QCoreApplication::applicationPid()) + QLatin1Char('-')
+            + QString::number(QDateTime::currentMSecsSinceEpoch()) + QLatin1Char('-')
+            + QString::number(++counter);
+    const QByteArray path = QFile::encodeName(fileName);
+    if (::mkfifo(path.constData(), 0600) != 0) {
+        setError(qt_error_string(errno));
+        return false;
+    }
+    d->fifoPath = path;
+
+    // Opening the fifo for reading and writing doesn't block and keeps it alive.
+    const int fd = ::open(path.constData(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        setError(qt_error_string(errno));
+        return false;
+    }
+    d->readFd = d->writeFd = fd;
+    d->ownsReadFd = d->ownsWriteFd = true;
+
+    // Nobody reads from the fifo yet. Waiting for space in it would block forever.
+    // Therefore the number of tokens is limited by the capacity of the pipe.
+    const QByteArray tokens(numberOfTokens, '+');
+    const int written = writeTokensNonBlocking(fd, tokens.constData(), tokens.count());
+    if (written < 0) {
+        setError(qt_error_string(errno));
+        return false;
+    }
+    if (written < numberOfTokens) {
+        // The process that creates the job server owns one implicit job token.
+        fprintf(stderr, "jom: The job server is limited to %d jobs.\n", written + 1);
+        fflush(stderr);
+    }
+
+    m_auth = QLatin1String("fifo:") + fileName;
+    return true;
+}
+
+bool JobTokenPool::open(const QString &auth)
+{
+    if (auth.startsWith(QLatin1String("fifo:"))) {
+        // Our own open file description. Setting O_NONBLOCK doesn't affect other processes.
+        const QByteArray path = QFile::encodeName(auth.mid(5));
+        const int fd = ::open(path.constData(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+            setError(qt_error_string(errno));
+            return false;
+        }
+        d->readFd = d->writeFd = fd;
+        d->ownsReadFd = d->ownsWriteFd = true;
+    } else {
+        // The descriptors are inherited from the make process that started us.
+        // They must stay open and inheritable for our own children.
+        const int idx = auth.indexOf(QLatin1Char(','));
+        bool ok1 = false, ok2 = false;
+        if (idx > 0) {
+            d->readFd = auth.left(idx).toInt(&ok1);
+            d->writeFd = auth.mid(idx + 1).toInt(&ok2);
+        }
+        if (!ok1 || !ok2) {
+            setError(QLatin1String("Invalid job server: ") + auth);
+            return false;
+        }
+        if (::fcntl(d->readFd, F_GETFD) == -1 || ::fcntl(d->writeFd, F_GETFD) == -1) {
+            setError(QLatin1String("The job server's file descriptors are not open."));
+            return false;
+        }
+
+        // Another process may take the token between our notification and the read.
+        // A blocking read would then stall the event loop. Where possible, reopen the pipe
+        // to get a non-blocking file description of our own. Otherwise, the shared file
+        // description is made non-blocking until we're done.
+        const QByteArray procPath = "/proc/self/fd/" + QByteArray::number(d->readFd);
+        const int fd = ::open(procPath.constData(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd >= 0) {
+            d->readFd = fd;
+            d->ownsReadFd = true;
+        } else {
+            const int flags = ::fcntl(d->readFd, F_GETFL);
+            if (flags == -1 || ::fcntl(d->readFd, F_SETFL, flags | O_NONBLOCK) == -1) {
+                setError(qt_error_string(errno));
+                return false;
+            }
+            if (!(flags & O_NONBLOCK))
+                d->originalReadFlags = flags;
+        }
+    }
+
+    m_auth = auth;
+    return true;
+}
+
+/**
+ * Starts acquiring up to maxNumberOfTokens tokens. Emits acquired() as soon as the
+ * job server has at least one token for us.
+ */
+void JobTokenPool::asyncAcquire(int maxNumberOfTokens)
+{
+    Q_ASSERT(!isAcquiring());
+    Q_ASSERT(maxNumberOfTokens > 0);
+
+    m_maxNumberOfTokens = maxNumberOfTokens;
+    if (!d->notifier) {
+        d->notifier = new QSocketNotifier(d->readFd, QSocketNotifier::Read, this);
+        connect(d->notifier, SIGNAL(activated(int)), this, SLOT(onTokenAvailable()));
+    }
+    d->notifier->setEnabled(true);
+}
+
+void JobTokenPool::onTokenAvailable()
+{
+    if (!isAcquiring()) {
+        d->notifier->setEnabled(false);
+        return;
+    }
+
+    QByteArray tokens(m_maxNumberOfTokens, Qt::Uninitialized);
+    ssize_t n;
+    do {
+        n = ::read(d->readFd, tokens.data(), tokens.size());
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0 && errno == EAGAIN)
+        return;     // Another process was faster.
+    if (n <= 0) {
+        d->notifier->setEnabled(false);
+        m_maxNumberOfTokens = 0;
+        if (n == 0)
+            setError(QLatin1String("The job server has been closed."));
+        else
+            setError(qt_error_string(errno));
+        emit acquisitionFailed();
+        return;
+    }
+
+    d->notifier->setEnabled(false);
+    m_maxNumberOfTokens = 0;
+    d->acquiredTokens.append(tokens.constData(), int(n));
+    emit acquired(int(n));
+}
+
+/**
+ * Gives back a token. GNU make expects to get back the same characters it handed out.
+ */
+bool JobTokenPool::release()
+{
+    char token = '+';
+    if (!d->acquiredTokens.isEmpty()) {
+        token = d->acquiredTokens.at(d->acquiredTokens.count() - 1);
+        d->acquiredTokens.chop(1);
+    }
+    if (!writeTokens(d->writeFd, &token, 1)) {
+        setError(qt_error_string(errno));
+        return false;
+    }
+    return true;
+}
+
+} // namespace NMakeFile
@@ -0,0 +1,166 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "jobtokenpool.h"
+#include "filetime.h"
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+
+#include <windows.h>
+
+namespace NMakeFile {
+
+class JobTokenPoolPrivate
+{
+public:
+    JobTokenPoolPrivate(JobTokenPool *pool)
+        : q(pool)
+        , semaphore(NULL)
+        , waitHandle(NULL)
+    {
+    }
+
+    void unregisterWait()
+    {
+        if (!waitHandle)
+            return;
+        // Waits until a running callback has returned.
+        UnregisterWaitEx(waitHandle, INVALID_HANDLE_VALUE);
+        waitHandle = NULL;
+    }
+
+    JobTokenPool *q;
+    HANDLE semaphore;
+    HANDLE waitHandle;
+    QAtomicInt tokenPending;    // set if the wait callback took a token from the semaphore
+};
+
+/**
+ * Runs in a thread of the Windows thread pool. The satisfied wait has
+ * decremented the semaphore, i.e. we own one token now.
+ */
+static void CALLBACK onSemaphoreSignaled(void *context, BOOLEAN timedOut)
+{
+    Q_UNUSED(timedOut);
+    JobTokenPoolPrivate *d = static_cast<JobTokenPoolPrivate *>(context);
+    d->tokenPending.storeRelease(1);
+    QMetaObject::invokeMethod(d->q, "onTokenAvailable", Qt::QueuedConnection);
+}
+
+JobTokenPool::JobTokenPool(QObject *parent)
+    : QObject(parent)
+    , d(new JobTokenPoolPrivate(this))
+    , m_maxNumberOfTokens(0)
+{
+}
+
+JobTokenPool::~JobTokenPool()
+{
+    d->unregisterWait();
+    if (d->tokenPending.fetchAndStoreOrdered(0))
+        ReleaseSemaphore(d->semaphore, 1, NULL);
+    if (d->semaphore)
+        CloseHandle(d->semaphore);
+    delete d;
+}
+
+bool JobTokenPool::create(int numberOfTokens)
+{
+    const quint64 randomId = (FileTime::currentTime().internalRepresentation() % UINT_MAX)
+        ^ reinterpret_cast<quint64>(&numberOfTokens);
+    const QString name = QLatin1String("jom_semaphore_")
+            + QString::number(QCoreApplication::applicationPid()) + QLatin1Char('_')
+            + QString::number(randomId);
+    d->semaphore = CreateSemaphoreW(NULL, numberOfTokens, qMax(1, numberOfTokens),
+                                    reinterpret_cast<const wchar_t *>(name.utf16()));
+    if (!d->semaphore) {
+        setError(qt_error_string(GetLastError()));
+        return false;
+    }
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        setError(QLatin1String("Semaphore ") + name + QLatin1String(" already exists."));
+        return false;
+    }
+    m_auth = name;
+    return true;
+}
+
+bool JobTokenPool::open(const QString &auth)
+{
+    d->semaphore = OpenSemaphoreW(SEMAPHORE_MODIFY_STATE | SYNCHRONIZE, FALSE,
+                                  reinterpret_cast<const wchar_t *>(auth.utf16()));
+    if (!d->semaphore) {
+        setError(qt_error_string(GetLastError()));
+        return false;
+    }
+    m_auth = auth;
+    return true;
+}
+
+/**
+ * Starts acquiring up to maxNumberOfTokens tokens. Emits acquired() as soon as the
+ * job server has at least one token for us.
+ */
+void JobTokenPool::asyncAcquire(int maxNumberOfTokens)
+{
+    Q_ASSERT(!isAcquiring());
+    Q_ASSERT(maxNumberOfTokens > 0);
+
+    m_maxNumberOfTokens = maxNumberOfTokens;
+
+    // The wait is registered for one shot only. It must not take more tokens than we asked for.
+    if (!RegisterWaitForSingleObject(&d->waitHandle, d->semaphore, onSemaphoreSignaled, d,
+                                     INFINITE, WT_EXECUTEONLYONCE)) {
+        d->waitHandle = NULL;
+        m_maxNumberOfTokens = 0;
+        setError(qt_error_string(GetLastError()));
+        emit acquisitionFailed();
+    }
+}
+
+void JobTokenPool::onTokenAvailable()
+{
+    if (!d->tokenPending.fetchAndStoreOrdered(0))
+        return;
+    d->unregisterWait();
+
+    int n = 1;
+    while (n < m_maxNumberOfTokens && WaitForSingleObject(d->semaphore, 0) == WAIT_OBJECT_0)
+        ++n;
+    m_maxNumberOfTokens = 0;
+    emit acquired(n);
+}
+
+bool JobTokenPool::release()
+{
+    if (!ReleaseSemaphore(d->semaphore, 1, NULL)) {
+        setError(qt_error_string(GetLastError()));
+        return false;
+    }
+    return true;
+}
+
+} // namespace NMakeFile
@@ -54,11 +54,18 @@ win32-* {
         iocompletionport.h
     SOURCES += \
         jomprocess.cpp \
-        iocompletionport.cpp
+        jobtokenpool_win.cpp \
+        iocompletionport.cpp \
+        buildserver_win.cpp
+} else:linux {
+    SOURCES += \
+        jomprocess_linux.cpp \
+        jobtokenpool_unix.cpp
 } else {
     DEFINES += USE_QPROCESS
     SOURCES += \
-        jomprocess_qt.cpp
+        jomprocess_qt.cpp \
+        jobtokenpool_unix.cpp
 }
 
 HEADERS +=  \
@@ -66,22 +73,30 @@ HEADERS +=  \
     filetime.h \
     helperfunctions.h \
     jobserver.h \
+    jobtokenpool.h \
     makefile.h \
+    makefilecache.h \
     makefilefactory.h \
     makefilelinereader.h \
     macrotable.h \
     exception.h \
     dependencygraph.h \
+    depslog.h \
     options.h \
     parser.h \
+    pathtable.h \
     preprocessor.h \
     ppexprparser.h \
     targetexecutor.h \
+    shellworker.h \
     commandexecutor.h \
+    builtincommands.h \
+    buildhistory.h \
+    contenthashes.h \
+    buildserver.h \
     jomprocess.h \
     processenvironment.h \
-    jobclient.h \
-    jobclientacquirehelper.h
+    jobclient.h
 
 SOURCES += \
     fastfileinfo.cpp \
@@ -90,19 +105,25 @@ SOURCES += \
     jobserver.cpp \
     macrotable.cpp \
     makefile.cpp \
+    makefilecache.cpp \
     makefilefactory.cpp \
     makefilelinereader.cpp \
     exception.cpp \
     dependencygraph.cpp \
+    depslog.cpp \
     options.cpp \
     parser.cpp \
+    pathtable.cpp \
     preprocessor.cpp \
     ppexpr_grammar.cpp \
     ppexprparser.cpp \
     targetexecutor.cpp \
+    shellworker.cpp \
     commandexecutor.cpp \
-    jobclient.cpp \
-    jobclientacquirehelper.cpp
+    builtincommands.cpp \
+    buildhistory.cpp \
+    contenthashes.cpp \
+    jobclient.cpp
 
 OTHER_FILES += \
     ppexpr.g \
@@ -62,6 +62,7 @@ public:
     void start(const QString &commandLine);
     void writeToStdOutBuffer(const QByteArray &output);
     void writeToStdErrBuffer(const QByteArray &output);
+    void printBufferedOutput() {}
     ExitStatus exitStatus() const;
 
 signals:
@@ -110,6 +111,7 @@ public:
     bool isBufferedOutputSet() const { return m_bufferedOutput; }
     void writeToStdOutBuffer(const QByteArray &output);
     void writeToStdErrBuffer(const QByteArray &output);
+    void printBufferedOutput();
     void setWorkingDirectory(const QString &path);
     const QString &workingDirectory() const { return m_workingDirectory; }
     void setEnvironment(const ProcessEnvironment &environment);
@@ -126,9 +128,6 @@ public slots:
     void start(const QString &commandLine);
     bool waitForFinished();
 
-private:
-    void printBufferedOutput();
-
 private slots:
     void tryToRetrieveExitCode();
     void onProcessFinished();
@@ -0,0 +1,682 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "jomprocess.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QEventLoop>
+#include <QFile>
+#include <QList>
+#include <QMetaType>
+#include <QSet>
+#include <QSocketNotifier>
+#include <QVector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define JOM_HAVE_SPAWN_ADDCHDIR
+#endif
+
+namespace NMakeFile {
+
+Q_GLOBAL_STATIC(QElapsedTimer, runtime)
+
+static void safelyCloseFd(int &fd)
+{
+    if (fd != -1) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+static int openPidFd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return static_cast<int>(::syscall(SYS_pidfd_open, pid, 0));
+#else
+    Q_UNUSED(pid);
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+struct TimeStampedBuffer
+{
+    TimeStampedBuffer(const qint64 t, const QByteArray &b)
+        : timestamp(t), buffer(b)
+    {
+    }
+
+    qint64 timestamp;
+    QByteArray buffer;
+};
+
+class EpollObserver
+{
+public:
+    virtual void epollNotified(quint32 events) = 0;
+};
+
+class ProcessPrivate;
+
+/**
+ * Multiplexes the output pipes and the process descriptors of all running
+ * processes on one epoll instance. The epoll descriptor itself is watched by
+ * a single socket notifier in the main thread.
+ * On kernels without pidfd_open the termination of child processes is
+ * signalled through a SIGCHLD self-pipe that is registered on the same
+ * epoll instance.
+ */
+class ProcessEventPoller : public EpollObserver
+{
+public:
+    static ProcessEventPoller *instance();
+
+    void registerObserver(EpollObserver *observer, int fd);
+    void unregisterObserver(EpollObserver *observer, int fd);
+    void watchForTermination(ProcessPrivate *process);
+    void unwatchForTermination(ProcessPrivate *process);
+
+    void epollNotified(quint32 events);
+
+private:
+    class Notifier : public QSocketNotifier
+    {
+    public:
+        Notifier(ProcessEventPoller *poller, int fd)
+            : QSocketNotifier(fd, QSocketNotifier::Read), m_poller(poller)
+        {
+        }
+
+    protected:
+        bool event(QEvent *e)
+        {
+            if (e->type() == QEvent::SockAct) {
+                m_poller->dispatchEvents();
+                return true;
+            }
+            return QSocketNotifier::event(e);
+        }
+
+    private:
+        ProcessEventPoller *m_poller;
+    };
+
+    ProcessEventPoller();
+    void dispatchEvents();
+    static void sigchldHandler(int);
+
+    int m_epollFd;
+    Notifier *m_notifier;
+    QSet<EpollObserver *> m_observers;
+    QList<ProcessPrivate *> m_sigchldWatchedProcesses;
+    static int m_sigchldPipe[2];
+};
+
+int ProcessEventPoller::m_sigchldPipe[2] = { -1, -1 };
+
+class OutputChannel : public EpollObserver
+{
+public:
+    OutputChannel()
+        : d(0), fd(-1), stream(0)
+    {
+    }
+
+    void epollNotified(quint32 events);
+    bool readAvailableData();
+    void close();
+
+    ProcessPrivate *d;
+    int fd;
+    FILE *stream;
+    QList<TimeStampedBuffer> buffers;
+};
+
+class ProcessPrivate : public EpollObserver
+{
+public:
+    ProcessPrivate(Process *process)
+        : q(process),
+          pid(-1),
+          pidFd(-1),
+          exited(false),
+          exitStatus(0)
+    {
+        stdoutChannel.d = this;
+        stdoutChannel.stream = stdout;
+        stderrChannel.d = this;
+        stderrChannel.stream = stderr;
+    }
+
+    void epollNotified(quint32 events);
+    bool reap();
+    void finishIfDone();
+
+    Process *q;
+    pid_t pid;
+    int pidFd;
+    bool exited;
+    int exitStatus;
+    OutputChannel stdoutChannel;
+    OutputChannel stderrChannel;
+};
+
+ProcessEventPoller::ProcessEventPoller()
+    : m_epollFd(::epoll_create1(EPOLL_CLOEXEC)),
+      m_notifier(0)
+{
+    if (m_epollFd == -1) {
+        qErrnoWarning("Process: epoll_create1 failed.");
+        return;
+    }
+    m_notifier = new Notifier(this, m_epollFd);
+}
+
+ProcessEventPoller *ProcessEventPoller::instance()
+{
+    static ProcessEventPoller *poller = new ProcessEventPoller;
+    return poller;
+}
+
+void ProcessEventPoller::registerObserver(EpollObserver *observer, int fd)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = observer;
+    if (::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        qErrnoWarning("Process: can't register file descriptor with epoll.");
+        return;
+    }
+    m_observers.insert(observer);
+}
+
+void ProcessEventPoller::unregisterObserver(EpollObserver *observer, int fd)
+{
+    ::epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, 0);
+    m_observers.remove(observer);
+}
+
+void ProcessEventPoller::sigchldHandler(int)
+{
+    const int savedErrno = errno;
+    const char c = 0;
+    ssize_t result = ::write(m_sigchldPipe[1], &c, 1);
+    Q_UNUSED(result);
+    errno = savedErrno;
+}
+
+void ProcessEventPoller::watchForTermination(ProcessPrivate *process)
+{
+    process->pidFd = openPidFd(process->pid);
+    if (process->pidFd != -1) {
+        registerObserver(process, process->pidFd);
+        return;
+    }
+
+    if (m_sigchldPipe[0] == -1) {
+        if (::pipe2(m_sigchldPipe, O_CLOEXEC | O_NONBLOCK) == -1)
+            qFatal("Cannot setup pipe for SIGCHLD notifications.");
+        registerObserver(this, m_sigchldPipe[0]);
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = &ProcessEventPoller::sigchldHandler;
+        action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+        sigemptyset(&action.sa_mask);
+        ::sigaction(SIGCHLD, &action, 0);
+
+        // The child might have died before the handler was installed.
+        sigchldHandler(SIGCHLD);
+    }
+    m_sigchldWatchedProcesses.append(process);
+}
+
+void ProcessEventPoller::unwatchForTermination(ProcessPrivate *process)
+{
+    if (process->pidFd != -1) {
+        unregisterObserver(process, process->pidFd);
+        safelyCloseFd(process->pidFd);
+    }
+    m_sigchldWatchedProcesses.removeOne(process);
+}
+
+/**
+ * Is called for the SIGCHLD self-pipe.
+ */
+void ProcessEventPoller::epollNotified(quint32 events)
+{
+    Q_UNUSED(events);
+    char buf[256];
+    while (::read(m_sigchldPipe[0], buf, sizeof(buf)) > 0)
+        ;
+
+    const QList<ProcessPrivate *> processes = m_sigchldWatchedProcesses;
+    foreach (ProcessPrivate *process, processes) {
+        if (process->reap())
+            process->finishIfDone();
+    }
+}
+
+void ProcessEventPoller::dispatchEvents()
+{
+    const int maxEvents = 64;
+    struct epoll_event events[maxEvents];
+    for (;;) {
+        int n = ::epoll_wait(m_epollFd, events, maxEvents, 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        for (int i = 0; i < n; ++i) {
+            // Observers can vanish while we're dispatching the events of this batch.
+            EpollObserver *observer = static_cast<EpollObserver *>(events[i].data.ptr);
+            if (m_observers.contains(observer))
+                observer->epollNotified(events[i].events);
+        }
+        if (n < maxEvents)
+            return;
+    }
+}
+
+Process::Process(QObject *parent)
+    : QObject(parent),
+      d(new ProcessPrivate(this)),
+      m_state(NotRunning),
+      m_exitCode(0),
+      m_exitStatus(NormalExit),
+      m_bufferedOutput(true)
+{
+    static bool staticsInitialized = false;
+    if (!staticsInitialized) {
+        staticsInitialized = true;
+        qRegisterMetaType<ExitStatus>("Process::ExitStatus");
+        qRegisterMetaType<ProcessError>("Process::ProcessError");
+        qRegisterMetaType<ProcessState>("Process::ProcessState");
+        runtime()->start();
+    }
+}
+
+Process::~Process()
+{
+    if (m_state == Running) {
+        qWarning("Process: destroyed while process still running.");
+        ProcessEventPoller::instance()->unwatchForTermination(d);
+    }
+    d->stdoutChannel.close();
+    d->stderrChannel.close();
+    printBufferedOutput();
+    delete d;
+}
+
+void Process::setBufferedOutput(bool b)
+{
+    if (m_bufferedOutput == b)
+        return;
+
+    m_bufferedOutput = b;
+    if (!m_bufferedOutput)
+        printBufferedOutput();
+}
+
+void Process::writeToStdOutBuffer(const QByteArray &output)
+{
+    d->stdoutChannel.buffers.append(TimeStampedBuffer(runtime()->elapsed(), output));
+}
+
+void Process::writeToStdErrBuffer(const QByteArray &output)
+{
+    d->stderrChannel.buffers.append(TimeStampedBuffer(runtime()->elapsed(), output));
+}
+
+void Process::setWorkingDirectory(const QString &path)
+{
+    m_workingDirectory = path;
+}
+
+static QByteArray createEnvBlock(const ProcessEnvironment &environment)
+{
+    QByteArray envlist;
+    ProcessEnvironment::const_iterator it = environment.constBegin();
+    const ProcessEnvironment::const_iterator end = environment.constEnd();
+    for (; it != end; ++it) {
+        const QString &keystr = it.key().toQString();
+        if (keystr.isEmpty())
+            continue;
+        envlist += keystr.toLocal8Bit();
+        envlist += '=';
+        envlist += it.value().toLocal8Bit();
+        envlist += '\0';
+    }
+    return envlist;
+}
+
+void Process::setEnvironment(const ProcessEnvironment &environment)
+{
+    m_environment = environment;
+    m_envBlock = createEnvBlock(environment);
+}
+
+static bool setupPipe(int fds[2])
+{
+    if (::pipe2(fds, O_CLOEXEC) == -1) {
+        qErrnoWarning("Process: pipe2 failed.");
+        return false;
+    }
+
+    // Only our end is non-blocking. The child gets a normal blocking pipe.
+    ::fcntl(fds[0], F_SETFL, ::fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+/**
+ * Splits a command line that doesn't use any shell syntax into its words.
+ * Returns false, if the command line must be interpreted by the shell.
+ */
+static bool splitSimpleCommandLine(const QByteArray &commandLine, QList<QByteArray> *arguments)
+{
+    static const char shellCharacters[] = "|&;<>()$`\\\"'*?[]#~={}!\n";
+    for (int i = 0; i < commandLine.count(); ++i)
+        if (strchr(shellCharacters, commandLine.at(i)))
+            return false;
+    const QByteArray simplifiedCommandLine = commandLine.simplified();
+    if (simplifiedCommandLine.isEmpty())
+        return false;
+    *arguments = simplifiedCommandLine.split(' ');
+    return true;
+}
+
+static int spawn(pid_t *pid, QList<QByteArray> arguments, const QByteArray &workingDirectory,
+                 posix_spawn_file_actions_t *fileActions, char **envp)
+{
+#ifdef JOM_HAVE_SPAWN_ADDCHDIR
+    Q_UNUSED(workingDirectory);
+#else
+    if (!workingDirectory.isEmpty()) {
+        // Without posix_spawn_file_actions_addchdir_np, a shell changes the directory of
+        // the child and replaces itself with the command.
+        arguments = QList<QByteArray>()
+                << "/bin/sh" << "-c" << "cd -- \"$0\" || exit 127; exec \"$@\""
+                << workingDirectory << arguments;
+    }
+#endif
+
+    QVector<char *> argv;
+    for (int i = 0; i < arguments.count(); ++i)
+        argv.append(arguments[i].data());
+    argv.append(0);
+    return ::posix_spawnp(pid, argv.first(), fileActions, 0, argv.data(), envp);
+}
+
+void Process::start(const QString &commandLine)
+{
+    m_state = Starting;
+
+    int stdoutPipe[2];
+    int stderrPipe[2];
+    if (!setupPipe(stdoutPipe))
+        qFatal("Cannot setup pipe for stdout.");
+    if (!setupPipe(stderrPipe))
+        qFatal("Cannot setup pipe for stderr.");
+
+    QVector<char *> envp;
+    if (!m_envBlock.isEmpty()) {
+        char *p = m_envBlock.data();
+        char *const end = p + m_envBlock.size();
+        while (p < end) {
+            envp.append(p);
+            p += qstrlen(p) + 1;
+        }
+        envp.append(0);
+    }
+
+    posix_spawn_file_actions_t fileActions;
+    posix_spawn_file_actions_init(&fileActions);
+    // We don't use stdin but some processes demand it.
+    posix_spawn_file_actions_addopen(&fileActions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&fileActions, stdoutPipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&fileActions, stderrPipe[1], STDERR_FILENO);
+
+    // The working directory of this process is shared by all jobs. Only the child changes it.
+    const QByteArray workingDirectory = QFile::encodeName(m_workingDirectory);
+#ifdef JOM_HAVE_SPAWN_ADDCHDIR
+    if (!workingDirectory.isEmpty())
+        posix_spawn_file_actions_addchdir_np(&fileActions, workingDirectory.constData());
+#endif
+
+    // Simple commands are started directly. Everything else is run by the POSIX shell.
+    // The shell also reports simple commands that can't be found, like other make tools do.
+    const QByteArray localCommandLine = commandLine.toLocal8Bit();
+    char **const environment = envp.isEmpty() ? environ : envp.data();
+    QList<QByteArray> arguments;
+    pid_t pid = -1;
+    int spawnError = ENOENT;
+    if (splitSimpleCommandLine(localCommandLine, &arguments))
+        spawnError = spawn(&pid, arguments, workingDirectory, &fileActions, environment);
+    if (spawnError != 0) {
+        arguments = QList<QByteArray>() << "/bin/sh" << "-c" << localCommandLine;
+        spawnError = spawn(&pid, arguments, workingDirectory, &fileActions, environment);
+    }
+    posix_spawn_file_actions_destroy(&fileActions);
+
+    // Close the write ends. This process doesn't need them anymore.
+    safelyCloseFd(stdoutPipe[1]);
+    safelyCloseFd(stderrPipe[1]);
+
+    if (spawnError != 0) {
+        safelyCloseFd(stdoutPipe[0]);
+        safelyCloseFd(stderrPipe[0]);
+        m_state = NotRunning;
+        emit error(FailedToStart);
+        return;
+    }
+
+    d->pid = pid;
+    d->exited = false;
+    d->stdoutChannel.fd = stdoutPipe[0];
+    d->stderrChannel.fd = stderrPipe[0];
+    ProcessEventPoller *poller = ProcessEventPoller::instance();
+    poller->registerObserver(&d->stdoutChannel, d->stdoutChannel.fd);
+    poller->registerObserver(&d->stderrChannel, d->stderrChannel.fd);
+    m_state = Running;
+    poller->watchForTermination(d);
+}
+
+/**
+ * Collects the exit status of the child process without blocking.
+ * Returns true, if the process has terminated.
+ */
+bool ProcessPrivate::reap()
+{
+    if (exited)
+        return true;
+
+    int status;
+    pid_t result;
+    do {
+        result = ::waitpid(pid, &status, WNOHANG);
+    } while (result == -1 && errno == EINTR);
+
+    if (result != pid)
+        return false;
+
+    exited = true;
+    exitStatus = status;
+    ProcessEventPoller::instance()->unwatchForTermination(this);
+    return true;
+}
+
+/**
+ * Is called when the pidfd of the child becomes readable.
+ */
+void ProcessPrivate::epollNotified(quint32 events)
+{
+    Q_UNUSED(events);
+    if (reap())
+        finishIfDone();
+}
+
+void ProcessPrivate::finishIfDone()
+{
+    if (!exited || q->m_state != Process::Running)
+        return;
+
+    // Drain what the child has written before it died.
+    // Processes that inherited the pipes may keep them open; we don't wait for them.
+    stdoutChannel.readAvailableData();
+    stderrChannel.readAvailableData();
+    q->tryToRetrieveExitCode();
+}
+
+bool OutputChannel::readAvailableData()
+{
+    if (fd == -1)
+        return false;
+
+    char buf[65536];
+    for (;;) {
+        const ssize_t numberOfBytes = ::read(fd, buf, sizeof(buf));
+        if (numberOfBytes > 0) {
+            if (d->q->isBufferedOutputSet()) {
+                buffers.append(TimeStampedBuffer(runtime()->elapsed(),
+                                                 QByteArray(buf, numberOfBytes)));
+            } else {
+                fwrite(buf, sizeof(char), numberOfBytes, stream);
+                fflush(stream);
+            }
+            continue;
+        }
+        if (numberOfBytes == -1 && errno == EINTR)
+            continue;
+        if (numberOfBytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+
+        // End of file or error.
+        close();
+        return false;
+    }
+}
+
+void OutputChannel::close()
+{
+    if (fd == -1)
+        return;
+    ProcessEventPoller::instance()->unregisterObserver(this, fd);
+    safelyCloseFd(fd);
+}
+
+/**
+ * Is called whenever the pipe is readable or the writing side was closed.
+ */
+void OutputChannel::epollNotified(quint32 events)
+{
+    Q_UNUSED(events);
+    readAvailableData();
+}
+
+void Process::tryToRetrieveExitCode()
+{
+    if (!d->exited && !d->reap())
+        return;
+    onProcessFinished();
+}
+
+void Process::onProcessFinished()
+{
+    if (m_state != Running)
+        return;
+
+    d->stdoutChannel.close();
+    d->stderrChannel.close();
+    printBufferedOutput();
+    m_state = NotRunning;
+
+    ExitStatus exitStatus = NormalExit;
+    if (WIFSIGNALED(d->exitStatus)) {
+        exitStatus = CrashExit;
+        m_exitCode = 128 + WTERMSIG(d->exitStatus);
+    } else {
+        m_exitCode = WEXITSTATUS(d->exitStatus);
+    }
+    m_exitStatus = exitStatus;
+    d->pid = -1;
+    emit finished(m_exitCode, exitStatus);
+}
+
+bool Process::waitForFinished()
+{
+    if (m_state != Running)
+        return true;
+
+    QEventLoop eventLoop;
+    connect(this, SIGNAL(finished(int, Process::ExitStatus)), &eventLoop, SLOT(quit()));
+    eventLoop.exec();
+
+    m_state = NotRunning;
+    return true;
+}
+
+void Process::printBufferedOutput()
+{
+    while (!d->stdoutChannel.buffers.isEmpty()
+        || !d->stderrChannel.buffers.isEmpty())
+    {
+        OutputChannel *channels[2] = { &d->stdoutChannel, &d->stderrChannel };
+
+        size_t i = 0;
+        if (channels[0]->buffers.isEmpty()
+            || (!channels[1]->buffers.isEmpty()
+                && channels[0]->buffers.first().timestamp > channels[1]->buffers.first().timestamp))
+        {
+            i = 1;
+        }
+
+        OutputChannel *const channel = channels[i];
+        const QByteArray &ba = channel->buffers.first().buffer;
+        fwrite(ba.data(), sizeof(char), ba.count(), channel->stream);
+        fflush(channel->stream);
+        channel->buffers.removeFirst();
+    }
+}
+
+} // namespace NMakeFile
+
+QT_BEGIN_NAMESPACE
+Q_DECLARE_TYPEINFO(NMakeFile::TimeStampedBuffer, Q_MOVABLE_TYPE);
+QT_END_NAMESPACE
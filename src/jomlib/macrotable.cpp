@@ -36,6 +36,7 @@ namespace NMakeFile {
 const QChar MacroTable::fileNameMacroMagicEscape = QChar::ByteOrderMark;
 
 MacroTable::MacroTable()
+    : m_generation(0)
 {
 }
 
@@ -194,14 +195,22 @@ MacroTable::MacroData* MacroTable::internalSetMacroValue(const QString &name, co
     if (!isMacroNameValid(expandedName))
         return 0;
 
-    MacroData* result = 0;
-    const QString instantiatedName = QLatin1Literal("$(") + expandedName + QLatin1Literal(")");
-    QString newValue = value;
-    replaceStringWithLazyValue(newValue, instantiatedName, MacroValueOp(this, expandedName));
+    MacroData* result = &m_macros[expandedName];
+    if (!ignoreReadOnly && result->isReadOnly)
+        return result;
 
-    result = &m_macros[expandedName];
-    if (ignoreReadOnly || !result->isReadOnly)
+    const QString instantiatedName = QLatin1Literal("$(") + expandedName + QLatin1Literal(")");
+    if (value.startsWith(instantiatedName)
+            && value.indexOf(instantiatedName, instantiatedName.length()) < 0) {
+        // The common case OBJECTS = $(OBJECTS) foo.obj appends to the old value in place.
+        // Copying the old value here would make building long lists quadratic.
+        result->value.append(value.midRef(instantiatedName.length()));
+    } else {
+        QString newValue = value;
+        replaceStringWithLazyValue(newValue, instantiatedName, MacroValueOp(this, expandedName));
         result->value = newValue;
+    }
+    invalidateExpansions();
 
     return result;
 }
@@ -214,6 +223,7 @@ bool MacroTable::isMacroDefined(const QString& name) const
 void MacroTable::undefineMacro(const QString& name)
 {
     m_macros.remove(name);
+    invalidateExpansions();
 }
 
 QString MacroTable::expandMacros(const QString& str, bool inDependentsLine) const
@@ -279,13 +289,11 @@ QString MacroTable::expandMacros(const QString& str, bool inDependentsLine, QSet
                     break;
                 default:
                     {
-                        QString macroValue = cycleCheckedMacroValue(macroName, usedMacros);
-                        macroValue = expandMacros(macroValue, inDependentsLine, usedMacros);
+                        QString macroValue = expandedMacroValue(macroName, inDependentsLine, usedMacros);
                         if (macroNameEnd != macroInvokationEnd) {
                             const Substitution s = parseSubstitutionStatement(str, macroNameEnd + 1, macroInvokationEnd);
                             applySubstitution(s, macroValue);
                         }
-                        usedMacros.remove(macroName);
                         ret.append(macroValue);
                     }
                 }
@@ -316,10 +324,7 @@ QString MacroTable::expandMacros(const QString& str, bool inDependentsLine, QSet
             } else if (str.at(i).isLetterOrNumber()) {
                 // found single character macro invocation a la $X
                 const QString macroName = str.at(i);
-                QString macroValue = cycleCheckedMacroValue(macroName, usedMacros);
-                macroValue = expandMacros(macroValue, inDependentsLine, usedMacros);
-                usedMacros.remove(macroName);
-                ret.append(macroValue);
+                ret.append(expandedMacroValue(macroName, inDependentsLine, usedMacros));
             } else {
                 switch (str.at(i).toLatin1())
                 {
@@ -364,6 +369,30 @@ QString MacroTable::cycleCheckedMacroValue(const QString& macroName, QSet<QStrin
     return macroValue(macroName);
 }
 
+/**
+ * Returns the value of a macro with all macros in it expanded.
+ * The expansion is remembered until the next macro is (re)defined or undefined.
+ *
+ * A remembered expansion contains no cycle. So it cannot contain any of the usedMacros
+ * either, because the macro would be part of a cycle then.
+ */
+QString MacroTable::expandedMacroValue(const QString& macroName, bool inDependentsLine,
+                                       QSet<QString>& usedMacros) const
+{
+    QHash<QString, MacroExpansion> &expansions = m_expansions[inDependentsLine ? 1 : 0];
+    QHash<QString, MacroExpansion>::const_iterator it = expansions.constFind(macroName);
+    if (it != expansions.constEnd() && it->generation == m_generation)
+        return it->value;
+
+    MacroExpansion expansion;
+    expansion.generation = m_generation;
+    expansion.value = expandMacros(cycleCheckedMacroValue(macroName, usedMacros),
+                                   inDependentsLine, usedMacros);
+    usedMacros.remove(macroName);
+    expansions.insert(macroName, expansion);
+    return expansion.value;
+}
+
 void MacroTable::dump() const
 {
     QHash<QString, MacroData>::const_iterator it = m_macros.begin();
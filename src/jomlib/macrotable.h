@@ -86,6 +86,12 @@ private:
         QString value;
     };
 
+    struct MacroExpansion
+    {
+        uint generation;
+        QString value;
+    };
+
     void setMacroValueImpl(const QString &name, const QString &value, MacroSource source);
     void defineCommandLineMacroValueImpl(const QString &name, const QString &value,
                                          MacroSource source);
@@ -94,9 +100,16 @@ private:
     void setEnvironmentVariable(const QString& name, const QString& value);
     QString expandMacros(const QString& str, bool inDependentsLine, QSet<QString>& usedMacros) const;
     QString cycleCheckedMacroValue(const QString& macroName, QSet<QString>& usedMacros) const;
+    QString expandedMacroValue(const QString& macroName, bool inDependentsLine,
+                               QSet<QString>& usedMacros) const;
+    void invalidateExpansions() { ++m_generation; }
 
     QHash<QString, MacroData>   m_macros;
     ProcessEnvironment          m_environment;
+    uint                        m_generation;
+    mutable QHash<QString, MacroExpansion> m_expansions[2];
+
+    friend class MakefileCache;
 };
 
 } // namespace NMakeFile
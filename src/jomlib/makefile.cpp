@@ -429,10 +429,40 @@ void Makefile::clear()
 
     m_firstTarget = 0;
     m_targets.clear();
+    m_targetsById.clear();
     m_preciousTargets.clear();
+    m_restatTargets.clear();
+    m_depFileTargets.clear();
     m_inferenceRules.clear();
 }
 
+/**
+ * Returns the target with the given name or 0 if there's no such target.
+ * Target names are case-insensitive and slashes match backslashes.
+ */
+DescriptionBlock* Makefile::target(const QString& name) const
+{
+    return m_targetsById.value(PathTable::id(name), 0);
+}
+
+/**
+ * Returns the target for the given dependent name. In addition to target(),
+ * dependent "foo" also matches a target that has been defined as "C:\MySourceDir\foo"
+ * if C:\MySourceDir is the directory of this makefile.
+ */
+DescriptionBlock* Makefile::dependentTarget(const QString& name) const
+{
+    const int id = PathTable::id(name);
+    DescriptionBlock* result = m_targetsById.value(id, 0);
+    if (result)
+        return result;
+
+    QHash<int, int>::iterator it = m_dirPathIds.find(id);
+    if (it == m_dirPathIds.end())
+        it = m_dirPathIds.insert(id, PathTable::id(dirPath() + QDir::separator() + name));
+    return m_targetsById.value(it.value(), 0);
+}
+
 const QString &Makefile::dirPath() const
 {
     if (m_dirPath.isEmpty()) {
@@ -511,7 +541,7 @@ void Makefile::filterRulesByDependent(QVector<InferenceRule*>& rules, const QStr
                                 baseName + rule->m_fromExtension;
 
         DescriptionBlock* depTarget = m_targets.value(dependentName);
-        if ((depTarget && depTarget->m_bFileExists) || QFile::exists(dependentName)) {
+        if ((depTarget && depTarget->m_bFileExists) || FastFileInfo(dependentName).exists()) {
             ++it;
             continue;
         }
@@ -573,6 +603,61 @@ void Makefile::addPreciousTarget(const QString& targetName)
         m_preciousTargets.append(targetName);
 }
 
+void Makefile::addRestatTarget(const QString& targetName)
+{
+    if (!m_restatTargets.contains(targetName, Qt::CaseInsensitive))
+        m_restatTargets.append(targetName);
+}
+
+void Makefile::addDepFileTarget(const QString& targetName)
+{
+    if (!m_depFileTargets.contains(targetName, Qt::CaseInsensitive))
+        m_depFileTargets.append(targetName);
+}
+
+/**
+ * Returns the name of the depfile the commands of the target write, or an empty string
+ * if the target has not been listed in a .DEPFILES directive.
+ * Entries starting with a dot, like .obj, stand for all targets with that extension.
+ * The depfile has the name of the target with the extension replaced by .d,
+ * like gcc -MD and clang -MD produce it.
+ */
+QString Makefile::depFileName(const QString& targetName) const
+{
+    QString fileName = targetName;
+    if (fileName.startsWith(QLatin1Char('"')) && fileName.endsWith(QLatin1Char('"')))
+        fileName = fileName.mid(1, fileName.length() - 2);
+
+    bool found = false;
+    foreach (const QString &entry, m_depFileTargets) {
+        if (entry.startsWith(QLatin1Char('.'))
+                ? fileName.endsWith(entry, Qt::CaseInsensitive)
+                : fileName.compare(entry, Qt::CaseInsensitive) == 0) {
+            found = true;
+            break;
+        }
+    }
+    if (!found)
+        return QString();
+
+    const int dotIdx = fileName.lastIndexOf(QLatin1Char('.'));
+    if (dotIdx > fileName.lastIndexOf(QLatin1Char('\\'))
+            && dotIdx > fileName.lastIndexOf(QLatin1Char('/'))) {
+        fileName.truncate(dotIdx);
+    }
+    return fileName + QLatin1String(".d");
+}
+
+/**
+ * Returns true if the target has been listed in a .RESTAT directive.
+ * If the commands of such a target leave its file unchanged, the
+ * targets that depend on it aren't rebuilt.
+ */
+bool Makefile::isRestatTarget(const QString& targetName) const
+{
+    return m_restatTargets.contains(targetName, Qt::CaseInsensitive);
+}
+
 void Makefile::invalidateTimeStamps()
 {
     QHash<QString, DescriptionBlock*>::iterator it = m_targets.begin();
@@ -28,6 +28,7 @@
 
 #include "fastfileinfo.h"
 #include "macrotable.h"
+#include "pathtable.h"
 #include <QStringList>
 #include <QHash>
 #include <QVector>
@@ -100,6 +101,7 @@ public:
     Makefile* makefile() const { return m_pMakefile; }
 
     QStringList m_dependents;
+    QStringList m_implicitDependents;   // from the deps log, not part of $** and $?
     FileTime m_timeStamp;
     bool m_bFileExists;
     bool m_bVisitedByCycleCheck;
@@ -148,6 +150,7 @@ public:
     void append(DescriptionBlock* target)
     {
         m_targets[target->targetName().toLower()] = target;
+        m_targetsById[PathTable::id(target->targetName())] = target;
         if (!m_firstTarget) m_firstTarget = target;
     }
 
@@ -156,21 +159,8 @@ public:
         return m_firstTarget;
     }
 
-    DescriptionBlock* target(const QString& name) const
-    {
-        DescriptionBlock* result = 0;
-        const QString lowerName = name.toLower();
-        result = m_targets.value(lowerName, 0);
-        if (result)
-            return result;
-
-        QString systemName = lowerName;
-        result = m_targets.value(systemName.replace(QLatin1Char('/'), QLatin1Char('\\')), 0);
-        if (result)
-            return result;
-
-        return result;
-    }
+    DescriptionBlock* target(const QString& name) const;
+    DescriptionBlock* dependentTarget(const QString& name) const;
 
     const QHash<QString, DescriptionBlock*>& targets() const
     {
@@ -182,6 +172,16 @@ public:
         return m_preciousTargets;
     }
 
+    const QStringList& restatTargets() const
+    {
+        return m_restatTargets;
+    }
+
+    const QStringList& depFileTargets() const
+    {
+        return m_depFileTargets;
+    }
+
     const QVector<InferenceRule *>& inferenceRules() const
     {
         return m_inferenceRules;
@@ -205,6 +205,10 @@ public:
     void addInferenceRule(InferenceRule *rule);
     void calculateInferenceRulePriorities(const QStringList &suffixes);
     void addPreciousTarget(const QString& targetName);
+    void addRestatTarget(const QString& targetName);
+    bool isRestatTarget(const QString& targetName) const;
+    void addDepFileTarget(const QString& targetName);
+    QString depFileName(const QString& targetName) const;
 
 private:
     void filterRulesByDependent(QVector<InferenceRule*>& rules, const QString& targetName);
@@ -218,7 +222,11 @@ private:
     mutable QString m_dirPath;
     DescriptionBlock* m_firstTarget;
     QHash<QString, DescriptionBlock*> m_targets;
+    QHash<int, DescriptionBlock*> m_targetsById;
+    mutable QHash<int, int> m_dirPathIds;   // id of "foo" -> id of "C:\MySourceDir\foo"
     QStringList m_preciousTargets;
+    QStringList m_restatTargets;
+    QStringList m_depFileTargets;
     QVector<InferenceRule *> m_inferenceRules;
     MacroTable* m_macroTable;
     Options* m_options;
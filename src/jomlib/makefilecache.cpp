@@ -0,0 +1,376 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "makefilecache.h"
+#include "macrotable.h"
+#include "makefile.h"
+#include "options.h"
+#include "preprocessor.h"
+
+#include <QtCore/QBuffer>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QSaveFile>
+#include <QtCore/QScopedPointer>
+
+#include <algorithm>
+
+namespace NMakeFile {
+
+static const quint32 cacheFileMagic = 0x4a4f4d43;   // "JOMC"
+static const quint32 cacheFileVersion = 3;
+
+/**
+ * In-memory caches of a long-running jom process, keyed by the cache file name.
+ */
+static QHash<QString, QByteArray> residentCaches;
+
+MakefileCache::MakefileCache(const QString &makefileName, const QStringList &activeTargets,
+                             const Options *options, const MacroTable *macroTable)
+    : m_makefileName(makefileName)
+    , m_isResident(false)
+{
+    const QString absoluteMakefileName = QFileInfo(makefileName).absoluteFilePath();
+    m_cacheFileName = absoluteMakefileName + QLatin1String(".jomcache");
+
+    // Everything the parser sees before reading the first line goes into the key.
+    QByteArray data;
+    QDataStream ds(&data, QIODevice::WriteOnly);
+    ds << cacheFileVersion
+       << absoluteMakefileName
+       << QDir::currentPath()
+       << activeTargets
+       << options->fullAppPath
+       << options->suppressOutputMessages
+       << options->stopOnErrors
+       << options->overrideEnvVarMacros
+       << options->ignorePredefinedRulesAndMacros;
+    writeMacroTable(ds, macroTable);
+    m_inputKey = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
+QByteArray MakefileCache::fileHash(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return QByteArray();
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if (!hash.addData(&file))
+        return QByteArray();
+    return hash.result();
+}
+
+void MakefileCache::writeMacroTable(QDataStream &ds, const MacroTable *macroTable)
+{
+    // QHash iteration order differs between processes. Sort the macros by name.
+    QStringList names = macroTable->m_macros.keys();
+    std::sort(names.begin(), names.end());
+    ds << quint32(names.count());
+    foreach (const QString &name, names) {
+        const MacroTable::MacroData &macroData = macroTable->m_macros[name];
+        ds << name << qint32(macroData.source) << macroData.isReadOnly << macroData.value;
+    }
+
+    const ProcessEnvironment &environment = macroTable->environment();
+    ds << quint32(environment.count());
+    for (ProcessEnvironment::const_iterator it = environment.constBegin();
+         it != environment.constEnd(); ++it)
+    {
+        ds << it.key().toQString() << it.value();
+    }
+}
+
+void MakefileCache::readMacroTable(QDataStream &ds, MacroTable *macroTable)
+{
+    macroTable->m_macros.clear();
+    macroTable->invalidateExpansions();
+    quint32 count;
+    ds >> count;
+    for (quint32 i = 0; i < count && ds.status() == QDataStream::Ok; ++i) {
+        QString name;
+        qint32 source;
+        MacroTable::MacroData macroData;
+        ds >> name >> source >> macroData.isReadOnly >> macroData.value;
+        macroData.source = static_cast<MacroTable::MacroSource>(source);
+        macroTable->m_macros.insert(name, macroData);
+    }
+
+    ProcessEnvironment environment;
+    ds >> count;
+    for (quint32 i = 0; i < count && ds.status() == QDataStream::Ok; ++i) {
+        QString key, value;
+        ds >> key >> value;
+        environment.insert(key, value);
+    }
+    macroTable->setEnvironment(environment);
+}
+
+void MakefileCache::writeCommands(QDataStream &ds, const QList<Command> &commands)
+{
+    ds << quint32(commands.count());
+    foreach (const Command &command, commands) {
+        ds << command.m_commandLine
+           << quint32(command.m_maxExitCode)
+           << command.m_silent
+           << command.m_singleExecution
+           << quint32(command.m_inlineFiles.count());
+        foreach (const InlineFile *inlineFile, command.m_inlineFiles) {
+            ds << inlineFile->m_keep
+               << inlineFile->m_unicode
+               << inlineFile->m_filename
+               << inlineFile->m_content;
+        }
+    }
+}
+
+void MakefileCache::readCommands(QDataStream &ds, QList<Command> &commands)
+{
+    quint32 count;
+    ds >> count;
+    for (quint32 i = 0; i < count && ds.status() == QDataStream::Ok; ++i) {
+        Command command;
+        quint32 maxExitCode, inlineFileCount;
+        ds >> command.m_commandLine
+           >> maxExitCode
+           >> command.m_silent
+           >> command.m_singleExecution
+           >> inlineFileCount;
+        command.m_maxExitCode = maxExitCode;
+        for (quint32 k = 0; k < inlineFileCount && ds.status() == QDataStream::Ok; ++k) {
+            InlineFile *inlineFile = new InlineFile;
+            ds >> inlineFile->m_keep
+               >> inlineFile->m_unicode
+               >> inlineFile->m_filename
+               >> inlineFile->m_content;
+            command.m_inlineFiles.append(inlineFile);
+        }
+        commands.append(command);
+    }
+}
+
+/**
+ * Returns the cached makefile, or 0 if there's no valid cache for the current input.
+ * On success, the macro table is replaced by the cached one, and the makefile takes
+ * ownership of the options and the macro table.
+ */
+Makefile *MakefileCache::load(Options *options, MacroTable *macroTable)
+{
+    if (m_isResident) {
+        QHash<QString, QByteArray>::const_iterator it = residentCaches.constFind(m_cacheFileName);
+        if (it == residentCaches.constEnd())
+            return 0;
+        QBuffer buffer;
+        buffer.setData(it.value());
+        buffer.open(QBuffer::ReadOnly);
+        return read(&buffer, options, macroTable);
+    }
+
+    QFile file(m_cacheFileName);
+    if (!file.open(QFile::ReadOnly))
+        return 0;
+    return read(&file, options, macroTable);
+}
+
+Makefile *MakefileCache::read(QIODevice *device, Options *options, MacroTable *macroTable)
+{
+    QDataStream ds(device);
+    quint32 magic, version;
+    ds >> magic >> version;
+    if (magic != cacheFileMagic || version != cacheFileVersion)
+        return 0;
+
+    QByteArray inputKey;
+    ds >> inputKey;
+    if (inputKey != m_inputKey)
+        return 0;
+
+    quint32 count;
+    ds >> count;
+    for (quint32 i = 0; i < count; ++i) {
+        QString fileName;
+        QByteArray hash;
+        ds >> fileName >> hash;
+        if (ds.status() != QDataStream::Ok || hash.isEmpty() || fileHash(fileName) != hash)
+            return 0;
+    }
+
+    QStringList missingFiles;
+    ds >> missingFiles;
+    foreach (const QString &fileName, missingFiles)
+        if (QFile::exists(fileName))
+            return 0;
+
+    QStringList messages;
+    ds >> messages;
+    MacroTable cachedMacroTable;
+    readMacroTable(ds, &cachedMacroTable);
+
+    QScopedPointer<Makefile> makefile(new Makefile(m_makefileName));
+    bool parallelExecutionDisabled;
+    QStringList preciousTargets, restatTargets, depFileTargets;
+    ds >> parallelExecutionDisabled >> preciousTargets >> restatTargets >> depFileTargets;
+    makefile->setParallelExecutionDisabled(parallelExecutionDisabled);
+    foreach (const QString &preciousTarget, preciousTargets)
+        makefile->addPreciousTarget(preciousTarget);
+    foreach (const QString &restatTarget, restatTargets)
+        makefile->addRestatTarget(restatTarget);
+    foreach (const QString &depFileTarget, depFileTargets)
+        makefile->addDepFileTarget(depFileTarget);
+
+    QVector<InferenceRule *> rules;
+    ds >> count;
+    for (quint32 i = 0; i < count && ds.status() == QDataStream::Ok; ++i) {
+        InferenceRule *rule = new InferenceRule;
+        qint32 priority;
+        ds >> rule->m_batchMode
+           >> rule->m_fromSearchPath
+           >> rule->m_fromExtension
+           >> rule->m_toSearchPath
+           >> rule->m_toExtension
+           >> priority;
+        rule->m_priority = priority;
+        readCommands(ds, rule->m_commands);
+        makefile->addInferenceRule(rule);
+        rules.append(rule);
+    }
+
+    ds >> count;
+    for (quint32 i = 0; i < count && ds.status() == QDataStream::Ok; ++i) {
+        DescriptionBlock *target = new DescriptionBlock(makefile.data());
+        QString targetName;
+        qint32 canAddCommands;
+        QVector<qint32> ruleIndices;
+        ds >> targetName >> target->m_dependents >> canAddCommands >> ruleIndices;
+        target->setTargetName(targetName);
+        target->m_canAddCommands = static_cast<DescriptionBlock::AddCommandsState>(canAddCommands);
+        foreach (qint32 idx, ruleIndices) {
+            if (idx < 0 || idx >= rules.count()) {
+                ds.setStatus(QDataStream::ReadCorruptData);
+                break;
+            }
+            target->m_inferenceRules.append(rules.at(idx));
+        }
+        readCommands(ds, target->m_commands);
+        makefile->append(target);
+    }
+
+    if (ds.status() != QDataStream::Ok) {
+        makefile->clear();
+        qDeleteAll(rules);
+        return 0;
+    }
+
+    foreach (const QString &message, messages)
+        puts(qPrintable(message));
+
+    *macroTable = cachedMacroTable;
+    makefile->setOptions(options);
+    makefile->setMacroTable(macroTable);
+    return makefile.take();
+}
+
+bool MakefileCache::save(const Makefile *makefile, const Preprocessor *preprocessor)
+{
+    if (m_isResident) {
+        QBuffer buffer;
+        buffer.open(QBuffer::WriteOnly);
+        if (!write(&buffer, makefile, preprocessor))
+            return false;
+        residentCaches.insert(m_cacheFileName, buffer.data());
+        return true;
+    }
+
+    QSaveFile file(m_cacheFileName);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+    if (!write(&file, makefile, preprocessor)) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+bool MakefileCache::write(QIODevice *device, const Makefile *makefile,
+                          const Preprocessor *preprocessor)
+{
+    QDataStream ds(device);
+    ds << cacheFileMagic << cacheFileVersion << m_inputKey;
+
+    const QStringList &inputFiles = preprocessor->openedFiles();
+    ds << quint32(inputFiles.count());
+    foreach (const QString &fileName, inputFiles)
+        ds << fileName << fileHash(fileName);
+    ds << preprocessor->missingFiles()
+       << preprocessor->messages();
+    writeMacroTable(ds, makefile->macroTable());
+
+    ds << makefile->isParallelExecutionDisabled() << makefile->preciousTargets()
+       << makefile->restatTargets() << makefile->depFileTargets();
+
+    const QVector<InferenceRule *> &rules = makefile->inferenceRules();
+    ds << quint32(rules.count());
+    foreach (const InferenceRule *rule, rules) {
+        ds << rule->m_batchMode
+           << rule->m_fromSearchPath
+           << rule->m_fromExtension
+           << rule->m_toSearchPath
+           << rule->m_toExtension
+           << qint32(rule->m_priority);
+        writeCommands(ds, rule->m_commands);
+    }
+
+    // The first target must be appended first when loading.
+    QList<DescriptionBlock *> targets = makefile->targets().values();
+    std::sort(targets.begin(), targets.end(),
+              [] (const DescriptionBlock *lhs, const DescriptionBlock *rhs)
+              {
+                  return lhs->targetName() < rhs->targetName();
+              });
+    DescriptionBlock *firstTarget = const_cast<Makefile *>(makefile)->firstTarget();
+    if (firstTarget) {
+        targets.removeOne(firstTarget);
+        targets.prepend(firstTarget);
+    }
+
+    ds << quint32(targets.count());
+    foreach (const DescriptionBlock *target, targets) {
+        QVector<qint32> ruleIndices;
+        foreach (InferenceRule *rule, target->m_inferenceRules)
+            ruleIndices.append(rules.indexOf(rule));
+        ds << target->targetName()
+           << target->m_dependents
+           << qint32(target->m_canAddCommands)
+           << ruleIndices;
+        writeCommands(ds, target->m_commands);
+    }
+
+    return ds.status() == QDataStream::Ok;
+}
+
+} // namespace NMakeFile
@@ -0,0 +1,81 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef MAKEFILECACHE_H
+#define MAKEFILECACHE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QStringList>
+
+QT_BEGIN_NAMESPACE
+class QDataStream;
+class QIODevice;
+QT_END_NAMESPACE
+
+namespace NMakeFile {
+
+class Command;
+class Makefile;
+class MacroTable;
+class Options;
+class Preprocessor;
+
+/**
+ * Binary cache of a fully parsed makefile.
+ *
+ * The cache is stored next to the makefile and is keyed by the macro table and options
+ * before parsing, and by the content hashes of all files the preprocessor has read.
+ * A resident cache is kept in the memory of the jom process instead of on disk.
+ */
+class MakefileCache
+{
+public:
+    MakefileCache(const QString &makefileName, const QStringList &activeTargets,
+                  const Options *options, const MacroTable *macroTable);
+
+    void setResident(bool resident) { m_isResident = resident; }
+    bool isResident() const { return m_isResident; }
+
+    Makefile *load(Options *options, MacroTable *macroTable);
+    bool save(const Makefile *makefile, const Preprocessor *preprocessor);
+
+private:
+    Makefile *read(QIODevice *device, Options *options, MacroTable *macroTable);
+    bool write(QIODevice *device, const Makefile *makefile, const Preprocessor *preprocessor);
+    static void writeMacroTable(QDataStream &ds, const MacroTable *macroTable);
+    static void readMacroTable(QDataStream &ds, MacroTable *macroTable);
+    static void writeCommands(QDataStream &ds, const QList<Command> &commands);
+    static void readCommands(QDataStream &ds, QList<Command> &commands);
+    static QByteArray fileHash(const QString &fileName);
+
+    QString m_makefileName;
+    QString m_cacheFileName;
+    QByteArray m_inputKey;
+    bool m_isResident;
+};
+
+} // namespace NMakeFile
+
+#endif // MAKEFILECACHE_H
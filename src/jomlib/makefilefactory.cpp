@@ -27,18 +27,21 @@
 #include "makefilefactory.h"
 #include "macrotable.h"
 #include "makefile.h"
+#include "makefilecache.h"
 #include "options.h"
 #include "parser.h"
 #include "preprocessor.h"
 
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDir>
+#include <QtCore/QScopedPointer>
 
 namespace NMakeFile {
 
 MakefileFactory::MakefileFactory()
 :   m_makefile(0),
-    m_errorType(NoError)
+    m_errorType(NoError),
+    m_isResident(false)
 {
 }
 
@@ -105,8 +108,14 @@ bool MakefileFactory::apply(const QStringList& commandLineArguments, Options **o
     macroTable->setEnvironment(m_environment);
 
     QString filename;
-    if (!options->readCommandLineArguments(commandLineArguments, filename, m_activeTargets, *macroTable)) {
-        m_errorType = CommandLineError;
+    try {
+        if (!options->readCommandLineArguments(commandLineArguments, filename, m_activeTargets, *macroTable)) {
+            m_errorType = CommandLineError;
+            return false;
+        }
+    } catch (const Exception &e) {
+        m_errorString = e.message();
+        m_errorType = MacroError;
         return false;
     }
     if (options->showUsageAndExit || options->showVersionAndExit)
@@ -156,6 +165,15 @@ bool MakefileFactory::apply(const QStringList& commandLineArguments, Options **o
         macroTable->predefineValue("RCFLAGS", QString());
     }
 
+    QScopedPointer<MakefileCache> cache;
+    if (options->useMakefileCache || m_isResident) {
+        cache.reset(new MakefileCache(filename, m_activeTargets, options, macroTable));
+        cache->setResident(m_isResident);
+        m_makefile = cache->load(options, macroTable);
+        if (m_makefile)
+            return true;
+    }
+
     try {
         m_makefile = new Makefile(filename);
         m_makefile->setOptions(options);
@@ -165,6 +183,8 @@ bool MakefileFactory::apply(const QStringList& commandLineArguments, Options **o
         preprocessor.openFile(filename);
         Parser parser;
         parser.apply(&preprocessor, m_makefile, m_activeTargets);
+        if (cache && preprocessor.isResultCacheable() && parser.isResultCacheable())
+            cache->save(m_makefile, &preprocessor);
     } catch (Exception &e) {
         m_errorType = ParserError;
         m_errorString = e.toString();
@@ -39,11 +39,14 @@ class MakefileFactory
 public:
     MakefileFactory();
     void setEnvironment(const QStringList& env);
+    void setEnvironment(const ProcessEnvironment& env) { m_environment = env; }
+    void setResident(bool resident) { m_isResident = resident; }
     bool apply(const QStringList& commandLineArguments, Options **outopt = 0);
 
     enum ErrorType {
         NoError,
         CommandLineError,
+        MacroError,
         ParserError,
         IOError
     };
@@ -62,6 +65,7 @@ private:
     QStringList m_activeTargets;
     QString     m_errorString;
     ErrorType   m_errorType;
+    bool        m_isResident;
 };
 
 } // namespace NMakeFile
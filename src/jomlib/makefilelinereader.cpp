@@ -28,58 +28,152 @@
 #include <QTextCodec>
 #include <QDebug>
 
+#include <string.h>
+
 namespace NMakeFile {
 
 MakefileLineReader::MakefileLineReader(const QString& filename)
 :   m_file(filename),
-    m_nLineBufferSize(m_nInitialLineBufferSize),
+    m_mappedData(0),
+    m_data(0),
+    m_dataSize(0),
+    m_pos(0),
     m_nLineNumber(0)
 {
-    m_lineBuffer = reinterpret_cast<char*>( malloc(m_nLineBufferSize) );
 }
 
 MakefileLineReader::~MakefileLineReader()
 {
     close();
-    free(m_lineBuffer);
 }
 
 bool MakefileLineReader::open()
 {
-    if (!m_file.open(QIODevice::ReadOnly | QIODevice::Text))
+    if (!m_file.open(QIODevice::ReadOnly))
         return false;
 
+    // Lines are read directly from the mapped file.
+    // Files that cannot be mapped, e.g. empty ones, are read into memory.
+    m_pos = 0;
+    m_dataSize = m_file.size();
+    if (m_dataSize > 0)
+        m_mappedData = m_file.map(0, m_dataSize);
+    if (m_mappedData) {
+        m_data = reinterpret_cast<const char *>(m_mappedData);
+    } else {
+        m_fileContent = m_file.readAll();
+        m_data = m_fileContent.constData();
+        m_dataSize = m_fileContent.size();
+    }
+
     // check BOM
-    enum FileEncoding { FCLatin1, FCUTF8, FCUTF16 };
-    FileEncoding fileEncoding = FCLatin1;
-    QByteArray buf = m_file.peek(3);
-    if (buf.startsWith("\xFF\xFE"))
-        fileEncoding = FCUTF16;
-    else if (buf.startsWith("\xEF\xBB\xBF"))
-        fileEncoding = FCUTF8;
-
-    if (fileEncoding == FCLatin1) {
-        m_readLineImpl = &NMakeFile::MakefileLineReader::readLine_impl_local8bit;
+    const QByteArray bom = QByteArray::fromRawData(m_data, qMin<qint64>(m_dataSize, 3));
+    if (bom.startsWith("\xFF\xFE")) {
+        QTextCodec *codec = QTextCodec::codecForName("UTF-16LE");
+        m_unicodeContent = codec->toUnicode(m_data + 2, static_cast<int>(m_dataSize - 2));
+    } else if (bom.startsWith("\xEF\xBB\xBF")) {
+        m_unicodeContent = QString::fromUtf8(m_data + 3, static_cast<int>(m_dataSize - 3));
     } else {
-        m_readLineImpl = &NMakeFile::MakefileLineReader::readLine_impl_unicode;
-        m_textStream.setCodec(fileEncoding == FCUTF8 ? "UTF-8" : "UTF-16");
-        m_textStream.setAutoDetectUnicode(false);
-        m_textStream.setDevice(&m_file);
+        m_readLineImpl = &NMakeFile::MakefileLineReader::readLine_impl<char>;
+        return true;
     }
 
+    // Unicode files are decoded in one go. The lines are read from the decoded string.
+    m_readLineImpl = &NMakeFile::MakefileLineReader::readLine_impl<QChar>;
+    unmapFile();
+    m_dataSize = m_unicodeContent.length();
     return true;
 }
 
+void MakefileLineReader::unmapFile()
+{
+    if (m_mappedData) {
+        m_file.unmap(m_mappedData);
+        m_mappedData = 0;
+    }
+    m_fileContent.clear();
+    m_data = 0;
+}
+
 void MakefileLineReader::close()
 {
+    unmapFile();
+    m_unicodeContent.clear();
+    m_dataSize = 0;
     m_file.close();
 }
 
-void MakefileLineReader::growLineBuffer(size_t nGrow)
+/**
+ * Returns the next line of an 8 bit file without copying it.
+ * The line ends before the newline character. A "\r\n" line end is recognized as well.
+ * Returns false at the end of the file.
+ */
+bool MakefileLineReader::nextRawLine(const char **line, int *length, bool *newLineFound)
+{
+    if (m_pos >= m_dataSize)
+        return false;
+
+    const char *begin = m_data + m_pos;
+    const size_t available = static_cast<size_t>(m_dataSize - m_pos);
+    const char *newLine = static_cast<const char *>(memchr(begin, '\n', available));
+    const char *end = newLine ? newLine : begin + available;
+    m_pos = end - m_data + (newLine ? 1 : 0);
+    if (newLine && end > begin && end[-1] == '\r')
+        --end;
+
+    *line = begin;
+    *length = static_cast<int>(end - begin);
+    if (newLineFound)
+        *newLineFound = newLine != 0;
+    return true;
+}
+
+/**
+ * Returns the next line of a decoded unicode file without copying it.
+ */
+bool MakefileLineReader::nextRawLine(const QChar **line, int *length, bool *newLineFound)
+{
+    if (m_pos >= m_dataSize)
+        return false;
+
+    const int begin = static_cast<int>(m_pos);
+    const int newLine = m_unicodeContent.indexOf(QLatin1Char('\n'), begin);
+    int end = newLine >= 0 ? newLine : m_unicodeContent.length();
+    m_pos = newLine >= 0 ? newLine + 1 : end;
+    if (newLine >= 0 && end > begin && m_unicodeContent.at(end - 1) == QLatin1Char('\r'))
+        --end;
+
+    *line = m_unicodeContent.constData() + begin;
+    *length = end - begin;
+    if (newLineFound)
+        *newLineFound = newLine >= 0;
+    return true;
+}
+
+static inline ushort code(char ch)
+{
+    return static_cast<uchar>(ch);
+}
+
+static inline ushort code(QChar ch)
+{
+    return ch.unicode();
+}
+
+template <typename Char>
+static inline bool startsWith(const Char *str, int length, char ch)
+{
+    return length > 0 && code(str[0]) == ch;
+}
+
+static inline QString toQString(const char *str, int length)
 {
-    //fprintf(stderr, "realloc %d -> %d\n", m_nLineBufferSize, m_nLineBufferSize + nGrow);
-    m_nLineBufferSize += nGrow;
-    m_lineBuffer = reinterpret_cast<char*>(realloc(m_lineBuffer, m_nLineBufferSize));
+    return QString::fromLatin1(str, length);
+}
+
+static inline QString toQString(const QChar *str, int length)
+{
+    return QString(str, length);
 }
 
 /**
@@ -90,101 +184,63 @@ void MakefileLineReader::growLineBuffer(size_t nGrow)
  */
 MakefileLine MakefileLineReader::readLine(bool bInlineFileMode)
 {
-    if (bInlineFileMode) {
-        m_nLineNumber++;
-        return MakefileLine{ QString::fromLatin1(m_file.readLine()) };
-    }
-
-    return (this->*m_readLineImpl)();
+    return (this->*m_readLineImpl)(bInlineFileMode ? InlineFileMode : NormalMode);
 }
 
 /**
- * readLine implementation optimized for 8 bit files.
+ * Reads the next line that starts with '!'.
+ * All lines in between are skipped without being converted to QString.
+ * Used for skipping the lines of inactive conditional blocks.
  */
-MakefileLine MakefileLineReader::readLine_impl_local8bit()
+MakefileLine MakefileLineReader::readDirectiveLine()
 {
-    size_t bytesRead;
-    do {
-        m_nLineNumber++;
-        const qint64 n = m_file.readLine(m_lineBuffer, m_nLineBufferSize - 1);
-        if (n <= 0)
-            return {};
-
-        bytesRead = n;
-        while (m_lineBuffer[bytesRead - 1] != '\n') {
-            if (m_file.atEnd()) {
-                // The file didn't end with a newline.
-                // Code below relies on having a trailing newline.
-                // We're imitating it by increasing the string length.
-                if (bytesRead >= (m_nLineBufferSize - 2))
-                    growLineBuffer(1);
-                ++bytesRead;
-                break;
-            }
-
-            growLineBuffer(m_nLineBufferGrowSize);
-            int moreBytesRead = m_file.readLine(m_lineBuffer + bytesRead, m_nLineBufferSize - 1 - bytesRead);
-            if (moreBytesRead <= 0)
-                break;
-            bytesRead += moreBytesRead;
-        }
-
-    } while (m_lineBuffer[0] == '#');
-    m_lineBuffer[bytesRead] = '\0';
-
-    MakefileLine line;
-    char* buf = m_lineBuffer;
-    int bufLength = static_cast<int>(bytesRead);
-    if (bufLength >= 2 && buf[bufLength - 2] == '\\') {
-        if (bufLength >= 3 && buf[bufLength - 3] == '^') {
-            buf[bufLength - 3] = '\\';      // replace "^\\\n" -> "\\\\\n"
-            bufLength -= 2;                 // remove "\\\n"
-        } else if (bufLength >= 3 && buf[bufLength - 3] == '\\') {
-            bufLength--;    // remove trailing \n
-        } else {
-            bufLength -= 2; // remove "\\\n"
-            line.continuation = LineContinuationType::Backslash;
-        }
-    } else if (bufLength >= 2 && buf[bufLength - 2] == '^') {
-        bufLength -= 2;
-        line.continuation = LineContinuationType::Caret;
-    } else {
-        bufLength--;    // remove trailing \n
-    }
-
-    line.content = QString::fromLatin1(buf, bufLength);
-    return line;
+    return (this->*m_readLineImpl)(DirectiveMode);
 }
 
 /**
- * readLine implementation for unicode files.
- * Much slower than the 8 bit version.
+ * readLine implementation for 8 bit files and decoded unicode files.
+ * Comment lines are skipped without being converted to QString.
  */
-MakefileLine MakefileLineReader::readLine_impl_unicode()
+template <typename Char>
+MakefileLine MakefileLineReader::readLine_impl(ReadMode mode)
 {
-    MakefileLine line;
-    QString str;
-    do {
+    const Char *buf;
+    int bufLength;
+    if (mode == InlineFileMode) {
         m_nLineNumber++;
-        str = m_textStream.readLine();
-    } while (str.startsWith(QLatin1Char('#')));
-
-    if (str.isNull())
+        bool newLineFound;
+        if (!nextRawLine(&buf, &bufLength, &newLineFound))
+            return {};
+        MakefileLine line{ toQString(buf, bufLength) };
+        if (newLineFound)
+            line.content += QLatin1Char('\n');
         return line;
+    }
+
+    do {
+        m_nLineNumber++;
+        if (!nextRawLine(&buf, &bufLength))
+            return {};
+    } while (mode == DirectiveMode ? !startsWith(buf, bufLength, '!')
+                                   : startsWith(buf, bufLength, '#'));
 
-    if (str.endsWith(QLatin1String("^\\"))) {
-        str.remove(str.length() - 2, 1);
-    } else if (str.endsWith(QLatin1String("\\\\"))) {
-        // Do nothing. Double backslash at the end is not altered.
-    } else if (str.endsWith(QLatin1Char('\\'))) {
-        str.chop(1);
-        line.continuation = LineContinuationType::Backslash;
-    } else if (str.endsWith(QLatin1Char('^'))) {
-        str.chop(1);
+    MakefileLine line;
+    if (bufLength >= 1 && code(buf[bufLength - 1]) == '\\') {
+        if (bufLength >= 2 && code(buf[bufLength - 2]) == '^') {
+            // replace "^\\" -> "\\"
+            line.content = toQString(buf, bufLength - 1);
+            line.content[bufLength - 2] = QLatin1Char('\\');
+            return line;
+        } else if (bufLength < 2 || code(buf[bufLength - 2]) != '\\') {
+            bufLength--;    // remove trailing "\\"
+            line.continuation = LineContinuationType::Backslash;
+        }
+    } else if (bufLength >= 1 && code(buf[bufLength - 1]) == '^') {
+        bufLength--;
         line.continuation = LineContinuationType::Caret;
     }
 
-    line.content = str;
+    line.content = toQString(buf, bufLength);
     return line;
 }
 
@@ -26,8 +26,9 @@
 #ifndef MAKEFILELINEREADER_H
 #define MAKEFILELINEREADER_H
 
+#include <QtCore/QByteArray>
 #include <QtCore/QFile>
-#include <QtCore/QTextStream>
+#include <QtCore/QString>
 
 namespace NMakeFile {
 
@@ -57,24 +58,28 @@ public:
     bool open();
     void close();
     MakefileLine readLine(bool bInlineFileMode);
+    MakefileLine readDirectiveLine();
     QString fileName() const { return m_file.fileName(); }
     uint lineNumber() const { return m_nLineNumber; }
 
 private:
-    void growLineBuffer(size_t nGrow);
+    void unmapFile();
+    bool nextRawLine(const char **line, int *length, bool *newLineFound = 0);
+    bool nextRawLine(const QChar **line, int *length, bool *newLineFound = 0);
 
-    typedef MakefileLine (MakefileLineReader::*ReadLineImpl)();
+    enum ReadMode { NormalMode, InlineFileMode, DirectiveMode };
+    typedef MakefileLine (MakefileLineReader::*ReadLineImpl)(ReadMode mode);
     ReadLineImpl m_readLineImpl;
-    MakefileLine readLine_impl_local8bit();
-    MakefileLine readLine_impl_unicode();
+    template <typename Char> MakefileLine readLine_impl(ReadMode mode);
 
 private:
     QFile m_file;
-    QTextStream m_textStream;
-    static const size_t m_nInitialLineBufferSize = 6144;
-    static const size_t m_nLineBufferGrowSize = 1024;
-    size_t m_nLineBufferSize;
-    char *m_lineBuffer;
+    uchar *m_mappedData;
+    QByteArray m_fileContent;
+    QString m_unicodeContent;
+    const char *m_data;
+    qint64 m_dataSize;
+    qint64 m_pos;
     uint m_nLineNumber;
 };
 
@@ -67,7 +67,15 @@ Options::Options()
     showUsageAndExit(false),
     displayBuildInfo(false),
     debugMode(false),
-    showVersionAndExit(false)
+    showVersionAndExit(false),
+    useMakefileCache(false),
+    criticalPathScheduling(false),
+    combineCommandLineTargets(false),
+    advertiseJobServer(false),
+    runRecursiveMakeInProcess(false),
+    useContentHashes(false),
+    watchForChanges(false),
+    useShellPool(false)
 {
 }
 
@@ -79,10 +87,15 @@ Options::Options()
  * - fill the MAKEFLAGS variable (and translate long option names to short option names)
  * - set macro values
  * - generate list of targets
+ *
+ * The process wide options go into globalOptions, which defaults to g_options.
  */
 bool Options::readCommandLineArguments(QStringList arguments, QString& makefile,
-                                       QStringList& targets, MacroTable& macroTable)
+                                       QStringList& targets, MacroTable& macroTable,
+                                       GlobalOptions* globalOptions)
 {
+    if (!globalOptions)
+        globalOptions = &g_options;
     QString makeflags;
     if (!expandCommandFiles(arguments))
         return false;
@@ -97,16 +110,14 @@ bool Options::readCommandLineArguments(QStringList arguments, QString& makefile,
             // handle option
             arg.remove(0, 1);
             arg = arg.trimmed();
-            if (!handleCommandLineOption(originalArguments, arg, arguments, makefile, makeflags))
+            if (!handleCommandLineOption(originalArguments, arg, arguments, makefile, makeflags, *globalOptions))
                 return false;
         } else if (arg.contains(QLatin1Char('='))) {
             // handle macro definition
             int idx = arg.indexOf(QLatin1Char('='));
             QString name = arg.left(idx).trimmed();
-            if (!macroTable.isMacroNameValid(name)) {
-                fprintf(stderr, "Error: The macro name %s is invalid.", qPrintable(name));
-                exit(128);
-            }
+            if (!macroTable.isMacroNameValid(name))
+                throw Exception(QString(QLatin1String("The macro name %1 is invalid.")).arg(name));
             const QString value = trimLeft(arg.mid(idx+1));
             if (!explicitlyDefinedMacros.contains(name)) {
                 explicitlyDefinedMacros.insert(name);
@@ -186,7 +197,7 @@ bool Options::expandCommandFiles(QStringList& arguments)
     return true;
 }
 
-bool Options::handleCommandLineOption(const QStringList &originalArguments, QString arg, QStringList& arguments, QString& makefile, QString& makeflags)
+bool Options::handleCommandLineOption(const QStringList &originalArguments, QString arg, QStringList& arguments, QString& makefile, QString& makeflags, GlobalOptions& globalOptions)
 {
     while (!arg.isEmpty()) {
         QString upperArg = arg.toUpper();
@@ -213,6 +224,30 @@ bool Options::handleCommandLineOption(const QStringList &originalArguments, QStr
             } else if (upperArg.startsWith(QLatin1String("VERSION"))) {
                 arg.remove(0, 7);
                 showVersionAndExit = true;
+            } else if (upperArg.startsWith(QLatin1String("PARSECACHE"))) {
+                arg.remove(0, 10);
+                useMakefileCache = true;
+            } else if (upperArg.startsWith(QLatin1String("CRITICALPATH"))) {
+                arg.remove(0, 12);
+                criticalPathScheduling = true;
+            } else if (upperArg.startsWith(QLatin1String("COMBINETARGETS"))) {
+                arg.remove(0, 14);
+                combineCommandLineTargets = true;
+            } else if (upperArg.startsWith(QLatin1String("GNUJOBSERVER"))) {
+                arg.remove(0, 12);
+                advertiseJobServer = true;
+            } else if (upperArg.startsWith(QLatin1String("INPROCESSMAKE"))) {
+                arg.remove(0, 13);
+                runRecursiveMakeInProcess = true;
+            } else if (upperArg.startsWith(QLatin1String("CONTENTHASH"))) {
+                arg.remove(0, 11);
+                useContentHashes = true;
+            } else if (upperArg.startsWith(QLatin1String("WATCH"))) {
+                arg.remove(0, 5);
+                watchForChanges = true;
+            } else if (upperArg.startsWith(QLatin1String("SHELLPOOL"))) {
+                arg.remove(0, 9);
+                useShellPool = true;
             }
         }
 
@@ -294,16 +329,16 @@ bool Options::handleCommandLineOption(const QStringList &originalArguments, QStr
                         arg.remove(0, nJobsStr.length());
                     }
                     bool ok;
-                    g_options.maxNumberOfJobs = nJobsStr.toUInt(&ok);
+                    globalOptions.maxNumberOfJobs = nJobsStr.toUInt(&ok);
                     if (!ok) {
                         fprintf(stderr, "Error: option -j expects a numerical argument\n");
                         return false;
                     }
-                    if (g_options.maxNumberOfJobs < 1) {
+                    if (globalOptions.maxNumberOfJobs < 1) {
                         fputs("Error: the argument for -j must not be less than 1.\n", stderr);
                         return false;
                     }
-                    g_options.isMaxNumberOfJobsSet = true;
+                    globalOptions.isMaxNumberOfJobsSet = true;
                     if (makeflags.at(makeflags.count() - 1).toUpper() == QLatin1Char('J'))
                         makeflags += nJobsStr;
                     break;
@@ -31,6 +31,7 @@
 
 namespace NMakeFile {
 
+class GlobalOptions;
 class MacroTable;
 
 class Options
@@ -39,7 +40,8 @@ public:
     Options();
 
     bool readCommandLineArguments(QStringList arguments, QString& makefile,
-                                  QStringList& targets, MacroTable& macroTable);
+                                  QStringList& targets, MacroTable& macroTable,
+                                  GlobalOptions* globalOptions = 0);
 
     bool buildAllTargets;
     bool buildIfTimeStampsAreEqual;
@@ -64,12 +66,20 @@ public:
     bool displayBuildInfo;
     bool debugMode;
     bool showVersionAndExit;
+    bool useMakefileCache;
+    bool criticalPathScheduling;
+    bool combineCommandLineTargets;
+    bool advertiseJobServer;
+    bool runRecursiveMakeInProcess;
+    bool useContentHashes;
+    bool watchForChanges;
+    bool useShellPool;
     QString fullAppPath;
     QString stderrFile;
 
 private:
     bool expandCommandFiles(QStringList& arguments);
-    bool handleCommandLineOption(const QStringList &originalArguments, QString arg, QStringList& arguments, QString& makefile, QString& makeflags);
+    bool handleCommandLineOption(const QStringList &originalArguments, QString arg, QStringList& arguments, QString& makefile, QString& makeflags, GlobalOptions& globalOptions);
 };
 
 class GlobalOptions
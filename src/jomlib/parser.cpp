@@ -38,9 +38,10 @@
 namespace NMakeFile {
 
 Parser::Parser()
-:   m_preprocessor(0)
+:   m_preprocessor(0),
+    m_bWildcardsExpanded(false)
 {
-    m_rexDotDirective.setPattern(QLatin1String("^\\.(IGNORE|PRECIOUS|SILENT|SUFFIXES)\\s*:(.*)"));
+    m_rexDotDirective.setPattern(QLatin1String("^\\.(DEPFILES|IGNORE|PRECIOUS|RESTAT|SILENT|SUFFIXES)\\s*:(.*)"));
     m_rexInferenceRule.setPattern(QLatin1String("^(\\{.*\\})?(\\.\\w+)(\\{.*\\})?(\\.\\w+)(:{1,2})"));
     m_rexSingleWhiteSpace.setPattern(QLatin1String("\\s"));
 }
@@ -63,6 +64,7 @@ void Parser::apply(Preprocessor* pp,
     const Options* options = mkfile->options();
     m_silentCommands = options->suppressOutputMessages;
     m_ignoreExitCodes = !options->stopOnErrors;
+    m_bWildcardsExpanded = false;
     m_suffixes.clear();
     m_suffixes << QLatin1String(".exe")
                << QLatin1String(".obj")
@@ -356,11 +358,13 @@ static bool containsWildcard(const QString &str)
     return false;
 }
 
-static QStringList expandWildcards(const QString &dirPath, const QStringList &lst)
+static QStringList expandWildcards(const QString &dirPath, const QStringList &lst,
+                                   bool *wildcardsExpanded)
 {
     QStringList result;
     foreach (QString str, lst) {
         if (containsWildcard(str)) {
+            *wildcardsExpanded = true;
             QString path = dirPath;
             str = QDir::fromNativeSeparators(str);
             int idx = str.lastIndexOf(QLatin1Char('/'));
@@ -420,7 +424,7 @@ void Parser::parseDescriptionBlock(int separatorPos, int separatorLength, int co
 
     const QStringList targets = splitTargetNames(target);
     QStringList dependents = splitTargetNames(value);
-    dependents = expandWildcards(m_makefile->dirPath(), dependents);
+    dependents = expandWildcards(m_makefile->dirPath(), dependents, &m_bWildcardsExpanded);
 
     // handle the special .SYNC dependents
     {
@@ -464,6 +468,10 @@ void Parser::parseDescriptionBlock(int separatorPos, int separatorLength, int co
         descblock->m_dependents.append(dependents);
         descblock->expandFileNameMacrosForDependents();
 
+        // Intern the dependents now. Looking them up in the dependency graph won't allocate.
+        foreach (const QString& dependent, descblock->m_dependents)
+            PathTable::id(dependent);
+
         if (!commands.isEmpty()) {
             if (canAddCommands == DescriptionBlock::ACSEnabled || descblock->m_commands.isEmpty())
                 descblock->m_commands.append(commands);
@@ -633,6 +641,16 @@ void Parser::parseDotDirective()
         foreach (QString str, splitvalues)
             if (!str.isEmpty())
                 m_makefile->addPreciousTarget(str);
+    } else if (directive == QLatin1String("DEPFILES")) {
+        const QStringList& splitvalues = value.split(m_rexSingleWhiteSpace);
+        foreach (QString str, splitvalues)
+            if (!str.isEmpty())
+                m_makefile->addDepFileTarget(str);
+    } else if (directive == QLatin1String("RESTAT")) {
+        const QStringList& splitvalues = value.split(m_rexSingleWhiteSpace);
+        foreach (QString str, splitvalues)
+            if (!str.isEmpty())
+                m_makefile->addRestatTarget(str);
     } else if (directive == QLatin1String("SILENT")) {
         m_silentCommands = true;
     }
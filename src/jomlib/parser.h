@@ -49,6 +49,7 @@ public:
                Makefile* mkfile,
                const QStringList& activeTargets = QStringList());
     MacroTable* macroTable();
+    bool isResultCacheable() const { return !m_bWildcardsExpanded; }
 
 private:
     void readLine();
@@ -74,6 +75,7 @@ private:
     QString                     m_line;
     bool                        m_silentCommands;
     bool                        m_ignoreExitCodes;
+    bool                        m_bWildcardsExpanded;
 
     QRegExp                     m_rexDotDirective;
     QRegExp                     m_rexInferenceRule;
@@ -23,23 +23,44 @@
 **
 ****************************************************************************/
 
-#include "jobclientacquirehelper.h"
+#include "pathtable.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QVector>
 
 namespace NMakeFile {
 
-JobClientAcquireHelper::JobClientAcquireHelper(QSystemSemaphore *semaphore)
-    : m_semaphore(semaphore)
+static QHash<QString, int> spellingIds;     // path as written -> id
+static QHash<QString, int> canonicalIds;    // canonical path -> id
+static QVector<QString> canonicalPaths;     // id -> canonical path
+
+/**
+ * Returns the id of the given path. The path is added to the table if necessary.
+ */
+int PathTable::id(const QString &path)
 {
+    QHash<QString, int>::const_iterator it = spellingIds.constFind(path);
+    if (it != spellingIds.constEnd())
+        return it.value();
+
+    QString canonical = path.toLower();
+    canonical.replace(QLatin1Char('/'), QLatin1Char('\\'));
+    int result = canonicalIds.value(canonical, -1);
+    if (result < 0) {
+        result = canonicalPaths.count();
+        canonicalPaths.append(canonical);
+        canonicalIds.insert(canonical, result);
+    }
+    spellingIds.insert(path, result);
+    return result;
 }
 
-void JobClientAcquireHelper::acquire()
+/**
+ * Returns the lower case path with backslashes as separators that belongs to the given id.
+ */
+QString PathTable::canonicalPath(int id)
 {
-    if (!m_semaphore->acquire()) {
-        qWarning("QSystemSemaphore::acquire failed: %s (%d)",
-                 qPrintable(m_semaphore->errorString()), m_semaphore->error());
-        return;
-    }
-    emit acquired();
+    return canonicalPaths.value(id);
 }
 
 } // namespace NMakeFile
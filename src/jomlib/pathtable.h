@@ -23,30 +23,29 @@
 **
 ****************************************************************************/
 
-#ifndef JOBCLIENTACQUIRETHREAD_H
-#define JOBCLIENTACQUIRETHREAD_H
+#ifndef PATHTABLE_H
+#define PATHTABLE_H
 
-#include <QObject>
-#include <QSystemSemaphore>
+#include <QtCore/QString>
 
 namespace NMakeFile {
 
-class JobClientAcquireHelper : public QObject
+/**
+ * Process-wide table of interned paths.
+ *
+ * Every path gets a compact id. Paths that differ only in case or in the kind of
+ * directory separators get the same id. Looking up the id of a spelling that has been
+ * seen before is a single hash probe and allocates nothing.
+ *
+ * Ids stay valid for the lifetime of the process. The table is not thread-safe.
+ */
+class PathTable
 {
-    Q_OBJECT
 public:
-    explicit JobClientAcquireHelper(QSystemSemaphore *semaphore);
-
-public slots:
-    void acquire();
-
-signals:
-    void acquired();
-
-private:
-    QSystemSemaphore *m_semaphore;
+    static int id(const QString &path);
+    static QString canonicalPath(int id);
 };
 
 } // namespace NMakeFile
 
-#endif // JOBCLIENTACQUIRETHREAD_H
+#endif // PATHTABLE_H
@@ -30,15 +30,165 @@
 #include "helperfunctions.h"
 #include "fastfileinfo.h"
 
+#include <QDateTime>
 #include <QDir>
 #include <QDebug>
+#include <QHash>
 
 namespace NMakeFile {
 
+/**
+ * Returns the first word after the '!' of a preprocessing directive line.
+ * Like in m_rexPreprocessingDirective, macros are not expanded.
+ */
+static QStringRef directiveName(const QString& line, int *valueStart = 0)
+{
+    int begin = 1;
+    while (begin < line.length() && line.at(begin).isSpace())
+        ++begin;
+    int end = begin;
+    while (end < line.length() && !line.at(end).isSpace())
+        ++end;
+    if (valueStart)
+        *valueStart = end;
+    return line.midRef(begin, end - begin);
+}
+
+enum ConditionalDirectiveToken { TOK_IF, TOK_ENDIF, TOK_ELSE, TOK_UNINTERESTING };
+
+/**
+ * Determines the kind of conditional directive in line without expanding macros.
+ */
+static ConditionalDirectiveToken conditionalDirectiveToken(const QString& line)
+{
+    const QStringRef directive = directiveName(line);
+    if (directive.compare(QLatin1String("ENDIF"), Qt::CaseInsensitive) == 0)
+        return TOK_ENDIF;
+    if (directive.startsWith(QLatin1String("IF"), Qt::CaseInsensitive))
+        return TOK_IF;
+    if (directive.startsWith(QLatin1String("ELSE"), Qt::CaseInsensitive))
+        return TOK_ELSE;
+    return TOK_UNINTERESTING;
+}
+
+/**
+ * Returns the macro name of a line like "!IFNDEF NAME".
+ * Returns an empty string for all other lines, including ones where the name needs expansion.
+ */
+static QString includeGuardCandidate(const MakefileLine& line)
+{
+    if (!isComplete(line) || !line.content.startsWith(QLatin1Char('!')))
+        return QString();
+
+    int valueStart;
+    if (directiveName(line.content, &valueStart).compare(QLatin1String("IFNDEF"),
+                                                         Qt::CaseInsensitive) != 0) {
+        return QString();
+    }
+
+    QString name = line.content.mid(valueStart);
+    Preprocessor::removeInlineComments(name);
+    name = name.trimmed();
+    for (int i = 0; i < name.length(); ++i) {
+        const QChar ch = name.at(i);
+        if (ch.isSpace() || ch == QLatin1Char('$') || ch == QLatin1Char('('))
+            return QString();
+    }
+    return name;
+}
+
+/**
+ * Returns the name of the include guard macro, if all content of the file is enclosed in
+ * "!IFNDEF NAME" ... "!ENDIF". Returns an empty string otherwise.
+ */
+static QString scanForIncludeGuard(const QString& fileName)
+{
+    MakefileLineReader reader(fileName);
+    if (!reader.open())
+        return QString();
+
+    QString macroName;
+    int depth = 0;
+    bool guardClosed = false;
+    forever {
+        const MakefileLine line = reader.readLine(false);
+        if (line.content.isNull())
+            break;
+        if (line.content.trimmed().isEmpty())
+            continue;
+        if (guardClosed)
+            return QString();   // content after the closing !ENDIF
+
+        if (macroName.isEmpty()) {
+            macroName = includeGuardCandidate(line);
+            if (macroName.isEmpty())
+                return QString();
+            depth = 1;
+            continue;
+        }
+
+        if (!line.content.startsWith(QLatin1Char('!')))
+            continue;
+        switch (conditionalDirectiveToken(line.content)) {
+        case TOK_IF:
+            ++depth;
+            break;
+        case TOK_ELSE:
+            if (depth == 1)
+                return QString();
+            break;
+        case TOK_ENDIF:
+            if (--depth == 0)
+                guardClosed = true;
+            break;
+        case TOK_UNINTERESTING:
+            break;
+        }
+    }
+    return guardClosed ? macroName : QString();
+}
+
+struct IncludeGuard
+{
+    QDateTime lastModified;
+    QString macroName;      // empty if the file has no include guard
+};
+
+/**
+ * Include guards of files that have been included more than once, keyed by absolute file path.
+ * Shared by all preprocessors of this process.
+ */
+static QHash<QString, IncludeGuard> includeGuards;
+
+static QString includeGuardMacro(const QFileInfo& fileInfo)
+{
+    const QString fileName = fileInfo.absoluteFilePath();
+    const QDateTime lastModified = fileInfo.lastModified();
+    QHash<QString, IncludeGuard>::iterator it = includeGuards.find(fileName);
+    if (it == includeGuards.end() || it->lastModified != lastModified) {
+        IncludeGuard guard;
+        guard.lastModified = lastModified;
+        guard.macroName = scanForIncludeGuard(fileName);
+        it = includeGuards.insert(fileName, guard);
+    }
+    return it->macroName;
+}
+
+/**
+ * Forgets the include guards of all files.
+ * A resident jom calls this before each build, because included files may have been
+ * replaced by files that have the same time stamp.
+ */
+void Preprocessor::clearIncludeGuards()
+{
+    includeGuards.clear();
+}
+
 Preprocessor::Preprocessor()
 :   m_macroTable(0),
     m_expressionParser(0),
-    m_bInlineFileMode(false)
+    m_bInlineFileMode(false),
+    m_bResultCacheable(true)
 {
     m_rexPreprocessingDirective.setPattern(QLatin1String("^!\\s*(\\S+)(.*)"));
 }
@@ -60,6 +210,12 @@ bool Preprocessor::openFile(const QString& fileName)
     m_conditionalStack.clear();
     if (!m_fileStack.isEmpty())
         m_fileStack.clear();
+    m_openedFiles.clear();
+    m_openedFileSet.clear();
+    m_missingFiles.clear();
+    m_includeFileLookups.clear();
+    m_messages.clear();
+    m_bResultCacheable = true;
 
     return internalOpenFile(fileName);
 }
@@ -80,12 +236,30 @@ bool Preprocessor::internalOpenFile(QString fileName)
         if (tf.reader->fileName() == fileName)
             error(QLatin1String("cycle in include files: ") + fileInfo.fileName());
 
+    // Files that are included again are checked for an include guard.
+    // If the guard macro is still defined, all lines of the file would be skipped anyway.
+    const bool alreadyOpened = m_openedFileSet.contains(fileName);
+    if (alreadyOpened || includeGuards.contains(fileName)) {
+        const QString guardMacro = includeGuardMacro(fileInfo);
+        if (!guardMacro.isEmpty() && m_macroTable->isMacroDefined(guardMacro)) {
+            if (!alreadyOpened) {
+                m_openedFiles.append(fileName);
+                m_openedFileSet.insert(fileName);
+            }
+            return true;
+        }
+    }
+
     MakefileLineReader* reader = new MakefileLineReader(fileName);
     if (!reader->open()) {
         delete reader;
         error(QLatin1Literal("Can't open ") + origFileName);
     }
 
+    if (!alreadyOpened) {
+        m_openedFiles.append(fileName);
+        m_openedFileSet.insert(fileName);
+    }
     m_fileStack.push(TextFile());
     TextFile& textFile = m_fileStack.top();
     textFile.reader = reader;
@@ -136,7 +310,10 @@ QString Preprocessor::currentFileName() const
     return m_fileStack.top().reader->fileName();
 }
 
-MakefileLine Preprocessor::basicReadLine()
+/**
+ * Reads the next line. If directivesOnly is true, lines that don't start with '!' are skipped.
+ */
+MakefileLine Preprocessor::basicReadLine(bool directivesOnly)
 {
     if (!m_linesPutBack.isEmpty())
         return { m_linesPutBack.takeFirst() };
@@ -144,15 +321,17 @@ MakefileLine Preprocessor::basicReadLine()
     if (m_fileStack.isEmpty())
         return {};
 
-    MakefileLine line = m_fileStack.top().reader->readLine(m_bInlineFileMode);
-    while (line.content.isNull()) {
-        delete m_fileStack.top().reader;
+    forever {
+        MakefileLineReader *reader = m_fileStack.top().reader;
+        MakefileLine line = directivesOnly ? reader->readDirectiveLine()
+                                           : reader->readLine(m_bInlineFileMode);
+        if (!line.content.isNull())
+            return line;
+        delete reader;
         m_fileStack.pop();
         if (m_fileStack.isEmpty())
-            break;
-        line = m_fileStack.top().reader->readLine(m_bInlineFileMode);
+            return line;
     }
-    return line;
 }
 
 static QString leftTrimmed(const QString &str)
@@ -256,6 +435,7 @@ bool Preprocessor::parsePreprocessingDirective(const QString& line)
     } else if (directive == QLatin1String("ERROR")) {
         error(QLatin1Literal("ERROR: ") + value);
     } else if (directive == QLatin1String("MESSAGE")) {
+        m_messages.append(value);
         puts(qPrintable(value));
     } else if (directive == QLatin1String("INCLUDE")) {
         internalOpenFile(findIncludeFile(value));
@@ -332,34 +512,69 @@ QString Preprocessor::findIncludeFile(const QString &filePathToInclude)
     }
     removeDoubleQuotes(filePath);
 
-    QFileInfo fi(filePath);
-    if (fi.exists())
-        return fi.absoluteFilePath();
+    QString includeVar;
+    if (angleBrackets) {
+        includeVar = m_macroTable->macroValue(QLatin1String("INCLUDE"))
+                .replace(QLatin1Char('\t'), QLatin1Char(' '));
+    }
 
-    // Search recursively through all directories of all parent makefiles.
+    QString lookupKey = FastFileInfo::currentDirectory() + QLatin1Char('\n') + filePathToInclude;
     for (QStack<TextFile>::const_iterator it = m_fileStack.constEnd();
          it != m_fileStack.constBegin();) {
         --it;
-        fi.setFile(it->fileDirectory + QLatin1Char('/') + filePath);
-        if (fi.exists())
-            return fi.absoluteFilePath();
+        lookupKey += QLatin1Char('\n') + it->fileDirectory;
+    }
+    if (angleBrackets)
+        lookupKey += QLatin1Char('\n') + includeVar;
+
+    // A file that has been found before might have been deleted in the meantime.
+    QHash<QString, IncludeFileLookup>::const_iterator cit = m_includeFileLookups.constFind(lookupKey);
+    if (cit != m_includeFileLookups.constEnd() && FastFileInfo(cit->filePath).exists()) {
+        m_missingFiles += cit->missingFiles;
+        return cit->filePath;
     }
 
-    if (angleBrackets) {
+    IncludeFileLookup lookup;
+    QFileInfo fi(filePath);
+    if (fi.exists()) {
+        lookup.filePath = fi.absoluteFilePath();
+    } else {
+        lookup.missingFiles.append(fi.absoluteFilePath());
+
+        // Search recursively through all directories of all parent makefiles.
+        for (QStack<TextFile>::const_iterator it = m_fileStack.constEnd();
+             it != m_fileStack.constBegin();) {
+            --it;
+            fi.setFile(it->fileDirectory + QLatin1Char('/') + filePath);
+            if (fi.exists()) {
+                lookup.filePath = fi.absoluteFilePath();
+                break;
+            }
+            lookup.missingFiles.append(fi.absoluteFilePath());
+        }
+    }
+
+    if (lookup.filePath.isEmpty() && angleBrackets) {
         // Search through all directories in the INCLUDE macro.
-        const QString includeVar = m_macroTable->macroValue(QLatin1String("INCLUDE"))
-                .replace(QLatin1Char('\t'), QLatin1Char(' '));
         const QStringList includeDirs = includeVar.split(QLatin1Char(';'), QString::SkipEmptyParts);
         foreach (const QString& includeDir, includeDirs) {
             fi.setFile(includeDir + QLatin1Char('/') + filePath);
-            if (fi.exists())
-                return fi.absoluteFilePath();
+            if (fi.exists()) {
+                lookup.filePath = fi.absoluteFilePath();
+                break;
+            }
+            lookup.missingFiles.append(fi.absoluteFilePath());
         }
     }
 
-    const QString msg = QLatin1String("File %1 cannot be found.");
-    error(msg.arg(filePathToInclude));
-    return QString();
+    m_missingFiles += lookup.missingFiles;
+    if (lookup.filePath.isEmpty()) {
+        const QString msg = QLatin1String("File %1 cannot be found.");
+        error(msg.arg(filePathToInclude));
+    }
+
+    m_includeFileLookups.insert(lookupKey, lookup);
+    return lookup.filePath;
 }
 
 bool Preprocessor::isPreprocessingDirective(const QString& line, QString& directive, QString& value)
@@ -400,41 +615,29 @@ bool Preprocessor::isPreprocessingDirective(const QString& line, QString& direct
     return result;
 }
 
+/**
+ * Skips the lines of an inactive conditional block.
+ * The conditional directives are recognized lexically. Macros in skipped lines are not
+ * expanded, and lines that aren't directives aren't even converted to QString.
+ */
 void Preprocessor::skipUntilNextMatchingConditional()
 {
     uint depth = 0;
-    MakefileLine line;
-    QString directive, value;
-
-    enum DirectiveToken { TOK_IF, TOK_ENDIF, TOK_ELSE, TOK_UNINTERESTING };
-    DirectiveToken token;
-    do {
-        line = basicReadLine();
+    forever {
+        MakefileLine line = basicReadLine(true);
         if (line.content.isNull())
             return;
-
-        if (line.content.startsWith(QLatin1Char('!')))
-            completePreprocessingDirectiveLine(line);
-
-        QString expandedLine = m_macroTable->expandMacros(line.content);
-        if (!isPreprocessingDirective(expandedLine, directive, value))
+        if (!line.content.startsWith(QLatin1Char('!')))
             continue;
 
-        if (directive == QLatin1String("ENDIF"))
-            token = TOK_ENDIF;
-        else if (directive.startsWith(QLatin1String("IF")))
-            token = TOK_IF;
-        else if (directive.startsWith(QLatin1String("ELSE")))
-            token = TOK_ELSE;
-        else
-            token = TOK_UNINTERESTING;
-
+        completePreprocessingDirectiveLine(line);
+        const ConditionalDirectiveToken token = conditionalDirectiveToken(line.content);
         if (token == TOK_UNINTERESTING)
             continue;
 
         if (depth == 0) {
             if (token == TOK_ELSE) {
-                m_linesPutBack.append(expandedLine);
+                m_linesPutBack.append(line.content);
                 return;  // found the next matching ELSE
             }
             if (token == TOK_ENDIF) {
@@ -447,8 +650,7 @@ void Preprocessor::skipUntilNextMatchingConditional()
             --depth;
         else if (token == TOK_IF)
             ++depth;
-
-    } while (!line.content.isNull());
+    }
 }
 
 void Preprocessor::enterConditional(bool followElseBranch)
@@ -470,7 +672,20 @@ int Preprocessor::evaluateExpression(const QString& expr)
         m_expressionParser->setMacroTable(m_macroTable);
     }
 
-    if (!m_expressionParser->parse(qPrintable(m_macroTable->expandMacros(expr)))) {
+    const QString expandedExpr = m_macroTable->expandMacros(expr);
+
+    // The results of EXIST() and of [shell commands] depend on more than the makefiles.
+    if (expandedExpr.contains(QLatin1Char('['))
+        || expandedExpr.contains(QLatin1String("EXIST"), Qt::CaseInsensitive))
+    {
+        m_bResultCacheable = false;
+    }
+
+    // Shell commands might create files that would be found by later include file lookups.
+    if (expandedExpr.contains(QLatin1Char('[')))
+        m_includeFileLookups.clear();
+
+    if (!m_expressionParser->parse(qPrintable(expandedExpr))) {
         QString msg = QLatin1String("Can't evaluate preprocessor expression.");
         msg += QLatin1String("\nerror: ");
         msg += QString::fromLatin1(m_expressionParser->errorMessage());
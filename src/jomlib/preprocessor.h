@@ -28,7 +28,9 @@
 
 #include "makefilelinereader.h"
 
+#include <QHash>
 #include <QRegExp>
+#include <QSet>
 #include <QStack>
 #include <QStringList>
 
@@ -56,10 +58,16 @@ public:
     void setInlineFileModeEnabled(bool enabled) { m_bInlineFileMode = enabled; }
 
     static void removeInlineComments(QString& line);
+    static void clearIncludeGuards();
+
+    const QStringList &openedFiles() const { return m_openedFiles; }
+    const QStringList &missingFiles() const { return m_missingFiles; }
+    const QStringList &messages() const { return m_messages; }
+    bool isResultCacheable() const { return m_bResultCacheable; }
 
 private:
     bool internalOpenFile(QString fileName);
-    MakefileLine basicReadLine();
+    MakefileLine basicReadLine(bool directivesOnly = false);
     typedef void (*JoinFunc)(MakefileLine &, const MakefileLine &);
     static void joinLines(MakefileLine &line, const MakefileLine &next);
     static void joinPreprocessingDirectiveLines(MakefileLine &line, const MakefileLine &next);
@@ -98,6 +106,12 @@ private:
         }
     };
 
+    struct IncludeFileLookup
+    {
+        QString filePath;
+        QStringList missingFiles;
+    };
+
     QStack<TextFile>    m_fileStack;
     MacroTable*         m_macroTable;
     QRegExp             m_rexPreprocessingDirective;
@@ -105,6 +119,15 @@ private:
     PPExprParser*       m_expressionParser;
     QStringList         m_linesPutBack;
     bool                m_bInlineFileMode;
+    QStringList         m_openedFiles;
+    QSet<QString>       m_openedFileSet;
+    QStringList         m_missingFiles;
+    QStringList         m_messages;
+    bool                m_bResultCacheable;
+
+    // Results of findIncludeFile of the current parse, keyed by the include argument and
+    // everything the search depends on.
+    QHash<QString, IncludeFileLookup> m_includeFileLookups;
 };
 
 } //namespace NMakeFile
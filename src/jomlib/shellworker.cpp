@@ -0,0 +1,310 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "shellworker.h"
+#include "helperfunctions.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QRegExp>
+#include <QtCore/QUuid>
+
+namespace NMakeFile {
+
+ShellWorker::ShellWorker(QObject *parent)
+    : QObject(parent)
+    , m_sentinel("jom-shell-" + QUuid::createUuid().toRfc4122().toHex())
+    , m_exitCode(0)
+    , m_isStartingUp(false)
+    , m_isBusy(false)
+    , m_isRestartRequired(false)
+{
+    m_stdout.state = Channel::Done;
+    m_stderr.state = Channel::Done;
+    connect(&m_shell, SIGNAL(readyReadStandardOutput()), SLOT(onReadyReadStandardOutput()));
+    connect(&m_shell, SIGNAL(readyReadStandardError()), SLOT(onReadyReadStandardError()));
+    connect(&m_shell, SIGNAL(finished(int, QProcess::ExitStatus)),
+            SLOT(onShellFinished(int, QProcess::ExitStatus)));
+}
+
+ShellWorker::~ShellWorker()
+{
+    m_isBusy = false;
+    stopShell();
+}
+
+/**
+ * Returns true, if the command line can be passed to the shell's standard input.
+ */
+bool ShellWorker::canExecute(const QString &commandLine, const QString &workingDirectory)
+{
+    // The shell reads 8 bit text. Only pass ASCII to be independent of the console code page.
+    foreach (const QChar &ch, workingDirectory) {
+        if (ch.unicode() < 0x20 || ch.unicode() > 0x7e || ch == QLatin1Char('%'))
+            return false;
+    }
+
+    // The command is put into a parenthesized block to redirect its input.
+    // Parentheses in the command could end the block. Labels are not allowed in blocks.
+    // A trailing caret would continue the command on the line that closes the block.
+    // With "echo on" the shell would print its prompt and the commands that follow.
+    static QRegExp rexEchoOn(QLatin1String("\\becho\\s+on\\b"), Qt::CaseInsensitive);
+    if (trimLeft(commandLine).startsWith(QLatin1Char(':'))
+            || commandLine.trimmed().endsWith(QLatin1Char('^'))
+            || rexEchoOn.indexIn(commandLine) >= 0)
+    {
+        return false;
+    }
+    bool inQuotes = false;
+    foreach (const QChar &ch, commandLine) {
+        if ((ch.unicode() < 0x20 && ch != QLatin1Char('\t')) || ch.unicode() > 0x7e)
+            return false;
+        if (ch == QLatin1Char('"'))
+            inQuotes = !inQuotes;
+        else if (!inQuotes && (ch == QLatin1Char('(') || ch == QLatin1Char(')')))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Passes the command line to the shell, and starts the shell if needed.
+ * Returns false, if the shell cannot be started.
+ */
+bool ShellWorker::start(const QString &commandLine, const QString &workingDirectory,
+                        const ProcessEnvironment &environment)
+{
+    if (m_shell.state() != QProcess::Running || m_isRestartRequired
+            || environment != m_environment)
+    {
+        stopShell();
+        if (!startShell(environment))
+            return false;
+    }
+
+    m_commandLine = commandLine;
+    m_workingDirectory = workingDirectory;
+    m_isBusy = true;
+    if (!m_isStartingUp)
+        writeCommand();
+    return true;
+}
+
+static QProcessEnvironment toProcessEnvironment(const ProcessEnvironment &environment)
+{
+    const QProcessEnvironment systemEnvironment = QProcessEnvironment::systemEnvironment();
+    if (environment.isEmpty())
+        return systemEnvironment;
+
+    QProcessEnvironment result;
+    ProcessEnvironment::const_iterator it = environment.constBegin();
+    for (; it != environment.constEnd(); ++it)
+        result.insert(it.key().toQString(), it.value());
+
+    // Process adds these for loading DLLs, too.
+    static const char *inheritedVariables[] = { "PATH", "SystemRoot" };
+    for (size_t i = 0; i < sizeof(inheritedVariables) / sizeof(inheritedVariables[0]); ++i) {
+        const QString name = QLatin1String(inheritedVariables[i]);
+        if (!result.contains(name) && systemEnvironment.contains(name))
+            result.insert(name, systemEnvironment.value(name));
+    }
+    return result;
+}
+
+bool ShellWorker::startShell(const ProcessEnvironment &environment)
+{
+    QString shellCmd = qGetEnvironmentVariable(L"ComSpec");
+    if (shellCmd.isEmpty())
+        shellCmd = QLatin1String("cmd.exe");
+
+    m_shell.setProcessEnvironment(toProcessEnvironment(environment));
+    m_shell.start(shellCmd, QStringList() << QLatin1String("/Q"));
+    if (!m_shell.waitForStarted())
+        return false;
+
+    m_environment = environment;
+    m_isStartingUp = true;
+    m_isRestartRequired = false;
+    m_stdout.state = Channel::Output;
+    m_stdout.buffer.clear();
+    m_stderr.state = Channel::Output;
+    m_stderr.buffer.clear();
+
+    // Skip the logo, and remember the environment the shell started with.
+    m_shell.write("echo " + m_sentinel + " 0& echo " + m_sentinel + " 1>&2\r\n"
+                  "set & echo " + m_sentinel + "\r\n");
+    return true;
+}
+
+void ShellWorker::stopShell()
+{
+    if (m_shell.state() == QProcess::NotRunning)
+        return;
+
+    // The shell exits at the end of its input.
+    m_shell.closeWriteChannel();
+    if (!m_shell.waitForFinished(1000)) {
+        m_shell.kill();
+        m_shell.waitForFinished();
+    }
+}
+
+void ShellWorker::writeCommand()
+{
+    // "(call )" resets ERRORLEVEL. The command gets NUL as input, because it would
+    // read the lines that follow it from the shell's input otherwise.
+    QByteArray lines = "cd /d \"";
+    lines += QDir::toNativeSeparators(m_workingDirectory).toLatin1();
+    lines += "\"\r\n(call )\r\n(\r\n";
+    lines += m_commandLine.toLatin1();
+    lines += "\r\n) <NUL\r\n";
+    lines += "echo " + m_sentinel + " %ERRORLEVEL%& echo " + m_sentinel + " 1>&2\r\n";
+    lines += "set & echo " + m_sentinel + "\r\n";
+
+    m_stdout.state = Channel::Output;
+    m_stderr.state = Channel::Output;
+    m_shell.write(lines);
+}
+
+void ShellWorker::onReadyReadStandardOutput()
+{
+    m_stdout.buffer += m_shell.readAllStandardOutput();
+    parseChannel(m_stdout, Channel::ExitCode);
+}
+
+void ShellWorker::onReadyReadStandardError()
+{
+    m_stderr.buffer += m_shell.readAllStandardError();
+    parseChannel(m_stderr, Channel::LineEnd);
+}
+
+void ShellWorker::parseChannel(Channel &channel, Channel::State stateAfterSentinel)
+{
+    forever {
+        switch (channel.state) {
+        case Channel::Output:
+        {
+            const int idx = channel.buffer.indexOf(m_sentinel);
+            if (idx < 0) {
+                // Keep what might be the start of the sentinel.
+                writeOutput(channel, channel.buffer.length() - m_sentinel.length() + 1);
+                return;
+            }
+            writeOutput(channel, idx);
+            channel.buffer.remove(0, m_sentinel.length());
+            channel.state = stateAfterSentinel;
+            break;
+        }
+        case Channel::ExitCode:
+        {
+            const int idx = channel.buffer.indexOf('\n');
+            if (idx < 0)
+                return;
+            m_exitCode = channel.buffer.left(idx).trimmed().toInt();
+            channel.buffer.remove(0, idx + 1);
+            channel.state = Channel::Environment;
+            break;
+        }
+        case Channel::Environment:
+        {
+            const int idx = channel.buffer.indexOf(m_sentinel);
+            if (idx < 0)
+                return;
+            m_environmentDump = channel.buffer.left(idx);
+            channel.buffer.remove(0, idx + m_sentinel.length());
+            channel.state = Channel::LineEnd;
+            break;
+        }
+        case Channel::LineEnd:
+        {
+            const int idx = channel.buffer.indexOf('\n');
+            if (idx < 0)
+                return;
+            channel.buffer.remove(0, idx + 1);
+            channel.state = Channel::Done;
+            onSentinelsRead();
+            return;
+        }
+        case Channel::Done:
+            return;
+        }
+    }
+}
+
+void ShellWorker::writeOutput(Channel &channel, int count)
+{
+    if (count <= 0)
+        return;
+    const QByteArray data = channel.buffer.left(count);
+    channel.buffer.remove(0, count);
+    if (m_isStartingUp)
+        return;
+    if (&channel == &m_stdout)
+        emit standardOutputReady(data);
+    else
+        emit standardErrorReady(data);
+}
+
+void ShellWorker::onSentinelsRead()
+{
+    if (m_stdout.state != Channel::Done || m_stderr.state != Channel::Done)
+        return;
+
+    if (m_isStartingUp) {
+        m_isStartingUp = false;
+        m_initialEnvironmentDump = m_environmentDump;
+        if (m_isBusy)
+            writeCommand();
+        return;
+    }
+
+    // Commands like "set" and "path" must not affect the following commands.
+    if (m_environmentDump != m_initialEnvironmentDump)
+        m_isRestartRequired = true;
+
+    m_isBusy = false;
+    emit finished(m_exitCode);
+}
+
+void ShellWorker::onShellFinished(int exitCode, QProcess::ExitStatus exitStatus)
+{
+    if (!m_isBusy)
+        return;
+
+    // The command ended the shell, e.g. with "exit".
+    onReadyReadStandardOutput();
+    onReadyReadStandardError();
+    if (!m_isBusy)
+        return;
+    if (m_stdout.state == Channel::Output)
+        writeOutput(m_stdout, m_stdout.buffer.length());
+    if (m_stderr.state == Channel::Output)
+        writeOutput(m_stderr, m_stderr.buffer.length());
+
+    m_isBusy = false;
+    m_isRestartRequired = true;
+    emit finished(exitStatus == QProcess::CrashExit ? 2 : exitCode);
+}
+
+} // namespace NMakeFile
@@ -0,0 +1,103 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef SHELLWORKER_H
+#define SHELLWORKER_H
+
+#include "processenvironment.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QObject>
+#include <QtCore/QProcess>
+
+namespace NMakeFile {
+
+/**
+ * A command shell that keeps running between commands.
+ *
+ * Command lines are written to the shell's standard input.
+ * Each command is followed by lines that print a sentinel with the exit code
+ * to stdout and stderr, and the shell's environment to stdout.
+ * The output before the sentinels belongs to the command.
+ *
+ * The working directory is set before every command.
+ * The shell is restarted if the command changed its environment,
+ * or if it must run with a different environment.
+ */
+class ShellWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ShellWorker(QObject *parent = 0);
+    ~ShellWorker();
+
+    static bool canExecute(const QString &commandLine, const QString &workingDirectory);
+    bool start(const QString &commandLine, const QString &workingDirectory,
+               const ProcessEnvironment &environment);
+    bool isBusy() const { return m_isBusy; }
+
+signals:
+    void standardOutputReady(const QByteArray &data);
+    void standardErrorReady(const QByteArray &data);
+    void finished(int exitCode);
+
+private slots:
+    void onReadyReadStandardOutput();
+    void onReadyReadStandardError();
+    void onShellFinished(int exitCode, QProcess::ExitStatus exitStatus);
+
+private:
+    struct Channel
+    {
+        enum State { Output, ExitCode, Environment, LineEnd, Done };
+        State state;
+        QByteArray buffer;
+    };
+
+    bool startShell(const ProcessEnvironment &environment);
+    void stopShell();
+    void writeCommand();
+    void parseChannel(Channel &channel, Channel::State stateAfterSentinel);
+    void writeOutput(Channel &channel, int count);
+    void onSentinelsRead();
+
+    QProcess m_shell;
+    QByteArray m_sentinel;
+    ProcessEnvironment m_environment;
+    QByteArray m_environmentDump;
+    QByteArray m_initialEnvironmentDump;
+    Channel m_stdout;
+    Channel m_stderr;
+    QString m_commandLine;
+    QString m_workingDirectory;
+    int m_exitCode;
+    bool m_isStartingUp;
+    bool m_isBusy;
+    bool m_isRestartRequired;
+};
+
+} // namespace NMakeFile
+
+#endif // SHELLWORKER_H
@@ -24,23 +24,40 @@
 ****************************************************************************/
 
 #include "targetexecutor.h"
+#include "buildhistory.h"
 #include "commandexecutor.h"
+#include "contenthashes.h"
 #include "dependencygraph.h"
+#include "depslog.h"
 #include "jobclient.h"
 #include "options.h"
 #include "exception.h"
+#include "fastfileinfo.h"
 
 #include <QDebug>
 #include <QTextStream>
 #include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
 
 namespace NMakeFile {
 
-TargetExecutor::TargetExecutor(const ProcessEnvironment &environment)
+// Milliseconds without further changes before /WATCH builds again.
+static const int watchDelay = 300;
+
+TargetExecutor::TargetExecutor(const ProcessEnvironment &environment, bool unbufferedOutput)
     : m_environment(environment)
+    , m_workingDirectory(FastFileInfo::currentDirectory())
     , m_jobClient(0)
     , m_bAborted(false)
     , m_allCommandsSuccessfullyExecuted(true)
+    , m_buildHistory(0)
+    , m_contentHashes(0)
+    , m_depsLog(0)
+    , m_virtualRoot(0)
+    , m_fileSystemWatcher(0)
+    , m_isWatching(false)
 {
     m_makefile = 0;
     m_depgraph = new DependencyGraph();
@@ -59,16 +76,25 @@ TargetExecutor::TargetExecutor(const ProcessEnvironment &environment)
         m_processes.append(executor);
     }
     m_availableProcesses = m_processes;
-    m_availableProcesses.first()->setBufferedOutput(false);
+
+    // A sub-make that is built in-process must not write directly to the console while
+    // the output of its parent command is buffered.
+    if (unbufferedOutput)
+        m_availableProcesses.first()->setBufferedOutput(false);
 }
 
 TargetExecutor::~TargetExecutor()
 {
     delete m_depgraph;
+    delete m_buildHistory;
+    delete m_contentHashes;
+    delete m_depsLog;
+    delete m_virtualRoot;
 }
 
 void TargetExecutor::apply(Makefile* mkfile, const QStringList& targets)
 {
+    FastFileInfo::setCurrentDirectory(m_workingDirectory);
     m_bAborted = false;
     m_allCommandsSuccessfullyExecuted = true;
     m_makefile = mkfile;
@@ -82,6 +108,8 @@ void TargetExecutor::apply(Makefile* mkfile, const QStringList& targets)
             throw Exception(msg.arg(m_jobClient->errorString()));
         }
         connect(m_jobClient, &JobClient::acquired, this, &TargetExecutor::buildNextTarget);
+        connect(m_jobClient, &JobClient::acquisitionFailed,
+                this, &TargetExecutor::onJobAcquisitionFailed);
     }
 
     DescriptionBlock* descblock;
@@ -91,6 +119,20 @@ void TargetExecutor::apply(Makefile* mkfile, const QStringList& targets)
             return;
         }
         descblock = mkfile->firstTarget();
+    } else if (targets.count() > 1 && mkfile->options()->combineCommandLineTargets) {
+        foreach (const QString &targetName, targets) {
+            if (!mkfile->target(targetName)) {
+                QString msg = QLatin1String("Target %1 does not exist in %2.");
+                throw Exception(msg.arg(targetName, mkfile->fileName()));
+            }
+        }
+
+        // Build all targets in one dependency graph below a root without commands.
+        delete m_virtualRoot;
+        m_virtualRoot = new DescriptionBlock(mkfile);
+        m_virtualRoot->setTargetName(QLatin1String("<command line targets>"));
+        m_virtualRoot->m_dependents = targets;
+        descblock = m_virtualRoot;
     } else {
         const QString targetName = targets.first();
         descblock = mkfile->target(targetName);
@@ -103,7 +145,42 @@ void TargetExecutor::apply(Makefile* mkfile, const QStringList& targets)
         }
     }
 
-    m_depgraph->build(descblock);
+    if ((mkfile->options()->criticalPathScheduling || !mkfile->restatTargets().isEmpty())
+            && !m_buildHistory)
+    {
+        m_buildHistory = new BuildHistory(QFileInfo(mkfile->fileName()).absoluteFilePath()
+                                          + QLatin1String(".jomlog"));
+        m_buildHistory->load();
+
+        // The order is applied for /J1 as well. It's predictable then, but doesn't save time.
+        if (mkfile->options()->criticalPathScheduling)
+            m_depgraph->setBuildHistory(m_buildHistory);
+        m_depgraph->setRestatHistory(m_buildHistory);
+    }
+    if (mkfile->options()->useContentHashes && !m_contentHashes) {
+        m_contentHashes = new ContentHashes(QFileInfo(mkfile->fileName()).absoluteFilePath()
+                                            + QLatin1String(".jomhashes"));
+        m_contentHashes->load();
+        m_depgraph->setContentHashes(m_contentHashes);
+    }
+    if (!mkfile->depFileTargets().isEmpty() && !m_depsLog) {
+        m_depsLog = new DepsLog(QFileInfo(mkfile->fileName()).absoluteFilePath()
+                                + QLatin1String(".jomdeps"));
+        m_depsLog->load();
+        m_depgraph->setDepsLog(m_depsLog);
+    }
+    if (mkfile->options()->watchForChanges && !m_fileSystemWatcher) {
+        m_fileSystemWatcher = new QFileSystemWatcher(this);
+        connect(m_fileSystemWatcher, &QFileSystemWatcher::fileChanged,
+                this, &TargetExecutor::onWatchedFileChanged);
+        m_watchTimer.setSingleShot(true);
+        m_watchTimer.setInterval(watchDelay);
+        connect(&m_watchTimer, &QTimer::timeout, this, &TargetExecutor::rebuildChangedTargets);
+        m_rootTargets = QList<DescriptionBlock*>() << descblock << m_pendingTargets;
+    }
+    m_buildTimer.start();
+
+    buildDependencyGraph(descblock);
     if (m_makefile->options()->dumpDependencyGraph) {
         if (m_makefile->options()->dumpDependencyGraphDot)
             m_depgraph->dotDump();
@@ -121,6 +198,7 @@ void TargetExecutor::startProcesses()
     if (m_bAborted || m_jobClient->isAcquiring() || m_availableProcesses.isEmpty())
         return;
 
+    FastFileInfo::setCurrentDirectory(m_workingDirectory);
     try {
         if (!m_nextTarget)
             findNextTarget();
@@ -131,17 +209,30 @@ void TargetExecutor::startProcesses()
                 buildNextTarget();
             } else {
                 // Acquire a job token from the server. Will call buildNextTarget() when done.
+                // Further tokens that are available right away are kept for the next targets.
                 m_jobAcquisitionCount++;
-                m_jobClient->asyncAcquire();
+                m_jobClient->asyncAcquire(m_availableProcesses.count());
             }
         } else {
+            m_jobClient->releaseSpareTokens();
             if (numberOfRunningProcesses() == 0) {
+                if (!m_depgraph->isEmpty())
+                    throw Exception(QLatin1String("Some targets have not been built."));
                 if (m_pendingTargets.isEmpty()) {
                     finishBuild(0);
                 } else {
                     m_depgraph->clear();
                     m_makefile->invalidateTimeStamps();
-                    m_depgraph->build(m_pendingTargets.takeFirst());
+                    try {
+                        buildDependencyGraph(m_pendingTargets.takeFirst());
+                    } catch (const Exception &e) {
+                        // Like for the first target, e.g. a dependent that doesn't exist.
+                        m_bAborted = true;
+                        fprintf(stderr, "Error: %s
+", qPrintable(e.message()));
+                        finishBuild(2);
+                        return;
+                    }
                     QMetaObject::invokeMethod(this, "startProcesses", Qt::QueuedConnection);
                 }
             }
@@ -160,8 +251,15 @@ void TargetExecutor::buildNextTarget()
     if (m_bAborted)
         return;
 
+    FastFileInfo::setCurrentDirectory(m_workingDirectory);
     try {
         CommandExecutor *executor = m_availableProcesses.takeFirst();
+        if (m_buildHistory)
+            m_commandStartTimes.insert(executor, m_buildTimer.elapsed());
+        if (m_buildHistory && !m_makefile->options()->dryRun
+                && m_nextTarget->makefile()->isRestatTarget(m_nextTarget->targetName())) {
+            saveRestatState(m_nextTarget);
+        }
         executor->start(m_nextTarget);
         m_nextTarget = 0;
         QMetaObject::invokeMethod(this, "startProcesses", Qt::QueuedConnection);
@@ -172,6 +270,22 @@ void TargetExecutor::buildNextTarget()
     }
 }
 
+void TargetExecutor::onJobAcquisitionFailed()
+{
+    // There's no token to release for this acquisition.
+    m_jobAcquisitionCount--;
+    if (m_bAborted)
+        return;
+
+    m_bAborted = true;
+    fprintf(stderr, "Error: %s\n", qPrintable(m_jobClient->errorString()));
+    m_depgraph->clear();
+    m_pendingTargets.clear();
+    waitForProcesses();
+    m_jobClient->releaseSpareTokens();
+    finishBuild(2);
+}
+
 void TargetExecutor::waitForProcesses()
 {
     foreach (CommandExecutor* process, m_processes)
@@ -180,12 +294,19 @@ void TargetExecutor::waitForProcesses()
 
 void TargetExecutor::waitForJobClient()
 {
+    m_jobClient->releaseSpareTokens();
     if (!m_jobClient->isAcquiring())
         return;
+    const int jobAcquisitionCount = m_jobAcquisitionCount;
     QEventLoop loop;
     connect(m_jobClient, &JobClient::acquired, &loop, &QEventLoop::quit);
+    connect(m_jobClient, &JobClient::acquisitionFailed, &loop, &QEventLoop::quit);
     loop.exec();
-    m_jobClient->release();
+
+    // onJobAcquisitionFailed has taken back the acquisition if there's no token.
+    if (m_jobAcquisitionCount == jobAcquisitionCount)
+        m_jobClient->release();
+    m_jobClient->releaseSpareTokens();
 }
 
 void TargetExecutor::finishBuild(int exitCode)
@@ -197,9 +318,93 @@ void TargetExecutor::finishBuild(int exitCode)
         // /k specified and some command failed
         exitCode = 1;
     }
+    if (m_buildHistory && !m_buildHistory->save()) {
+        fprintf(stderr, "jom: Cannot write %s.\n",
+                qPrintable(QDir::toNativeSeparators(m_buildHistory->fileName())));
+    }
+    if (m_contentHashes && !m_contentHashes->save()) {
+        fprintf(stderr, "jom: Cannot write %s.\n",
+                qPrintable(QDir::toNativeSeparators(m_contentHashes->fileName())));
+    }
+    if (m_fileSystemWatcher) {
+        // Depfiles might have added dependents during the build.
+        watchFileDependents();
+        if (!m_watchedFiles.isEmpty()) {
+            printf("jom: Watching %d files for changes.\n", m_watchedFiles.count());
+            fflush(stdout);
+            m_isWatching = true;
+            if (!m_changedFiles.isEmpty())
+                m_watchTimer.start();
+            return;
+        }
+    }
     emit finished(exitCode);
 }
 
+void TargetExecutor::buildDependencyGraph(DescriptionBlock *target)
+{
+    m_depgraph->build(target);
+    if (m_fileSystemWatcher)
+        watchFileDependents();
+}
+
+/**
+ * Watches the dependents of the current graph that aren't built by the makefile.
+ */
+void TargetExecutor::watchFileDependents()
+{
+    QStringList fileNames;
+    foreach (const QString &fileName, m_depgraph->fileDependents()) {
+        if (!m_watchedFiles.contains(fileName)) {
+            m_watchedFiles.insert(fileName);
+            fileNames.append(fileName);
+        }
+    }
+    if (!fileNames.isEmpty())
+        m_fileSystemWatcher->addPaths(fileNames);
+}
+
+void TargetExecutor::onWatchedFileChanged(const QString &fileName)
+{
+    // Editors often replace the file, which removes it from the watcher anyway.
+    // It's watched again after building.
+    m_fileSystemWatcher->removePath(fileName);
+    m_watchedFiles.remove(fileName);
+    m_changedFiles.insert(fileName);
+
+    // Editors that save several files cause a burst of changes. Wait until it's over.
+    if (m_isWatching)
+        m_watchTimer.start();
+}
+
+/**
+ * Builds the command line targets again after files have changed.
+ * Only targets that are out of date because of the changes are rebuilt.
+ */
+void TargetExecutor::rebuildChangedTargets()
+{
+    m_isWatching = false;
+    FastFileInfo::setCurrentDirectory(m_workingDirectory);
+    foreach (const QString &fileName, m_changedFiles)
+        FastFileInfo::clearCacheForFile(fileName);
+    m_changedFiles.clear();
+
+    m_bAborted = false;
+    m_allCommandsSuccessfullyExecuted = true;
+    m_jobAcquisitionCount = 0;
+    m_nextTarget = 0;
+    m_pendingTargets = m_rootTargets.mid(1);
+    m_makefile->invalidateTimeStamps();
+    try {
+        buildDependencyGraph(m_rootTargets.first());
+    } catch (const Exception &e) {
+        fprintf(stderr, "Error: %s\n", qPrintable(e.message()));
+        finishBuild(2);
+        return;
+    }
+    QMetaObject::invokeMethod(this, "startProcesses", Qt::QueuedConnection);
+}
+
 void TargetExecutor::findNextTarget()
 {
     forever {
@@ -221,9 +426,104 @@ void TargetExecutor::findNextTarget()
     }
 }
 
+/**
+ * Remembers the time stamp and content hash of the target's file before its commands run.
+ */
+void TargetExecutor::saveRestatState(DescriptionBlock *target)
+{
+    RestatState state;
+    state.inputTime = FileTime::currentTime();
+    FastFileInfo fi(target->targetName());
+    if (!fi.exists()) {
+        m_buildHistory->removeRestatRecord(target->targetName());
+        return;
+    }
+
+    state.lastModified = fi.lastModified();
+    state.isHashValid = ContentHashes::hashFile(target->targetName(), &state.hash);
+
+    // The content might not have changed since an earlier build.
+    BuildHistory::RestatRecord record;
+    if (m_buildHistory->restatRecord(target->targetName(), &record)
+            && record.fileTime == state.lastModified) {
+        state.contentTime = record.contentTime;
+    } else {
+        state.contentTime = state.lastModified;
+    }
+    m_restatStates.insert(target, state);
+}
+
+/**
+ * Returns true if the commands of the target didn't modify its file,
+ * or rewrote it with the same content.
+ */
+bool TargetExecutor::isTargetFileUnchanged(DescriptionBlock *target)
+{
+    const RestatState state = m_restatStates.value(target);
+    FastFileInfo fi(target->targetName());
+    if (!fi.exists())
+        return false;
+    if (fi.lastModified() == state.lastModified)
+        return true;
+
+    quint64 hash;
+    return state.isHashValid && ContentHashes::hashFile(target->targetName(), &hash)
+            && hash == state.hash;
+}
+
+/**
+ * Records whether the commands of the .RESTAT target left its file unchanged.
+ * The file keeps its new time stamp. The record lets the next builds treat the target
+ * as up-to-date, and its parents compare against the time of the last content change.
+ */
+void TargetExecutor::recordRestatResult(DescriptionBlock *target)
+{
+    if (!isTargetFileUnchanged(target)) {
+        m_buildHistory->removeRestatRecord(target->targetName());
+        return;
+    }
+
+    const RestatState state = m_restatStates.value(target);
+    BuildHistory::RestatRecord record;
+    record.fileTime = FastFileInfo(target->targetName()).lastModified();
+    record.inputTime = state.inputTime;
+    record.contentTime = state.contentTime;
+    m_buildHistory->setRestatRecord(target->targetName(), record);
+
+    // Parents that are only out of date because of this target are removed
+    // from the graph when they become leaves.
+    target->m_bFileExists = true;
+    target->m_timeStamp = state.contentTime;
+}
+
+/**
+ * Reads the depfile the commands of the target wrote and records the dependents in the deps log.
+ * They are added to the dependency graph in the next build.
+ */
+void TargetExecutor::readDepFile(DescriptionBlock *target)
+{
+    const QString depFileName = target->makefile()->depFileName(target->targetName());
+    QStringList dependents;
+    if (depFileName.isEmpty() || !DepsLog::readDepFile(depFileName, &dependents))
+        return;
+
+    target->m_implicitDependents.clear();
+    foreach (const QString &dependent, dependents) {
+        if (!target->m_dependents.contains(dependent, Qt::CaseInsensitive)
+                && !target->m_implicitDependents.contains(dependent, Qt::CaseInsensitive)) {
+            target->m_implicitDependents.append(dependent);
+        }
+    }
+    if (!m_depsLog->recordDependents(target->targetName(), target->m_implicitDependents)) {
+        fprintf(stderr, "jom: Cannot write %s.\n",
+                qPrintable(QDir::toNativeSeparators(m_depsLog->fileName())));
+    }
+}
+
 void TargetExecutor::onChildFinished(CommandExecutor* executor, bool commandFailed)
 {
     Q_CHECK_PTR(executor->target());
+    FastFileInfo::setCurrentDirectory(m_workingDirectory);
     if (commandFailed) {
         m_allCommandsSuccessfullyExecuted = false;
         if (m_makefile->options()->buildUnrelatedTargetsOnError) {
@@ -233,7 +533,30 @@ void TargetExecutor::onChildFinished(CommandExecutor* executor, bool commandFail
             fputs("jom: Option /K specified. Continuing.\n", stderr);
         }
     }
+    const qint64 startTime = m_commandStartTimes.take(executor);
+    if (m_buildHistory && !commandFailed && !m_makefile->options()->dryRun
+            && !m_makefile->options()->changeTimeStampsButDoNotBuild) {
+        m_buildHistory->setDuration(executor->target()->targetName(),
+                                    m_buildTimer.elapsed() - startTime);
+    }
     FastFileInfo::clearCacheForFile(executor->target()->targetName());
+    if (m_restatStates.contains(executor->target())) {
+        if (commandFailed)
+            m_buildHistory->removeRestatRecord(executor->target()->targetName());
+        else
+            recordRestatResult(executor->target());
+        m_restatStates.remove(executor->target());
+    }
+    if (m_depsLog && !commandFailed && !m_makefile->options()->dryRun)
+        readDepFile(executor->target());
+    if (m_contentHashes && !commandFailed && !m_makefile->options()->dryRun
+            && !m_makefile->options()->changeTimeStampsButDoNotBuild) {
+        quint64 hash;
+        if (m_contentHashes->dependentsHash(executor->target()->m_dependents
+                                            + executor->target()->m_implicitDependents, &hash)) {
+            m_contentHashes->setTargetHash(executor->target()->targetName(), hash);
+        }
+    }
     m_depgraph->removeLeaf(executor->target());
     if (m_jobAcquisitionCount > 0) {
         m_jobClient->release();
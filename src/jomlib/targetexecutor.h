@@ -29,22 +29,30 @@
 #include "makefile.h"
 #include <QObject>
 #include <QEvent>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
 #include <QtCore/QMap>
+#include <QtCore/QSet>
+#include <QtCore/QTimer>
 
 QT_BEGIN_NAMESPACE
 class QFile;
+class QFileSystemWatcher;
 QT_END_NAMESPACE
 
 namespace NMakeFile {
 
+class BuildHistory;
 class CommandExecutor;
+class ContentHashes;
+class DepsLog;
 class DependencyGraph;
 class JobClient;
 
 class TargetExecutor : public QObject {
     Q_OBJECT
 public:
-    TargetExecutor(const ProcessEnvironment &environment);
+    TargetExecutor(const ProcessEnvironment &environment, bool unbufferedOutput = true);
     ~TargetExecutor();
 
     void apply(Makefile* mkfile, const QStringList& targets);
@@ -56,17 +64,27 @@ signals:
 private slots:
     void startProcesses();
     void buildNextTarget();
+    void onJobAcquisitionFailed();
     void onChildFinished(CommandExecutor*, bool commandFailed);
+    void onWatchedFileChanged(const QString &fileName);
+    void rebuildChangedTargets();
 
 private:
     int numberOfRunningProcesses() const;
     void waitForProcesses();
     void waitForJobClient();
     void finishBuild(int exitCode);
+    void buildDependencyGraph(DescriptionBlock *target);
+    void watchFileDependents();
     void findNextTarget();
+    void saveRestatState(DescriptionBlock *target);
+    bool isTargetFileUnchanged(DescriptionBlock *target);
+    void recordRestatResult(DescriptionBlock *target);
+    void readDepFile(DescriptionBlock *target);
 
 private:
     ProcessEnvironment m_environment;
+    QString m_workingDirectory;
     Makefile* m_makefile;
     DependencyGraph* m_depgraph;
     QList<DescriptionBlock*> m_pendingTargets;
@@ -76,7 +94,30 @@ private:
     QList<CommandExecutor*> m_availableProcesses;
     QList<CommandExecutor*> m_processes;
     DescriptionBlock *m_nextTarget;
+    DescriptionBlock *m_virtualRoot;
     bool m_allCommandsSuccessfullyExecuted;
+    BuildHistory *m_buildHistory;
+    ContentHashes *m_contentHashes;
+    DepsLog *m_depsLog;
+    QElapsedTimer m_buildTimer;
+    QHash<CommandExecutor*, qint64> m_commandStartTimes;
+
+    struct RestatState
+    {
+        FileTime lastModified;
+        FileTime inputTime;
+        FileTime contentTime;
+        quint64 hash;
+        bool isHashValid;
+    };
+    QHash<DescriptionBlock*, RestatState> m_restatStates;
+
+    QFileSystemWatcher *m_fileSystemWatcher;
+    QTimer m_watchTimer;
+    QSet<QString> m_watchedFiles;
+    QSet<QString> m_changedFiles;
+    QList<DescriptionBlock*> m_rootTargets;
+    bool m_isWatching;
 };
 
 } //namespace NMakeFile
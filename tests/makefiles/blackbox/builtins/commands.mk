@@ -0,0 +1,20 @@
+# Commands that jom runs without starting cmd must behave like cmd.
+first: clean
+	@md out
+	-@md out
+	@echo hello> out\a.txt
+	@echo world >> out\a.txt
+	@type out\a.txt
+	-@type out\missing.txt
+	@copy /Y out\a.txt out\b.txt
+	@if exist out\b.txt echo b exists
+	@if not exist out\sub\dir md out\sub\dir
+	@if not exist out\sub\dir echo not reached
+	@del out\a.txt
+	@del out\a.txt
+	@del /Q out\missing.txt 2>NUL
+	@echo %%CD%%> NUL
+	@echo done
+
+clean:
+	@if exist out rd /S /Q out
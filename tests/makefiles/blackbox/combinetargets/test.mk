@@ -0,0 +1,8 @@
+one: common
+	@echo one
+
+two: common
+	@echo two
+
+common:
+	@echo common
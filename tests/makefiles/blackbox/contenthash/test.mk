@@ -0,0 +1,11 @@
+all: out.txt
+
+clean:
+	@del in.txt out.txt test.mk.jomhashes > NUL 2>&1
+
+in.txt:
+	@echo in > $@
+
+out.txt: in.txt
+	@echo $@
+	@type in.txt > $@
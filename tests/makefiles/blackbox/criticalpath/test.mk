@@ -0,0 +1,11 @@
+all: short long
+	@echo all
+
+long: long_step
+	@echo long
+
+long_step:
+	@echo long_step
+
+short:
+	@echo short
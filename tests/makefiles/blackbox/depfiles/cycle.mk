@@ -0,0 +1,16 @@
+.DEPFILES: .out
+
+all: bar.out
+
+clean:
+	@del foo.out foo.d bar.out cycle.mk.jomdeps > NUL 2>&1
+
+bar.out: foo.out
+	@echo $@
+	@type foo.out > $@
+
+# The depfile closes a cycle foo.out -> bar.out -> foo.out.
+foo.out: foo.txt
+	@echo $@
+	@type foo.txt > $@
+	@echo foo.out: foo.txt bar.out> foo.d
@@ -0,0 +1,12 @@
+.DEPFILES: .out
+
+all: foo.out
+
+clean:
+	@del foo.out foo.d header.h test.mk.jomdeps > NUL 2>&1
+
+# Writes a depfile like gcc -MD would do.
+foo.out: foo.txt
+	@echo $@
+	@type foo.txt > $@
+	@echo foo.out: foo.txt header.h> foo.d
@@ -0,0 +1,8 @@
+all:
+	@echo sub
+
+other:
+	@echo other
+
+fail:
+	@exit 1
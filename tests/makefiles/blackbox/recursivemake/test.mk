@@ -0,0 +1,9 @@
+all:
+	@echo top
+	@cd sub && $(MAKE) /nologo /f test.mk
+	@$(MAKE) /nologo /f sub\test.mk other
+	@echo top again
+
+fail:
+	@cd sub && $(MAKE) /nologo /f test.mk fail
+	@echo not reached
@@ -0,0 +1,18 @@
+all: out.txt
+
+clean:
+	@del input.txt gen.txt out.txt test.mk.jomlog > NUL 2>&1
+
+# gen.txt is rewritten with the same content whenever input.txt changes.
+.RESTAT: gen.txt
+
+input.txt:
+	@echo input> $@
+
+gen.txt: input.txt
+	@echo $@
+	@echo generated> $@
+
+out.txt: gen.txt
+	@echo $@
+	@type gen.txt > $@
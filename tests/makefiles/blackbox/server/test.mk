@@ -0,0 +1,6 @@
+all:
+	@echo build $(VALUE)
+
+fail:
+	@echo failing
+	@exit 3
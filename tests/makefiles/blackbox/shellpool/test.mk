@@ -0,0 +1,15 @@
+# Commands that need a shell must behave like with a new shell per command.
+first:
+	@echo one| findstr one
+	@set JOM_SHELLPOOL_TEST=leaked& echo two
+	@echo %%JOM_SHELLPOOL_TEST%%| more
+	@cd .. & echo three
+	@cd & rem
+
+failure:
+	@dir missing.txt > NUL 2>&1 & rem
+	@echo not reached
+
+exit:
+	@exit 3 & rem
+	@echo not reached
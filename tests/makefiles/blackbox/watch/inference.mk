@@ -0,0 +1,8 @@
+all: source.obj
+
+clean:
+	@del source.c source.obj > NUL 2>&1
+
+.c.obj:
+	@echo $@
+	@type $< > $@
@@ -0,0 +1,8 @@
+all: out.txt
+
+clean:
+	@del input.txt out.txt > NUL 2>&1
+
+out.txt: input.txt
+	@echo $@
+	@type input.txt > $@
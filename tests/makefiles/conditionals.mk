@@ -93,5 +93,15 @@ boo \
 hoo
 !ENDIF
 
+# Macros in skipped blocks are not expanded.
+TEST11=true
+!IF 0
+TEST11=$(UNTERMINATED
+!if $(UNTERMINATED
+TEST11=false
+!endif
+TEST11=false
+!ENDIF
+
 all:
 
@@ -0,0 +1,7 @@
+# comment
+A=one\
+two
+
+B=three^\
+#B=wrong
+C=four
\ No newline at end of file
@@ -0,0 +1,5 @@
+!IFNDEF ELSE_INCLUDED
+ELSE_INCLUDED=1
+!ELSE
+ELSE_COUNT=$(ELSE_COUNT)x
+!ENDIF
@@ -0,0 +1,7 @@
+# This file is included more than once.
+!IFNDEF GUARDED_INCLUDED  # include guard
+GUARDED_INCLUDED=1
+GUARDED_COUNT=$(GUARDED_COUNT)x
+
+!ENDIF
+
@@ -0,0 +1,7 @@
+!include include_guarded.mk
+!include include_guarded.mk
+!include "include_guarded.mk"
+!include include_unguarded.mk
+!include include_unguarded.mk
+!include include_guard_else.mk
+!include include_guard_else.mk
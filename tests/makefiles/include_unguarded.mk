@@ -0,0 +1,4 @@
+!IFNDEF UNGUARDED_INCLUDED
+UNGUARDED_INCLUDED=1
+!ENDIF
+UNGUARDED_COUNT=$(UNGUARDED_COUNT)x
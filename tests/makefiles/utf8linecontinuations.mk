@@ -0,0 +1,6 @@
+﻿# UTF-8 with signature
+A=куда\
+я
+B=three^\
+#B=wrong
+C=fünf
\ No newline at end of file
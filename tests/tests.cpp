@@ -33,9 +33,16 @@
 #include <QTest>
 
 #include <ppexprparser.h>
+#include <buildhistory.h>
+#include <contenthashes.h>
+#include <depslog.h>
+#include <fastfileinfo.h>
+#include <jobserver.h>
+#include <jomprocess.h>
 #include <makefilefactory.h>
 #include <preprocessor.h>
 #include <parser.h>
+#include <pathtable.h>
 #include <options.h>
 #include <exception.h>
 
@@ -92,6 +99,63 @@ void Tests::includeFiles()
     QCOMPARE(macroTable.macroValue("INCLUDE9"), QLatin1String("TRUE"));
 }
 
+static bool writeFile(const QString &fileName, const QByteArray &content)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+    return file.write(content) == content.size();
+}
+
+void Tests::includeFileLookups()
+{
+    QVERIFY(QDir().mkpath("include_lookup_a"));
+    QVERIFY(QDir().mkpath("include_lookup_b"));
+    QVERIFY(writeFile("include_lookup_a/lookup.mk", "WHICH=a\n"));
+    QVERIFY(writeFile("include_lookup_b/lookup.mk", "WHICH=b\n"));
+    QVERIFY(writeFile("include_lookup.mk",
+                      "INCLUDE=include_lookup_a;include_lookup_b\n"
+                      "!include <lookup.mk>\n"
+                      "!include <lookup.mk>\n"));
+
+    MacroTable macroTable;
+    Preprocessor pp;
+    pp.setMacroTable(&macroTable);
+    bool exceptionCaught = false;
+    try {
+        QVERIFY(pp.openFile(QLatin1String("include_lookup.mk")));
+        while (!pp.readLine().isNull());
+        QCOMPARE(macroTable.macroValue("WHICH"), QLatin1String("a"));
+
+        // The lookup of the first parse must not be used for the next one.
+        QVERIFY(QFile::remove("include_lookup_a/lookup.mk"));
+        FastFileInfo::clearCacheForFile(QFileInfo("include_lookup_a/lookup.mk").absoluteFilePath());
+        QVERIFY(pp.openFile(QLatin1String("include_lookup.mk")));
+        while (!pp.readLine().isNull());
+        QCOMPARE(macroTable.macroValue("WHICH"), QLatin1String("b"));
+    } catch (Exception &e) {
+        qDebug() << e.message();
+        exceptionCaught = true;
+    }
+    QFile::remove("include_lookup.mk");
+    QDir("include_lookup_a").removeRecursively();
+    QDir("include_lookup_b").removeRecursively();
+    QVERIFY(!exceptionCaught);
+}
+
+void Tests::includeGuards()
+{
+    MacroTable macroTable;
+    Preprocessor pp;
+    pp.setMacroTable(&macroTable);
+    QVERIFY(pp.openFile(QLatin1String("include_guards.mk")));
+    while (!pp.readLine().isNull());
+    QCOMPARE(macroTable.macroValue("GUARDED_COUNT"), QLatin1String("x"));
+    QCOMPARE(macroTable.macroValue("UNGUARDED_COUNT"), QLatin1String("xx"));
+    QCOMPARE(macroTable.macroValue("ELSE_COUNT"), QLatin1String("x"));
+    QCOMPARE(pp.openedFiles().filter("include_guarded.mk").count(), 1);
+}
+
 void Tests::includeCycle()
 {
     MacroTable macroTable;
@@ -154,6 +218,81 @@ void Tests::macros()
     QVERIFY(!bExceptionCaught);
 }
 
+void Tests::crlfLineEndings()
+{
+    // The file has "\r\n" line ends and no newline at the end.
+    MacroTable macroTable;
+    Preprocessor pp;
+    pp.setMacroTable(&macroTable);
+    QVERIFY(pp.openFile(QLatin1String("crlflineendings.mk")));
+    while (!pp.readLine().isNull());
+    QCOMPARE(macroTable.macroValue("A"), QLatin1String("one two"));
+    QCOMPARE(macroTable.macroValue("B"), QLatin1String("three\\"));
+    QCOMPARE(macroTable.macroValue("C"), QLatin1String("four"));
+}
+
+void Tests::utf8LineContinuations()
+{
+    MacroTable macroTable;
+    Preprocessor pp;
+    pp.setMacroTable(&macroTable);
+    QVERIFY(pp.openFile(QLatin1String("utf8linecontinuations.mk")));
+    while (!pp.readLine().isNull());
+    QCOMPARE(macroTable.macroValue("A"), QString::fromUtf8("\xD0\xBA\xD1\x83\xD0\xB4\xD0\xB0 \xD1\x8F"));
+    QCOMPARE(macroTable.macroValue("B"), QLatin1String("three\\"));
+    QCOMPARE(macroTable.macroValue("C"), QString::fromUtf8("f\xC3\xBCnf"));
+}
+
+void Tests::macroExpansionMemo()
+{
+    MacroTable macroTable;
+    macroTable.setMacroValue("INNER", "one");
+    macroTable.setMacroValue("OUTER", "$(INNER) $(INNER:one=two)");
+    QCOMPARE(macroTable.expandMacros("$(OUTER)"), QLatin1String("one two"));
+    QCOMPARE(macroTable.expandMacros("$(OUTER:one=1)"), QLatin1String("1 two"));
+
+    // Redefining or undefining a macro invalidates the remembered expansions.
+    macroTable.setMacroValue("INNER", "one again");
+    QCOMPARE(macroTable.expandMacros("$(OUTER)"), QLatin1String("one again two again"));
+    macroTable.undefineMacro("INNER");
+    QCOMPARE(macroTable.expandMacros("$(OUTER)"), QLatin1String(" "));
+
+    // Cycles are still detected after an expansion has been remembered.
+    macroTable.setMacroValue("INNER", "$(OUTER)");
+    bool exceptionCaught = false;
+    try {
+        macroTable.expandMacros("$(OUTER)");
+    } catch (const Exception &) {
+        exceptionCaught = true;
+    }
+    QVERIFY(exceptionCaught);
+}
+
+void Tests::macroSelfAppend()
+{
+    MacroTable macroTable;
+    macroTable.setMacroValue("OBJECTS", "$(OBJECTS) a.obj");
+    QCOMPARE(macroTable.macroValue("OBJECTS"), QLatin1String(" a.obj"));
+    for (int i = 0; i < 10000; ++i)
+        macroTable.setMacroValue("OBJECTS", "$(OBJECTS) b.obj");
+    QCOMPARE(macroTable.macroValue("OBJECTS").length(), 6 + 10000 * 6);
+    QVERIFY(macroTable.macroValue("OBJECTS").startsWith(" a.obj b.obj"));
+    QVERIFY(macroTable.macroValue("OBJECTS").endsWith(" b.obj b.obj"));
+
+    // Self references that are not a plain prefix still replace the whole value.
+    macroTable.setMacroValue("LIST", "b");
+    macroTable.setMacroValue("LIST", "a $(LIST) c");
+    QCOMPARE(macroTable.macroValue("LIST"), QLatin1String("a b c"));
+    macroTable.setMacroValue("LIST", "$(LIST) $(LIST)");
+    QCOMPARE(macroTable.macroValue("LIST"), QLatin1String("a b c a b c"));
+
+    // Appending invalidates the remembered expansion.
+    macroTable.setMacroValue("ALL", "$(LIST)");
+    QCOMPARE(macroTable.expandMacros("$(ALL)"), QLatin1String("a b c a b c"));
+    macroTable.setMacroValue("LIST", "$(LIST) d");
+    QCOMPARE(macroTable.expandMacros("$(ALL)"), QLatin1String("a b c a b c d"));
+}
+
 void Tests::invalidMacros_data()
 {
     QTest::addColumn<QString>("expression");
@@ -332,6 +471,7 @@ void Tests::conditionals()
     QCOMPARE(macroTable->macroValue("TEST8"), QLatin1String("true"));
     QCOMPARE(macroTable->macroValue("TEST9"), QLatin1String("foo  bar  baz"));
     QCOMPARE(macroTable->macroValue("TEST10"), QLatin1String("foo  bar  boo  hoo"));
+    QCOMPARE(macroTable->macroValue("TEST11"), QLatin1String("true"));
 }
 
 void Tests::dotDirectives()
@@ -926,11 +1066,284 @@ void Tests::windowsPathsInTargetName()
     QCOMPARE(target->m_commands.count(), 2);
 }
 
-/**
- * Note: this function clears the environment of m_jomProcess after every start.
- */
-bool Tests::runJom(const QStringList &args, const QString &workingDirectory,
-                   QProcess::ProcessChannelMode channelMode)
+void Tests::parseCache()
+{
+    const QString cacheFileName = QFileInfo(QLatin1String("descriptionblocks.mk")).absoluteFilePath()
+            + QLatin1String(".jomcache");
+    QFile::remove(cacheFileName);
+
+    QStringList args;
+    args << QLatin1String("/PARSECACHE") << QLatin1String("/F") << QLatin1String("descriptionblocks.mk");
+    QVERIFY(m_makefileFactory->apply(args));
+    QScopedPointer<Makefile> parsedMakefile(m_makefileFactory->makefile());
+    QVERIFY(parsedMakefile);
+    QVERIFY(QFile::exists(cacheFileName));
+
+    QVERIFY(m_makefileFactory->apply(args));
+    QScopedPointer<Makefile> cachedMakefile(m_makefileFactory->makefile());
+    QVERIFY(cachedMakefile);
+    QFile::remove(cacheFileName);
+
+    QCOMPARE(cachedMakefile->firstTarget()->targetName(),
+             parsedMakefile->firstTarget()->targetName());
+    QCOMPARE(cachedMakefile->targets().count(), parsedMakefile->targets().count());
+    foreach (DescriptionBlock *target, parsedMakefile->targets()) {
+        DescriptionBlock *cachedTarget = cachedMakefile->target(target->targetName());
+        QVERIFY(cachedTarget);
+        QCOMPARE(cachedTarget->m_dependents, target->m_dependents);
+        QCOMPARE(cachedTarget->m_commands.count(), target->m_commands.count());
+        for (int i = 0; i < target->m_commands.count(); ++i) {
+            QCOMPARE(cachedTarget->m_commands.at(i).m_commandLine,
+                     target->m_commands.at(i).m_commandLine);
+        }
+    }
+    QCOMPARE(cachedMakefile->inferenceRules().count(), parsedMakefile->inferenceRules().count());
+}
+
+void Tests::residentMakefile()
+{
+    const QString fileName = QLatin1String("resident_test.mk");
+    const QString cacheFileName = QFileInfo(fileName).absoluteFilePath()
+            + QLatin1String(".jomcache");
+    QFile file(fileName);
+    QVERIFY(file.open(QFile::WriteOnly));
+    file.write("all: foo\n");
+    file.close();
+
+    m_makefileFactory->setResident(true);
+    QVERIFY(openMakefile(fileName));
+    QScopedPointer<Makefile> parsedMakefile(m_makefileFactory->makefile());
+    QVERIFY(parsedMakefile);
+    QVERIFY(!QFile::exists(cacheFileName));
+
+    QVERIFY(openMakefile(fileName));
+    QScopedPointer<Makefile> residentMakefile(m_makefileFactory->makefile());
+    QVERIFY(residentMakefile);
+    QCOMPARE(residentMakefile->firstTarget()->targetName(), QLatin1String("all"));
+    QCOMPARE(residentMakefile->firstTarget()->m_dependents, QStringList() << "foo");
+
+    // A changed makefile is parsed again.
+    QVERIFY(file.open(QFile::WriteOnly));
+    file.write("all: bar\n");
+    file.close();
+    QVERIFY(openMakefile(fileName));
+    QScopedPointer<Makefile> changedMakefile(m_makefileFactory->makefile());
+    m_makefileFactory->setResident(false);
+    QFile::remove(fileName);
+    QVERIFY(changedMakefile);
+    QCOMPARE(changedMakefile->firstTarget()->m_dependents, QStringList() << "bar");
+}
+
+void Tests::targetLookup()
+{
+    Makefile mkfile(QLatin1String("C:/MySourceDir/Makefile"));
+    DescriptionBlock *sub = new DescriptionBlock(&mkfile);
+    sub->setTargetName(QLatin1String("Sub\\Target.obj"));
+    mkfile.append(sub);
+    QCOMPARE(mkfile.target(QLatin1String("sub/target.OBJ")), sub);
+    QCOMPARE(mkfile.target(QLatin1String("sub/target.OBJ")), sub);
+    QVERIFY(!mkfile.target(QLatin1String("later.obj")));
+
+    // A failed lookup doesn't hide targets that are added later.
+    DescriptionBlock *later = new DescriptionBlock(&mkfile);
+    later->setTargetName(QLatin1String("Later.obj"));
+    mkfile.append(later);
+    QCOMPARE(mkfile.target(QLatin1String("later.obj")), later);
+
+    // Dependents also match targets in the makefile's directory.
+    const QString absoluteName = mkfile.dirPath() + QDir::separator() + QLatin1String("abs.obj");
+    QVERIFY(!mkfile.dependentTarget(QLatin1String("abs.obj")));
+    DescriptionBlock *absolute = new DescriptionBlock(&mkfile);
+    absolute->setTargetName(absoluteName);
+    mkfile.append(absolute);
+    QVERIFY(!mkfile.target(QLatin1String("abs.obj")));
+    QCOMPARE(mkfile.dependentTarget(QLatin1String("abs.obj")), absolute);
+    QCOMPARE(mkfile.dependentTarget(QLatin1String("later.obj")), later);
+
+    mkfile.clear();
+    QVERIFY(!mkfile.target(QLatin1String("later.obj")));
+
+    // Spellings of the same path share one id.
+    const int id = PathTable::id(QLatin1String("Sub/Dir\\Target.OBJ"));
+    QCOMPARE(PathTable::id(QLatin1String("sub\\dir/target.obj")), id);
+    QCOMPARE(PathTable::id(QLatin1String("Sub/Dir\\Target.OBJ")), id);
+    QCOMPARE(PathTable::canonicalPath(id), QLatin1String("sub\\dir\\target.obj"));
+    QVERIFY(PathTable::id(QLatin1String("sub/dir/other.obj")) != id);
+}
+
+void Tests::prefetchFileInfos()
+{
+    QVERIFY(QDir().mkpath("prefetch_a/sub"));
+    QVERIFY(QDir().mkpath("prefetch_b"));
+    QVERIFY(writeFile("prefetch_a/one.txt", "1"));
+    QVERIFY(writeFile("prefetch_a/sub/Two.txt", "22"));
+    QVERIFY(writeFile("prefetch_b/three.txt", "333"));
+    const QStringList fileNames = QStringList()
+            << "prefetch_a/one.txt" << "prefetch_a/sub/two.TXT" << "prefetch_a/sub"
+            << QFileInfo("prefetch_b/three.txt").absoluteFilePath()
+            << "prefetch_a/missing.txt" << "prefetch_b/missing.txt"
+            << "prefetch_missing/missing.txt";
+
+    struct Result
+    {
+        bool exists;
+        FileTime lastModified;
+        qint64 size;
+    };
+    auto readFileInfos = [&fileNames] () -> QVector<Result> {
+        QVector<Result> results;
+        foreach (const QString &fileName, fileNames) {
+            const FastFileInfo fi(fileName);
+            const Result result = { fi.exists(), fi.lastModified(), fi.size() };
+            results.append(result);
+        }
+        return results;
+    };
+
+    FastFileInfo::clearCache();
+    const QVector<Result> serialResults = readFileInfos();
+    FastFileInfo::clearCache();
+    FastFileInfo::prefetch(fileNames);
+    const QVector<Result> prefetchedResults = readFileInfos();
+    FastFileInfo::clearCache();
+    QDir("prefetch_a").removeRecursively();
+    QDir("prefetch_b").removeRecursively();
+
+    // The directory listings that were read in parallel yield the same attributes.
+    QCOMPARE(prefetchedResults.count(), serialResults.count());
+    for (int i = 0; i < serialResults.count(); ++i) {
+        const QByteArray fileName = fileNames.at(i).toLocal8Bit();
+        QVERIFY2(prefetchedResults.at(i).exists == serialResults.at(i).exists, fileName);
+        QVERIFY2(prefetchedResults.at(i).lastModified == serialResults.at(i).lastModified, fileName);
+        QVERIFY2(prefetchedResults.at(i).size == serialResults.at(i).size, fileName);
+    }
+    QCOMPARE(serialResults.at(0).exists, true);
+    QCOMPARE(serialResults.at(1).size, qint64(2));
+    QCOMPARE(serialResults.at(2).exists, true);
+    QCOMPARE(serialResults.at(3).size, qint64(3));
+    QCOMPARE(serialResults.at(4).exists, false);
+    QCOMPARE(serialResults.at(5).exists, false);
+    QCOMPARE(serialResults.at(6).exists, false);
+}
+
+void Tests::negativeFileInfos()
+{
+    QVERIFY(QDir().mkpath("negative_a"));
+    QVERIFY(QDir().mkpath("negative_b"));
+    FastFileInfo::clearCache();
+    QVERIFY(!FastFileInfo("negative_a/side_effect.txt").exists());
+    QVERIFY(!FastFileInfo("negative_b/side_effect.txt").exists());
+
+    // Missing files are checked again, no matter which directory they have been created in.
+    QVERIFY(writeFile("negative_a/side_effect.txt", "a"));
+    QVERIFY(writeFile("negative_b/side_effect.txt", "b"));
+    const bool sideEffectExists = FastFileInfo("negative_a/side_effect.txt").exists();
+    const bool otherSideEffectExists = FastFileInfo("negative_b/side_effect.txt").exists();
+
+    // Building a file updates its cached attributes.
+    QVERIFY(writeFile("negative_a/target.txt", "a"));
+    FastFileInfo::clearCacheForFile("negative_a/target.txt");
+    const bool targetExists = FastFileInfo("negative_a/target.txt").exists();
+
+    FastFileInfo::clearCache();
+    QDir("negative_a").removeRecursively();
+    QDir("negative_b").removeRecursively();
+    QVERIFY(sideEffectExists);
+    QVERIFY(otherSideEffectExists);
+    QVERIFY(targetExists);
+}
+
+void Tests::posixCommandLines()
+{
+#ifndef Q_OS_LINUX
+    QSKIP("POSIX command lines are handled by the Linux process backend only.");
+#else
+    const QString dirPath = QDir::currentPath() + QLatin1String("/posix_command_lines");
+    QVERIFY(QDir().mkpath(dirPath));
+    const QString currentPath = QDir::currentPath();
+    Process process;
+    process.setWorkingDirectory(dirPath);
+
+    // Quotes are interpreted by the shell. The command runs in its own working directory.
+    process.start(QLatin1String("touch 'two words.txt' plain.txt"));
+    QVERIFY(process.isRunning());
+    process.waitForFinished();
+    QCOMPARE(process.exitCode(), 0);
+    QVERIFY(QFile::exists(dirPath + QLatin1String("/two words.txt")));
+    QVERIFY(QFile::exists(dirPath + QLatin1String("/plain.txt")));
+    QCOMPARE(QDir::currentPath(), currentPath);
+
+    // Simple commands are started directly.
+    process.start(QLatin1String("rm plain.txt"));
+    QVERIFY(process.isRunning());
+    process.waitForFinished();
+    QCOMPARE(process.exitCode(), 0);
+    QVERIFY(!QFile::exists(dirPath + QLatin1String("/plain.txt")));
+
+    process.start(QLatin1String("sh -c 'exit 3'"));
+    process.waitForFinished();
+    QCOMPARE(process.exitCode(), 3);
+
+    // The shell reports commands that don't exist.
+    process.start(QLatin1String("jom_nonexistent_command"));
+    QVERIFY(process.isRunning());
+    process.waitForFinished();
+    QCOMPARE(process.exitCode(), 127);
+
+    QDir(dirPath).removeRecursively();
+#endif
+}
+
+void Tests::depFiles()
+{
+    QStringList dependents;
+    QVERIFY(DepsLog::readDepFile(QLatin1String("depfile.d"), &dependents));
+    QCOMPARE(dependents, QStringList()
+             << "C:\\src\\foo.cpp"
+             << "C:/src/foo.h"
+             << "../include/with space.h"
+             << "hash#sign.h"
+             << "dollar$.h");
+    QVERIFY(!DepsLog::readDepFile(QLatin1String("nonexistent.d"), &dependents));
+
+    const QString logFileName = QLatin1String("depfiles_test.jomdeps");
+    QFile::remove(logFileName);
+    {
+        DepsLog depsLog(logFileName);
+        QVERIFY(!depsLog.load());
+        QVERIFY(depsLog.dependents(QLatin1String("foo.obj")).isEmpty());
+        QVERIFY(depsLog.recordDependents(QLatin1String("foo.obj"), QStringList() << "a.h" << "b.h"));
+        QVERIFY(depsLog.recordDependents(QLatin1String("bar.obj"), QStringList() << "b.h"));
+        QVERIFY(depsLog.recordDependents(QLatin1String("foo.obj"), QStringList() << "c.h"));
+    }
+    {
+        DepsLog depsLog(logFileName);
+        QVERIFY(depsLog.load());
+        QCOMPARE(depsLog.dependents(QLatin1String("FOO.obj")), QStringList() << "c.h");
+        QCOMPARE(depsLog.dependents(QLatin1String("bar.obj")), QStringList() << "b.h");
+    }
+
+    // A truncated record at the end is dropped.
+    QFile file(logFileName);
+    QVERIFY(file.open(QFile::ReadWrite));
+    QVERIFY(file.resize(file.size() - 2));
+    file.close();
+    {
+        DepsLog depsLog(logFileName);
+        QVERIFY(depsLog.load());
+        QCOMPARE(depsLog.dependents(QLatin1String("foo.obj")), QStringList() << "a.h" << "b.h");
+        QVERIFY(depsLog.recordDependents(QLatin1String("foo.obj"), QStringList() << "d.h"));
+    }
+    {
+        DepsLog depsLog(logFileName);
+        QVERIFY(depsLog.load());
+        QCOMPARE(depsLog.dependents(QLatin1String("foo.obj")), QStringList() << "d.h");
+        QCOMPARE(depsLog.dependents(QLatin1String("bar.obj")), QStringList() << "b.h");
+    }
+    QFile::remove(logFileName);
+}
+
+static QString jomBinaryPath()
 {
 #ifdef _DEBUG
     const QLatin1String jomBinaryName("jomd.exe");
@@ -944,6 +1357,16 @@ bool Tests::runJom(const QStringList &args, const QString &workingDirectory,
             qDebug("could not find jom");
         }
     }
+    return jomBinary;
+}
+
+/**
+ * Note: this function clears the environment of m_jomProcess after every start.
+ */
+bool Tests::runJom(const QStringList &args, const QString &workingDirectory,
+                   QProcess::ProcessChannelMode channelMode)
+{
+    const QString jomBinary = jomBinaryPath();
     QString oldWorkingDirectory;
     if (!workingDirectory.isNull()) {
         oldWorkingDirectory = QDir::currentPath();
@@ -1199,6 +1622,33 @@ void Tests::builtin_cd()
     QVERIFY(success);
 }
 
+void Tests::builtinCommands()
+{
+    QVERIFY(runJom(QStringList() << "/nologo" << "/f" << "commands.mk", "blackbox/builtins",
+                   QProcess::SeparateChannels));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QList<QByteArray> output = splitOutput(m_jomProcess->readAllStandardOutput());
+    QCOMPARE(output.takeFirst(), QByteArray("hello"));
+    QCOMPARE(output.takeFirst(), QByteArray("world"));
+    QCOMPARE(output.takeFirst(), QByteArray("1 file(s) copied."));
+    QCOMPARE(output.takeFirst(), QByteArray("b exists"));
+    QCOMPARE(output.takeFirst(), QByteArray("done"));
+    QCOMPARE(output.takeFirst(), QByteArray());
+    QVERIFY(output.isEmpty());
+
+    const QByteArray errorOutput = m_jomProcess->readAllStandardError();
+    QVERIFY(errorOutput.contains("A subdirectory or file out already exists."));
+    QVERIFY(errorOutput.contains("The system cannot find the file specified."));
+    QVERIFY(errorOutput.contains("Could Not Find "));
+    QVERIFY(!errorOutput.contains("missing.txt"));
+
+    QVERIFY(QFile::exists("blackbox/builtins/out/b.txt"));
+    QVERIFY(QFileInfo("blackbox/builtins/out/sub/dir").isDir());
+    QVERIFY(!QFile::exists("blackbox/builtins/out/a.txt"));
+    QVERIFY(runJom(QStringList() << "/nologo" << "/f" << "commands.mk" << "clean",
+                   "blackbox/builtins"));
+}
+
 void Tests::suffixes()
 {
     QVERIFY(runJom(QStringList() << "/nologo" << "/f" << "test.mk", "blackbox/suffixes"));
@@ -1289,6 +1739,12 @@ void Tests::nonexistentDependent()
     QVERIFY(!output.contains("we should not see this"));
     QEXPECT_FAIL("", "behaviour difference to nmake", Continue);
     QVERIFY(output.contains("yo ho ho ho"));
+
+    // The dependents of later command line targets are checked after building the first ones.
+    QVERIFY(runJom(QStringList() << "/nologo" << "/f" << "test.mk" << "yo" << "out",
+                   "blackbox/nonexistentdependent"));
+    QCOMPARE(m_jomProcess->exitCode(), 2);
+    QVERIFY(m_jomProcess->readAllStandardError().contains("Error: dependent 'notexist' does not exist."));
 }
 
 void Tests::noTargets()
@@ -1362,4 +1818,351 @@ void Tests::outOfDateCheck()
     QVERIFY(output.isEmpty());
 }
 
+void Tests::criticalPath()
+{
+    const QString logFileName = QFileInfo(QLatin1String("blackbox/criticalpath/test.mk.jomlog")).absoluteFilePath();
+    QFile::remove(logFileName);
+
+    for (int i = 0; i < 2; ++i) {
+        QVERIFY(runJom(QStringList() << "/nologo" << "/j2" << "/CRITICALPATH" << "/f" << "test.mk",
+                       "blackbox/criticalpath"));
+        QCOMPARE(m_jomProcess->exitCode(), 0);
+        QStringList output = readJomStdOutput();
+        QCOMPARE(output.count(), 4);
+        QCOMPARE(output.last(), QLatin1String("all"));
+    }
+
+    BuildHistory history(logFileName);
+    QVERIFY(history.load());
+    QFile::remove(logFileName);
+    QVERIFY(history.duration(QLatin1String("all")) >= 0);
+    QVERIFY(history.duration(QLatin1String("long")) >= 0);
+    QVERIFY(history.duration(QLatin1String("long_step")) >= 0);
+    QVERIFY(history.duration(QLatin1String("short")) >= 0);
+    QCOMPARE(history.duration(QLatin1String("unknown")), qint64(-1));
+
+    // Without recorded durations, the leaf of the path with more targets starts first.
+    const QStringList arguments = QStringList() << "/nologo" << "/j1" << "/CRITICALPATH"
+                                                << "/f" << "test.mk";
+    QVERIFY(runJom(arguments, "blackbox/criticalpath"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput().first(), QLatin1String("long_step"));
+    QFile::remove(logFileName);
+
+    // With recorded durations, the leaf of the longest path starts first.
+    BuildHistory slowShort(logFileName);
+    slowShort.setDuration(QLatin1String("long_step"), 100);
+    slowShort.setDuration(QLatin1String("long"), 100);
+    slowShort.setDuration(QLatin1String("short"), 5000);
+    QVERIFY(slowShort.save());
+    QVERIFY(runJom(arguments, "blackbox/criticalpath"));
+    QFile::remove(logFileName);
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput().first(), QLatin1String("short"));
+
+    BuildHistory slowLong(logFileName);
+    slowLong.setDuration(QLatin1String("long_step"), 5000);
+    slowLong.setDuration(QLatin1String("long"), 100);
+    slowLong.setDuration(QLatin1String("short"), 1000);
+    QVERIFY(slowLong.save());
+    QVERIFY(runJom(arguments, "blackbox/criticalpath"));
+    QFile::remove(logFileName);
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput().first(), QLatin1String("long_step"));
+}
+
+void Tests::contentHashes()
+{
+    QCOMPARE(ContentHashes::hash("", 0), Q_UINT64_C(0xef46db3751d8e999));
+    QCOMPARE(ContentHashes::hash("abc", 3), Q_UINT64_C(0x44bc2cf5ad770999));
+    const char longText[] = "Nobody inspects the spammish repetition";
+    QCOMPARE(ContentHashes::hash(longText, sizeof(longText) - 1), Q_UINT64_C(0xfbcea83c8a378bf1));
+
+    const QString inFileName = QLatin1String("blackbox/contenthash/in.txt");
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/CONTENTHASH" << "/f" << "test.mk"
+                   << "clean" << "all", "blackbox/contenthash"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), QStringList() << "out.txt");
+
+    // Rewriting the dependent with the same content doesn't trigger a rebuild.
+    QFile inFile(inFileName);
+    QVERIFY(inFile.open(QFile::ReadOnly));
+    const QByteArray content = inFile.readAll();
+    inFile.close();
+    QVERIFY(inFile.open(QFile::WriteOnly));
+    inFile.write(content);
+    inFile.close();
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/CONTENTHASH" << "/f" << "test.mk",
+                   "blackbox/contenthash"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QVERIFY(readJomStdOutput().isEmpty());
+
+    // Changing the content does.
+    QVERIFY(inFile.open(QFile::WriteOnly));
+    inFile.write("changed\r\n");
+    inFile.close();
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/CONTENTHASH" << "/f" << "test.mk",
+                   "blackbox/contenthash"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), QStringList() << "out.txt");
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk" << "clean",
+                   "blackbox/contenthash"));
+}
+
+void Tests::restat()
+{
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk" << "clean" << "all",
+                   "blackbox/restat"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), QStringList() << "gen.txt" << "out.txt");
+
+    // gen.txt is regenerated with the same content. out.txt is not rebuilt.
+    touchFile("blackbox/restat/input.txt");
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk", "blackbox/restat"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), QStringList() << "gen.txt");
+
+    // gen.txt keeps its new time stamp and is up-to-date. The restat record in the
+    // build log keeps out.txt up-to-date, too.
+    QVERIFY(QFile::exists("blackbox/restat/test.mk.jomlog"));
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk", "blackbox/restat"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), QStringList());
+
+    // A real change of gen.txt still rebuilds out.txt.
+    touchFile("blackbox/restat/gen.txt");
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk", "blackbox/restat"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), QStringList() << "out.txt");
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk" << "clean",
+                   "blackbox/restat"));
+}
+
+void Tests::implicitDependents()
+{
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk" << "clean",
+                   "blackbox/depfiles"));
+    QFile header(QLatin1String("blackbox/depfiles/header.h"));
+    QVERIFY(header.open(QFile::WriteOnly));
+    header.close();
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk", "blackbox/depfiles"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), QStringList() << "foo.out");
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk", "blackbox/depfiles"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QVERIFY(readJomStdOutput().isEmpty());
+
+    // The header is known from the depfile of the previous build.
+    touchFile("blackbox/depfiles/header.h");
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk", "blackbox/depfiles"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), QStringList() << "foo.out");
+
+    // A removed header is no error. It just makes the target out of date.
+    QVERIFY(header.remove());
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk", "blackbox/depfiles"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), QStringList() << "foo.out");
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk" << "clean",
+                   "blackbox/depfiles"));
+
+    // Cycles that are closed by implicit dependents are errors.
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "cycle.mk" << "clean",
+                   "blackbox/depfiles"));
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "cycle.mk", "blackbox/depfiles"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), QStringList() << "foo.out" << "bar.out");
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "cycle.mk", "blackbox/depfiles"));
+    QCOMPARE(m_jomProcess->exitCode(), 2);
+    QVERIFY(m_jomProcess->readAllStandardError().contains("cycle in targets detected"));
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "cycle.mk" << "clean",
+                   "blackbox/depfiles"));
+}
+
+void Tests::watchForChanges_data()
+{
+    QTest::addColumn<QString>("makefile");
+    QTest::addColumn<QString>("inputFile");
+    QTest::addColumn<QByteArray>("target");
+    QTest::newRow("explicit") << QString("test.mk") << QString("input.txt")
+                              << QByteArray("out.txt");
+    QTest::newRow("inference rule") << QString("inference.mk") << QString("source.c")
+                                    << QByteArray("source.obj");
+}
+
+void Tests::watchForChanges()
+{
+    QFETCH(QString, makefile);
+    QFETCH(QString, inputFile);
+    QFETCH(QByteArray, target);
+    QVERIFY(runJom(QStringList() << "/nologo" << "/f" << makefile << "clean", "blackbox/watch"));
+    QFile input(QLatin1String("blackbox/watch/") + inputFile);
+    QVERIFY(input.open(QFile::WriteOnly));
+    input.close();
+
+    QProcess jom;
+    jom.setWorkingDirectory(QLatin1String("blackbox/watch"));
+    jom.start(jomBinaryPath(), QStringList() << "/nologo" << "/j1" << "/WATCH" << "/f" << makefile);
+    QVERIFY(jom.waitForStarted());
+    QByteArray output;
+    auto waitForWatching = [&jom, &output] () -> bool {
+        output.clear();
+        while (!output.contains("jom: Watching 1 files for changes.")) {
+            if (!jom.waitForReadyRead(10000))
+                return false;
+            output += jom.readAllStandardOutput();
+        }
+        return true;
+    };
+    QVERIFY(waitForWatching());
+    QCOMPARE(splitOutput(output).first(), target);
+
+    // Changing the dependent builds the target again without restarting jom.
+    touchFile(input.fileName());
+    QVERIFY(waitForWatching());
+    QCOMPARE(splitOutput(output).first(), target);
+
+    jom.kill();
+    jom.waitForFinished();
+    QVERIFY(runJom(QStringList() << "/nologo" << "/f" << makefile << "clean", "blackbox/watch"));
+}
+
+void Tests::buildServer()
+{
+    QProcess server;
+    server.setWorkingDirectory(QLatin1String("blackbox/server"));
+    server.start(jomBinaryPath(), QStringList() << "/SERVER");
+    QVERIFY(server.waitForStarted());
+    QByteArray serverOutput;
+    while (!serverOutput.contains("jom: Serving builds")) {
+        QVERIFY(server.waitForReadyRead(10000));
+        serverOutput += server.readAllStandardOutput();
+    }
+
+    // The output of the build is streamed to the client.
+    const QStringList clientArguments = QStringList() << "/CLIENT" << "/nologo" << "/f" << "test.mk";
+    QVERIFY(runJom(clientArguments + (QStringList() << "VALUE=one"), "blackbox/server"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), QStringList() << "build one");
+
+    // The exit code of a failed build is passed to the client, and the server keeps running.
+    QVERIFY(runJom(clientArguments + (QStringList() << "fail"), "blackbox/server"));
+    QCOMPARE(m_jomProcess->exitCode(), 2);
+    QVERIFY(readJomStdOutput().contains("failing"));
+    QCOMPARE(server.state(), QProcess::Running);
+
+    // Macro definitions of one request don't leak into the next one.
+    QVERIFY(runJom(clientArguments, "blackbox/server"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), QStringList() << "build");
+    QCOMPARE(server.state(), QProcess::Running);
+
+    server.kill();
+    server.waitForFinished();
+}
+
+void Tests::combineTargets()
+{
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk" << "one" << "two",
+                   "blackbox/combinetargets"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QStringList output = readJomStdOutput();
+    QCOMPARE(output, QStringList() << "common" << "one" << "common" << "two");
+
+    // All targets share one dependency graph. The common dependent is built once.
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/COMBINETARGETS" << "/f" << "test.mk"
+                   << "one" << "two", "blackbox/combinetargets"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    output = readJomStdOutput();
+    QCOMPARE(output, QStringList() << "common" << "one" << "two");
+}
+
+void Tests::recursiveMakeInProcess()
+{
+    const QStringList expectedOutput = QStringList() << "top" << "sub" << "other" << "top again";
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk",
+                   "blackbox/recursivemake"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), expectedOutput);
+
+    // The sub-makes are built in-process with the same result.
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/INPROCESSMAKE" << "/f" << "test.mk",
+                   "blackbox/recursivemake"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), expectedOutput);
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/INPROCESSMAKE" << "/f" << "test.mk" << "fail",
+                   "blackbox/recursivemake"));
+    QCOMPARE(m_jomProcess->exitCode(), 2);
+    QVERIFY(!readJomStdOutput().contains("not reached"));
+}
+
+void Tests::shellPool()
+{
+    const QStringList arguments = QStringList() << "/nologo" << "/j1" << "/f" << "test.mk";
+    QVERIFY(runJom(arguments, "blackbox/shellpool"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    const QStringList expectedOutput = readJomStdOutput();
+    QCOMPARE(expectedOutput.count(), 5);
+    QCOMPARE(expectedOutput.at(2), QString("%JOM_SHELLPOOL_TEST%"));
+    QVERIFY(expectedOutput.last().endsWith("shellpool"));
+
+    // Changes of the environment and the working directory don't leak into the next command.
+    QVERIFY(runJom(QStringList(arguments) << "/SHELLPOOL", "blackbox/shellpool"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QCOMPARE(readJomStdOutput(), expectedOutput);
+
+    QVERIFY(runJom(QStringList(arguments) << "/SHELLPOOL" << "failure", "blackbox/shellpool",
+                   QProcess::SeparateChannels));
+    QCOMPARE(m_jomProcess->exitCode(), 2);
+    QVERIFY(readJomStdOutput().isEmpty());
+    QVERIFY(m_jomProcess->readAllStandardError().contains("[failure] Error 1"));
+
+    QVERIFY(runJom(QStringList(arguments) << "/SHELLPOOL" << "exit", "blackbox/shellpool",
+                   QProcess::SeparateChannels));
+    QCOMPARE(m_jomProcess->exitCode(), 2);
+    QVERIFY(readJomStdOutput().isEmpty());
+    QVERIFY(m_jomProcess->readAllStandardError().contains("[exit] Error 3"));
+}
+
+void Tests::jobServerMakeFlags()
+{
+    QCOMPARE(JobServer::jomFlagsFromMakeFlags("LJ4"), QString("LJ4"));
+    QCOMPARE(JobServer::jomFlagsFromMakeFlags(" -j8 --jobserver-auth=fifo:/tmp/GMfifo42"), QString());
+    QCOMPARE(JobServer::jomFlagsFromMakeFlags("ks -j8 --jobserver-auth=3,4"), QString("ks"));
+
+    QCOMPARE(JobServer::authFromMakeFlags("LJ4"), QString());
+    QCOMPARE(JobServer::authFromMakeFlags(" -j8 --jobserver-auth=fifo:/tmp/GMfifo42"),
+             QString("fifo:/tmp/GMfifo42"));
+    QCOMPARE(JobServer::authFromMakeFlags("-j4 --jobserver-fds=3,4"), QString("3,4"));
+    QCOMPARE(JobServer::authFromMakeFlags("-j4 --jobserver-auth=gmake_semaphore_1 -- X=--jobserver-auth=foo"),
+             QString("gmake_semaphore_1"));
+
+    QCOMPARE(JobServer::jobCountFromMakeFlags(" -j8 --jobserver-auth=3,4"), 8);
+    QCOMPARE(JobServer::jobCountFromMakeFlags("ks"), 0);
+
+    ProcessEnvironment environment;
+    environment.insert(QLatin1String("MAKEFLAGS"), QLatin1String("LJ4"));
+    JobServer::advertiseInMakeFlags(&environment, QLatin1String("fifo:/tmp/jomfifo"), 4);
+    QCOMPARE(environment.value(QLatin1String("MAKEFLAGS")),
+             QString("L -j4 --jobserver-auth=fifo:/tmp/jomfifo"));
+
+    // Only the /J flag and its job count are removed.
+    environment.insert(QLatin1String("MAKEFLAGS"), QLatin1String("Kj12S"));
+    JobServer::advertiseInMakeFlags(&environment, QLatin1String("fifo:/tmp/jomfifo"), 12);
+    QCOMPARE(environment.value(QLatin1String("MAKEFLAGS")),
+             QString("KS -j12 --jobserver-auth=fifo:/tmp/jomfifo"));
+    environment.insert(QLatin1String("MAKEFLAGS"), QLatin1String("Jk"));
+    JobServer::advertiseInMakeFlags(&environment, QLatin1String("fifo:/tmp/jomfifo"), 2);
+    QCOMPARE(environment.value(QLatin1String("MAKEFLAGS")),
+             QString("Jk -j2 --jobserver-auth=fifo:/tmp/jomfifo"));
+}
+
 QTEST_MAIN(Tests)
@@ -41,7 +41,13 @@ private slots:
     // preprocessor tests
     void includeFiles();
     void includeCycle();
+    void includeGuards();
+    void includeFileLookups();
     void macros();
+    void crlfLineEndings();
+    void utf8LineContinuations();
+    void macroExpansionMemo();
+    void macroSelfAppend();
     void invalidMacros_data();
     void invalidMacros();
     void preprocessorExpressions_data();
@@ -65,6 +71,13 @@ private slots:
     void fileNameMacrosInDependents();
     void wildcardsInDependencies();
     void windowsPathsInTargetName();
+    void parseCache();
+    void residentMakefile();
+    void targetLookup();
+    void prefetchFileInfos();
+    void negativeFileInfos();
+    void posixCommandLines();
+    void depFiles();
 
     // black-box tests
     void buildUnrelatedTargetsOnError();
@@ -79,12 +92,24 @@ private slots:
     void unicodeFiles();
     void builtin_cd_data();
     void builtin_cd();
+    void builtinCommands();
     void suffixes();
     void macrosOnCommandLine_data();
     void macrosOnCommandLine();
     void nonexistentDependent();
     void noTargets();
     void outOfDateCheck();
+    void criticalPath();
+    void contentHashes();
+    void restat();
+    void implicitDependents();
+    void watchForChanges_data();
+    void watchForChanges();
+    void buildServer();
+    void combineTargets();
+    void recursiveMakeInProcess();
+    void shellPool();
+    void jobServerMakeFlags();
 
 private:
     bool openMakefile(const QString& fileName);